@@ -0,0 +1,390 @@
+/* 
+ * File:    aes.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ *
+ * AES-128 (FIPS-197) with AES-NI on x86 (GCC or compatible compilers only),
+ * selected at run-time, and a straightforward byte-oriented implementation
+ * elsewhere.  The software version is meant for testing and portability, not
+ * speed, and is not hardened against timing attacks.
+ */
+
+#include <string.h>
+#include "aes.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define AES_X86
+#define WAYS	4				/* blocks in flight */
+#include <immintrin.h>
+#endif
+
+#define NB		AES_BLOCKSZ
+#define NR		AES_ROUNDS
+
+typedef void (*bulk_f)(const struct aes_key*, const unsigned char*,
+					   unsigned char*, size_t);
+
+static void init_tables(void);
+static void select_impl(void);
+static void encrypt_soft(const struct aes_key*, const unsigned char*,
+						 unsigned char*, size_t);
+static void decrypt_soft(const struct aes_key*, const unsigned char*,
+						 unsigned char*, size_t);
+
+static unsigned char Gsbox[256], Ginv_sbox[256];
+static bulk_f Gencrypt, Gdecrypt;
+static const char *Gimpl;
+static int Gaesni;
+
+/** Multiply by x in GF(2^8). */
+static inline unsigned char xtime(unsigned char a)
+{
+	return (a << 1) ^ ((a & 0x80) ? 0x1B : 0);
+}
+
+/** Multiply in GF(2^8). */
+static unsigned char gmul(unsigned char a, unsigned char b)
+{
+	unsigned char p = 0;
+
+	for(; b; b >>= 1, a = xtime(a))
+		if(b & 1)
+			p ^= a;
+	return p;
+}
+
+static inline unsigned char rotl8(unsigned char x, int n)
+{
+	return (x << n) | (x >> (8-n));
+}
+
+/**
+ * Compute the S-boxes by walking the multiplicative group with generator 3
+ * and its inverse.  Concurrent calls are harmless since they all store the
+ * same values.
+ */
+static void init_tables(void)
+{
+	unsigned char p = 1, q = 1, x;
+	int i;
+
+	do {
+		p = p ^ xtime(p);
+		q ^= q << 1;
+		q ^= q << 2;
+		q ^= q << 4;
+		if(q & 0x80)
+			q ^= 0x09;
+		x = q ^ rotl8(q, 1) ^ rotl8(q, 2) ^ rotl8(q, 3) ^ rotl8(q, 4);
+		Gsbox[p] = x ^ 0x63;
+	} while(p != 1);
+	Gsbox[0] = 0x63;
+	for(i = 0; i < 256; i++)
+		Ginv_sbox[Gsbox[i]] = i;
+}
+
+#ifdef AES_X86
+
+__attribute__((target("aes,sse2")))
+static void setup_aesni(struct aes_key *ks)
+{
+	int i;
+
+	memcpy(ks->dk[0], ks->ek[NR], NB);
+	for(i = 1; i < NR; i++)
+		_mm_storeu_si128((__m128i*)ks->dk[i], _mm_aesimc_si128(
+							 _mm_loadu_si128((const __m128i*)ks->ek[NR-i])));
+	memcpy(ks->dk[NR], ks->ek[0], NB);
+}
+
+__attribute__((target("aes,sse2")))
+static void encrypt_aesni(const struct aes_key *ks, const unsigned char *src,
+						  unsigned char *dst, size_t n)
+{
+	__m128i rk[NR+1], x[WAYS];
+	size_t i;
+	int r, j;
+
+	for(r = 0; r <= NR; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)ks->ek[r]);
+	for(i = 0; i + WAYS <= n; i += WAYS) {
+		for(j = 0; j < WAYS; j++)
+			x[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + NB*(i+j))),
+								 rk[0]);
+		for(r = 1; r < NR; r++)
+			for(j = 0; j < WAYS; j++)
+				x[j] = _mm_aesenc_si128(x[j], rk[r]);
+		for(j = 0; j < WAYS; j++)
+			_mm_storeu_si128((__m128i*)(dst + NB*(i+j)),
+							 _mm_aesenclast_si128(x[j], rk[NR]));
+	}
+	for(; i < n; i++) {
+		x[0] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + NB*i)), rk[0]);
+		for(r = 1; r < NR; r++)
+			x[0] = _mm_aesenc_si128(x[0], rk[r]);
+		_mm_storeu_si128((__m128i*)(dst + NB*i), _mm_aesenclast_si128(x[0], rk[NR]));
+	}
+}
+
+__attribute__((target("aes,sse2")))
+static void decrypt_aesni(const struct aes_key *ks, const unsigned char *src,
+						  unsigned char *dst, size_t n)
+{
+	__m128i rk[NR+1], x[WAYS];
+	size_t i;
+	int r, j;
+
+	for(r = 0; r <= NR; r++)
+		rk[r] = _mm_loadu_si128((const __m128i*)ks->dk[r]);
+	for(i = 0; i + WAYS <= n; i += WAYS) {
+		for(j = 0; j < WAYS; j++)
+			x[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + NB*(i+j))),
+								 rk[0]);
+		for(r = 1; r < NR; r++)
+			for(j = 0; j < WAYS; j++)
+				x[j] = _mm_aesdec_si128(x[j], rk[r]);
+		for(j = 0; j < WAYS; j++)
+			_mm_storeu_si128((__m128i*)(dst + NB*(i+j)),
+							 _mm_aesdeclast_si128(x[j], rk[NR]));
+	}
+	for(; i < n; i++) {
+		x[0] = _mm_xor_si128(_mm_loadu_si128((const __m128i*)(src + NB*i)), rk[0]);
+		for(r = 1; r < NR; r++)
+			x[0] = _mm_aesdec_si128(x[0], rk[r]);
+		_mm_storeu_si128((__m128i*)(dst + NB*i), _mm_aesdeclast_si128(x[0], rk[NR]));
+	}
+}
+
+#endif	/* AES_X86 */
+
+static void select_impl(void)
+{
+	bulk_f enc = encrypt_soft, dec = decrypt_soft;
+	const char *impl = "software";
+
+	init_tables();
+#ifdef AES_X86
+	__builtin_cpu_init();
+	if(__builtin_cpu_supports("aes")) {
+		enc = encrypt_aesni;
+		dec = decrypt_aesni;
+		impl = "aes-ni";
+		Gaesni = 1;
+	}
+#endif
+	Gencrypt = enc;
+	Gdecrypt = dec;
+	Gimpl = impl;
+}
+
+void aes_setup(struct aes_key *ks)
+{
+	static const unsigned char rcon[NR] = {
+		0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80, 0x1B, 0x36
+	};
+	unsigned char *w = ks->ek[0], t[4], u;
+	int i;
+
+	if(!Gimpl)
+		select_impl();
+
+	memcpy(w, ks->key, AES_KEYLEN);
+	for(i = AES_KEYLEN/4; i < 4*(NR+1); i++) {
+		memcpy(t, w + 4*(i-1), 4);
+		if(i % (AES_KEYLEN/4) == 0) {
+			u = t[0];
+			t[0] = Gsbox[t[1]] ^ rcon[i/(AES_KEYLEN/4) - 1];
+			t[1] = Gsbox[t[2]];
+			t[2] = Gsbox[t[3]];
+			t[3] = Gsbox[u];
+		}
+		w[4*i+0] = w[4*(i-4)+0] ^ t[0];
+		w[4*i+1] = w[4*(i-4)+1] ^ t[1];
+		w[4*i+2] = w[4*(i-4)+2] ^ t[2];
+		w[4*i+3] = w[4*(i-4)+3] ^ t[3];
+	}
+	memset(ks->dk, 0, sizeof(ks->dk));
+#ifdef AES_X86
+	if(Gaesni)
+		setup_aesni(ks);
+#endif
+}
+
+void aes_encrypt_blocks(const struct aes_key *ks, const void *src, void *dst,
+						size_t n)
+{
+	if(!Gencrypt)
+		select_impl();
+	Gencrypt(ks, src, dst, n);
+}
+
+void aes_decrypt_blocks(const struct aes_key *ks, const void *src, void *dst,
+						size_t n)
+{
+	if(!Gdecrypt)
+		select_impl();
+	Gdecrypt(ks, src, dst, n);
+}
+
+const char *aes_impl(void)
+{
+	if(!Gimpl)
+		select_impl();
+	return Gimpl;
+}
+
+/* The state is kept in input byte order, i.e. column-major. */
+
+static void add_round_key(unsigned char *s, const unsigned char *rk)
+{
+	int i;
+
+	for(i = 0; i < NB; i++)
+		s[i] ^= rk[i];
+}
+
+static void sub_shift_rows(unsigned char *s, const unsigned char *box, int inv)
+{
+	unsigned char t[NB];
+	int r, c;
+
+	for(c = 0; c < 4; c++)
+		for(r = 0; r < 4; r++) {
+			if(inv)
+				t[r + 4*((c+r) % 4)] = box[s[r + 4*c]];
+			else
+				t[r + 4*c] = box[s[r + 4*((c+r) % 4)]];
+		}
+	memcpy(s, t, NB);
+}
+
+static void mix_columns(unsigned char *s, const unsigned char m[4])
+{
+	unsigned char a[4];
+	int r, c;
+
+	for(c = 0; c < 4; c++) {
+		memcpy(a, s + 4*c, 4);
+		for(r = 0; r < 4; r++)
+			s[4*c + r] = gmul(a[0], m[(4-r) % 4]) ^ gmul(a[1], m[(5-r) % 4])
+				^ gmul(a[2], m[(6-r) % 4]) ^ gmul(a[3], m[(7-r) % 4]);
+	}
+}
+
+static void encrypt_soft(const struct aes_key *ks, const unsigned char *src,
+						 unsigned char *dst, size_t n)
+{
+	static const unsigned char mix[4] = { 2, 3, 1, 1 };
+	unsigned char s[NB];
+	size_t i;
+	int r;
+
+	for(i = 0; i < n; i++, src += NB, dst += NB) {
+		memcpy(s, src, NB);
+		add_round_key(s, ks->ek[0]);
+		for(r = 1; r <= NR; r++) {
+			sub_shift_rows(s, Gsbox, 0);
+			if(r < NR)
+				mix_columns(s, mix);
+			add_round_key(s, ks->ek[r]);
+		}
+		memcpy(dst, s, NB);
+	}
+}
+
+static void decrypt_soft(const struct aes_key *ks, const unsigned char *src,
+						 unsigned char *dst, size_t n)
+{
+	static const unsigned char mix[4] = { 14, 11, 13, 9 };
+	unsigned char s[NB];
+	size_t i;
+	int r;
+
+	for(i = 0; i < n; i++, src += NB, dst += NB) {
+		memcpy(s, src, NB);
+		add_round_key(s, ks->ek[NR]);
+		for(r = NR-1; r >= 0; r--) {
+			sub_shift_rows(s, Ginv_sbox, 1);
+			add_round_key(s, ks->ek[r]);
+			if(r > 0)
+				mix_columns(s, mix);
+		}
+		memcpy(dst, s, NB);
+	}
+}
+
+#ifdef AES_TEST
+
+#include <stdio.h>
+#include <stdlib.h>
+
+/* FIPS-197, appendix C.1, followed by a comparison of implementations. */
+
+int main(void)
+{
+	static const unsigned char pt[NB] = {
+		0x00, 0x11, 0x22, 0x33, 0x44, 0x55, 0x66, 0x77,
+		0x88, 0x99, 0xAA, 0xBB, 0xCC, 0xDD, 0xEE, 0xFF
+	};
+	static const unsigned char ct[NB] = {
+		0x69, 0xC4, 0xE0, 0xD8, 0x6A, 0x7B, 0x04, 0x30,
+		0xD8, 0xCD, 0xB7, 0x80, 0x70, 0xB4, 0xC5, 0x5A
+	};
+	static unsigned char buf1[NB*1027], buf2[NB*1027], buf3[NB*1027];
+	struct aes_key key;
+	unsigned char out[NB];
+	size_t i;
+	int err = 0;
+
+	for(i = 0; i < AES_KEYLEN; i++)
+		key.key[i] = i;
+	aes_setup(&key);
+
+	aes_encrypt_blocks(&key, pt, out, 1);
+	if(memcmp(out, ct, NB))
+		printf("ENCRYPTION ERROR (%s)!\n", aes_impl()), err = 1;
+	aes_decrypt_blocks(&key, ct, out, 1);
+	if(memcmp(out, pt, NB))
+		printf("DECRYPTION ERROR (%s)!\n", aes_impl()), err = 1;
+
+	encrypt_soft(&key, pt, out, 1);
+	if(memcmp(out, ct, NB))
+		printf("ENCRYPTION ERROR (software)!\n"), err = 1;
+	for(i = 0; i < sizeof(buf1); i++)
+		buf1[i] = rand();
+	encrypt_soft(&key, buf1, buf2, sizeof(buf1)/NB);
+	aes_encrypt_blocks(&key, buf1, buf3, sizeof(buf1)/NB);
+	if(memcmp(buf2, buf3, sizeof(buf2)))
+		printf("BULK ENCRYPTION MISMATCH (%s)!\n", aes_impl()), err = 1;
+	aes_decrypt_blocks(&key, buf3, buf3, sizeof(buf1)/NB);
+	decrypt_soft(&key, buf2, buf2, sizeof(buf1)/NB);
+	if(memcmp(buf1, buf2, sizeof(buf1)) || memcmp(buf1, buf3, sizeof(buf1)))
+		printf("BULK DECRYPTION MISMATCH (%s)!\n", aes_impl()), err = 1;
+
+	printf("%s: %s\n", aes_impl(), err ? "FAILED" : "OK");
+	return err;
+}
+
+#endif	/* AES_TEST */
@@ -0,0 +1,66 @@
+/* 
+ * File:    aes.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Interfaces for AES-128 encryption.
+ */
+
+#ifndef AES_H__
+#define AES_H__
+
+#include <stddef.h>
+
+#define AES_BLOCKSZ	16			/* (bytes) */
+#define AES_KEYLEN	16			/* (bytes) */
+#define AES_ROUNDS	10			/* # of rounds */
+
+struct aes_key {
+	unsigned char key[AES_KEYLEN];
+	unsigned char ek[AES_ROUNDS+1][AES_BLOCKSZ];	/* encryption schedule */
+	unsigned char dk[AES_ROUNDS+1][AES_BLOCKSZ];	/* AES-NI decryption schedule */
+};
+
+/**
+ * Expand the key.  On entry, the ks->key field must be initialized with the
+ * desired key.
+ */
+void aes_setup(struct aes_key *ks);
+
+/**
+ * Encrypt n consecutive blocks in ECB mode.  It is allowed that src == dst,
+ * but the buffers must not overlap otherwise.  Uses AES-NI when the CPU
+ * supports it; the software fallback gives identical results.
+ */
+void aes_encrypt_blocks(const struct aes_key *ks, const void *src, void *dst,
+						size_t n);
+
+/** Decrypt n consecutive blocks; see aes_encrypt_blocks. */
+void aes_decrypt_blocks(const struct aes_key *ks, const void *src, void *dst,
+						size_t n);
+
+/** Name of the implementation in use. */
+const char *aes_impl(void);
+
+#endif	/* AES_H__ */
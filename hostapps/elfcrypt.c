@@ -30,86 +30,333 @@
  *
  * Encrypt all loadable segments in an ELF file.  The key is given on the
  * command-line as a 32-digit hex string (total 128 bits).  The ELF file is
- * encrypted with simple ECB scheme just as proof-of-concept.  Other modes,
- * such as CTR, are also possible.
+ * encrypted with simple ECB scheme just as proof-of-concept, or with -m ctr in
+ * counter mode, where each word is XORed with the encryption of its virtual
+ * address, or with -m aes in 16-byte AES lines (see xform.c).  The mode is
+ * recorded in e_ident[XFORM_IDENT] of the output so that the runtime picks
+ * the matching transform, and so that an encrypted file is refused as input.
+ * Files encrypted by older versions carry no mark and are not recognized.
+ *
+ * Input and output are mapped into memory and split into chunks which are
+ * processed by a pool of threads (-j; by default one per online CPU).  Each
+ * chunk is either copied verbatim or encrypted straight from input to output,
+ * so the file is never held in a private buffer.  If ELF-OUT names the same
+ * file as ELF-IN, segments are encrypted in place; an error midway leaves the
+ * file partially encrypted.  The throughput is reported on stderr.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include "types.h"
 #include "elf.h"
 #include "rc5-16.h"
+#include "aes.h"
 #include "util.h"
 
+#define CHUNKSZ	(1U << 20)		/* default chunk size */
+
+/** A range of the file processed by one task. */
+struct chunk {
+	size_t off;					/**!< offset in the file */
+	size_t len;					/**!< length in bytes */
+	Elf32_Addr addr;			/**!< virtual address (CTR counter) */
+	int crypt;					/**!< encrypt; otherwise copy */
+};
+
+static struct xform *Gx;
+static int Gmode = XFORM_ECB;
+static const struct xform_backend *Gbe;
+static const char *Gin;			/* input mapping */
+static char *Gout;				/* output mapping; == Gin in place */
+static struct chunk *Gchunks;
+static unsigned Gnchunks, Gnext;
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+
+static void usage(const char *argv0);
+static char *map_file(const char *fname, int inplace, size_t *elfsz);
+static char *map_output(const char *fname, size_t elfsz);
+static int same_file(const char *fname1, const char *fname2);
 static void check_eh_limits(const Elf32_Ehdr*, size_t);
-static void crypt_segment(const struct rc5_key*, char*, Elf32_Phdr*);
+static void check_segments(const Elf32_Phdr*, unsigned, size_t, unsigned);
+static void add_chunks(size_t off, size_t len, Elf32_Addr addr, int crypt,
+					   size_t chunksz);
+static void *crypt_worker(void*);
 
 int main(int argc, char **argv)
 {
+	const Elf32_Ehdr *eh;
+	const Elf32_Phdr *ph;
 	struct rc5_key key;
-	char *elf;
-	size_t elfsz;
-	Elf32_Ehdr *eh;
-	Elf32_Phdr *ph;
-	FILE *out;
-	unsigned i, cnt;
-	
-	if(argc != 4) {
-		fprintf(stderr, "USAGE: %s ELF-IN ELF-OUT HEXKEY\n", argv[0]);
-		return 1;
+	struct timespec t0, t1;
+	pthread_t *tids;
+	size_t elfsz, off, chunksz = CHUNKSZ, nbytes;
+	unsigned i, nthreads = 0;
+	double secs;
+	int inplace;
+
+	while(argc > 1) {
+		if((argc > 2) && !strcmp(argv[1], "-j")) {
+			if(!(nthreads = atoi(argv[2])))
+				usage(argv[0]);
+			argv[2] = argv[0];
+			argc -= 2;
+			argv += 2;
+		} else if((argc > 2) && !strcmp(argv[1], "-c")) {
+			if(!(chunksz = (size_t)atoi(argv[2]) << 10))
+				usage(argv[0]);
+			argv[2] = argv[0];
+			argc -= 2;
+			argv += 2;
+		} else if((argc > 2) && !strcmp(argv[1], "-m")) {
+			if((Gmode = xform_find_mode(argv[2])) < 0)
+				usage(argv[0]);
+			argv[2] = argv[0];
+			argc -= 2;
+			argv += 2;
+		} else {
+			break;
+		}
 	}
+	if(argc != 4)
+		usage(argv[0]);
 	if(!rc5_convert_key(&key, argv[3])) {
 		fprintf(stderr, "can't convert key to internal form\n");
 		return 1;
 	}
-	rc5_setup(&key);
+	Gx = xform_get(key.key);
+	Gbe = xform_backend(Gmode);
 
-	read_elf(argv[1], &elf, &elfsz);
-	eh = (Elf32_Ehdr*)elf;
+	inplace = same_file(argv[1], argv[2]);
+	Gin = map_file(argv[1], inplace, &elfsz);
+	eh = (const Elf32_Ehdr*)Gin;
 	check_eh_limits(eh, elfsz);
+	if(eh->e_ident[XFORM_IDENT]) {
+		fprintf(stderr, "input is already encrypted\n");
+		exit(1);
+	}
+	ph = (const Elf32_Phdr*)(Gin + eh->e_phoff);
+	check_segments(ph, eh->e_phnum, elfsz, Gbe->align);
+	Gout = inplace ? (char*)Gin : map_output(argv[2], elfsz);
+
+	/* Split the file into encrypted segments and copied gaps in between;
+	 * segments are sorted and disjoint after check_segments. */
 
-	/* Iterate segments, check bounds and encrypt PT_LOAD. */
-	ph = (Elf32_Phdr*)(elf + eh->e_phoff);
-	for(i = 0, cnt = 0; i < eh->e_phnum; i++) {
-		if(ph->p_type != PT_LOAD)
+	for(i = 0, off = 0, nbytes = 0; i < eh->e_phnum; i++) {
+		if(ph[i].p_type != PT_LOAD)
 			continue;
-		++cnt;
-		if(ph->p_offset + ph->p_filesz >= elfsz) {
-			fprintf(stderr, "input segment %u is out of ELF bounds\n", i);
+		if(!inplace)
+			add_chunks(off, ph[i].p_offset - off, 0, 0, chunksz);
+		add_chunks(ph[i].p_offset, ph[i].p_filesz, ph[i].p_vaddr, 1, chunksz);
+		off = ph[i].p_offset + ph[i].p_filesz;
+		nbytes += ph[i].p_filesz;
+	}
+	if(!inplace)
+		add_chunks(off, elfsz - off, 0, 0, chunksz);
+
+	if(!nthreads)
+		nthreads = sysconf(_SC_NPROCESSORS_ONLN) > 0 ?
+			sysconf(_SC_NPROCESSORS_ONLN) : 1;
+	if(nthreads > Gnchunks)
+		nthreads = Gnchunks ? Gnchunks : 1;
+	if(!(tids = malloc(nthreads * sizeof(*tids)))) {
+		perror("malloc");
+		exit(1);
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	for(i = 0; i < nthreads; i++) {
+		if(pthread_create(&tids[i], NULL, crypt_worker, NULL)) {
+			fprintf(stderr, "can't create worker thread\n");
 			exit(1);
 		}
-		if((ph->p_filesz % RC5_BLOCKSZ) || (ph->p_memsz % RC5_BLOCKSZ)) {
-			/* 4 bytes is the cipher block size */
-			fprintf(stderr, "input segment file/memory size is not a multiple of 4\n");
-			exit(1);
+	}
+	for(i = 0; i < nthreads; i++)
+		pthread_join(tids[i], NULL);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+	Gout[XFORM_IDENT] = Gmode == XFORM_ECB ? XFORM_IDENT_ECB : Gmode;
+
+	if(munmap(Gout, elfsz) < 0) {
+		perror("munmap");
+		exit(1);
+	}
+
+	secs = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+	fprintf(stderr, "%lu bytes in %.3f s: %.1f MB/s (%u threads, %s, %s)\n",
+			(unsigned long)nbytes, secs, secs > 0 ? nbytes / secs / 1e6 : 0.0,
+			nthreads, Gbe->name,
+			Gmode == XFORM_AES ? aes_impl() : rc5_bulk_impl());
+	return 0;
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "USAGE: %s [-m ecb|ctr|aes] [-j THREADS] [-c CHUNK-KB] ELF-IN ELF-OUT HEXKEY\n",
+			argv0);
+	exit(1);
+}
+
+static void *crypt_worker(void *arg)
+{
+	const struct chunk *c;
+	unsigned i;
+
+	(void)arg;
+	while(1) {
+		pthread_mutex_lock(&Glock);
+		i = Gnext++;
+		pthread_mutex_unlock(&Glock);
+		if(i >= Gnchunks)
+			break;
+
+		c = &Gchunks[i];
+		if(c->crypt)
+			Gbe->encrypt(Gx, c->addr, Gin + c->off, Gout + c->off, c->len);
+		else
+			memcpy(Gout + c->off, Gin + c->off, c->len);
+	}
+	return NULL;
+}
+
+/** Append tasks covering [off, off+len) in pieces of at most chunksz. */
+static void add_chunks(size_t off, size_t len, Elf32_Addr addr, int crypt,
+					   size_t chunksz)
+{
+	static unsigned nalloc;
+	size_t n;
+
+	chunksz -= chunksz % Gbe->align;
+	for(; len; off += n, addr += n, len -= n) {
+		n = len < chunksz ? len : chunksz;
+		if(Gnchunks == nalloc) {
+			nalloc = nalloc ? 2*nalloc : 64;
+			if(!(Gchunks = realloc(Gchunks, nalloc * sizeof(*Gchunks)))) {
+				perror("realloc");
+				exit(1);
+			}
 		}
-		crypt_segment(&key, elf, ph+i);
+		Gchunks[Gnchunks].off = off;
+		Gchunks[Gnchunks].len = n;
+		Gchunks[Gnchunks].addr = addr;
+		Gchunks[Gnchunks].crypt = crypt;
+		++Gnchunks;
 	}
+}
 
-	if(!cnt) {
-		fprintf(stderr, "no PT_LOAD segments found\n");
+/** Map the input read-only, or shared and writable when in place. */
+static char *map_file(const char *fname, int inplace, size_t *elfsz)
+{
+	struct stat st;
+	void *p;
+	int fd;
+
+	if((fd = open(fname, inplace ? O_RDWR : O_RDONLY)) < 0) {
+		perror(fname);
+		exit(1);
+	}
+	if(fstat(fd, &st) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+	if((size_t)st.st_size < sizeof(Elf32_Ehdr)) {
+		fprintf(stderr, "input is too short for an ELF file\n");
 		exit(1);
 	}
+	p = mmap(NULL, st.st_size, inplace ? PROT_READ | PROT_WRITE : PROT_READ,
+			 inplace ? MAP_SHARED : MAP_PRIVATE, fd, 0);
+	if(p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+	*elfsz = st.st_size;
+	return p;
+}
+
+/**
+ * Create the output and map it writable.  Blocks are allocated up front so
+ * that running out of space fails here rather than with SIGBUS later.
+ */
+static char *map_output(const char *fname, size_t elfsz)
+{
+	void *p;
+	int fd, err;
 
-	if(!(out = fopen(argv[2], "w"))) {
-		fprintf(stderr, "can't write output\n");
+	if((fd = open(fname, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0) {
+		perror(fname);
 		exit(1);
 	}
-	if((fwrite(elf, 1, elfsz, out) != elfsz) || (fclose(out) == EOF)) {
-		fprintf(stderr, "output incomplete\n");
+	if((err = posix_fallocate(fd, 0, elfsz)) != 0) {
+		fprintf(stderr, "can't allocate output: %s\n", strerror(err));
 		exit(1);
 	}
-	return 0;
+	p = mmap(NULL, elfsz, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if(p == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	close(fd);
+	return p;
 }
 
-static void crypt_segment(const struct rc5_key *pk, char *elf, Elf32_Phdr *ph)
+/** Return true if both names refer to the same existing file. */
+static int same_file(const char *fname1, const char *fname2)
 {
-	char *p = elf + ph->p_offset;
-	unsigned i;
+	struct stat st1, st2;
 
-	for(i = 0; i < ph->p_filesz; i += RC5_BLOCKSZ)
-		rc5_ecb_encrypt(pk, p+i, p+i);
+	if((stat(fname1, &st1) < 0) || (stat(fname2, &st2) < 0))
+		return 0;
+	return (st1.st_dev == st2.st_dev) && (st1.st_ino == st2.st_ino);
+}
+
+/**
+ * Check that PT_LOAD segments are within the file, of whole blocks, start
+ * aligned as the transform requires, and in increasing, non-overlapping
+ * order, so that chunks never alias.
+ */
+static void check_segments(const Elf32_Phdr *ph, unsigned phnum, size_t elfsz,
+						   unsigned align)
+{
+	size_t end = 0;
+	unsigned i, cnt;
+
+	for(i = 0, cnt = 0; i < phnum; i++) {
+		if(ph[i].p_type != PT_LOAD)
+			continue;
+		++cnt;
+		if((size_t)ph[i].p_offset + ph[i].p_filesz > elfsz) {
+			fprintf(stderr, "input segment %u is out of ELF bounds\n", i);
+			exit(1);
+		}
+		if((ph[i].p_filesz % RC5_BLOCKSZ) || (ph[i].p_memsz % RC5_BLOCKSZ)) {
+			/* 4 bytes is the cipher block size */
+			fprintf(stderr, "input segment file/memory size is not a multiple of 4\n");
+			exit(1);
+		}
+		if(ph[i].p_vaddr % align) {
+			/* a partial final line is handled by the backend, not a partial
+			 * first one */
+			fprintf(stderr, "input segment %u address is not a multiple of "
+					"%u\n", i, align);
+			exit(1);
+		}
+		if(ph[i].p_offset < end) {
+			fprintf(stderr, "input segment %u overlaps or precedes another\n", i);
+			exit(1);
+		}
+		end = (size_t)ph[i].p_offset + ph[i].p_filesz;
+	}
+
+	if(!cnt) {
+		fprintf(stderr, "no PT_LOAD segments found\n");
+		exit(1);
+	}
 }
 
 static void check_eh_limits(const Elf32_Ehdr *eh, size_t elfsz)
@@ -136,7 +383,7 @@ static void check_eh_limits(const Elf32_Ehdr *eh, size_t elfsz)
 		fprintf(stderr, "input has no program headers\n");
 		exit(1);
 	}
-	if(eh->e_phoff + eh->e_phnum*eh->e_phentsize > elfsz) {
+	if((size_t)eh->e_phoff + eh->e_phnum*eh->e_phentsize > elfsz) {
 		fprintf(stderr, "invalid bounds of program header table\n");
 		exit(1);
 	}
@@ -33,6 +33,8 @@
 #ifndef RC5_16_H__
 #define RC5_16_H__
 
+#include <stddef.h>
+
 #define RC5_BLOCKSZ	4			/* (bytes) */
 #define RC5_KEYLEN	16			/* (bytes) */
 #define RC5_ROUNDS	12			/* # of rounds */
@@ -56,4 +58,33 @@ void rc5_ecb_encrypt(const struct rc5_key *ks, void *src, void *dst);
 /** Decrypt a single block.  It is allowed that src == dst. */
 void rc5_ecb_decrypt(const struct rc5_key *ks, void *src, void *dst);
 
+/**
+ * Encrypt n consecutive blocks.  It is allowed that src == dst, but the
+ * buffers must not overlap otherwise.  Uses SIMD instructions when the CPU
+ * supports them; the result is identical to that of rc5_ecb_encrypt.
+ */
+void rc5_ecb_encrypt_blocks(const struct rc5_key *ks, const void *src,
+							void *dst, size_t n);
+
+/** Decrypt n consecutive blocks; see rc5_ecb_encrypt_blocks. */
+void rc5_ecb_decrypt_blocks(const struct rc5_key *ks, const void *src,
+							void *dst, size_t n);
+
+/**
+ * Generate n blocks of CTR keystream: block i is the encryption of the 32-bit
+ * little-endian counter addr + i*RC5_BLOCKSZ, i.e. of its own address.
+ */
+void rc5_ctr_keystream(const struct rc5_key *ks, unsigned long addr,
+					   void *dst, size_t n);
+
+/**
+ * En- or decrypt n blocks in CTR mode by XORing them with the keystream for
+ * addr.  It is allowed that src == dst.
+ */
+void rc5_ctr_crypt(const struct rc5_key *ks, unsigned long addr,
+				   const void *src, void *dst, size_t n);
+
+/** Name of the implementation used by the bulk functions. */
+const char *rc5_bulk_impl(void);
+
 #endif	/* RC5_16_H__ */
@@ -32,36 +32,252 @@
  * exception is caused by BREAK or unsupported SYSCALL instruction, the code
  * is in addition printed to stdout.  Also supports execution of executables
  * encrypted with elfcrypt.
+ *
+ * With --save-snapshot, the loaded program is written to a snapshot file
+ * instead of being executed; with --snapshot, execution starts directly from
+ * such a file, skipping ELF loading altogether.  The key, if any, must be
+ * given again when running the snapshot since it is not saved.
+ *
+ * With --checkpoint, the run writes an incremental checkpoint every INTERVAL
+ * instructions to the chain NAME.base, NAME.1, ...; an interrupted run is
+ * continued from the last checkpoint with --restore NAME.
+ *
+ * With --map or --map-shared, the contents of a file are mapped into MIPS
+ * memory starting at the given address (which the program must know), up to
+ * the end of the file or the stack.
+ *
+ * With --compress-idle, memory of the program (of every copy with --async)
+ * is compressed whenever it has been waiting for input for longer than the
+ * given time; statistics are printed at the end.
+ *
+ * With --async N, N copies of the program (copy-on-write clones of the loaded
+ * CPU) are executed together on one thread, their file I/O going through
+ * io_uring so that copies waiting for I/O do not hold up the others.
+ *
+ * With --native, the comma-separated list of guest functions (or "all" that
+ * the program has) is replaced by native host routines; see native.h.  The
+ * replacement is kept in saved snapshots, so it is not given with --snapshot
+ * or --restore.
  */
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
 #include "cpu.h"
+#include "compress.h"
+#include "memory.h"
 #include "rc5-16.h"
+#include "snapshot.h"
 #include "util.h"
 
 #define MEMSZ (2U << 20)
 #define STKSZ (16U << 10)
+#define MAXCHAIN 8
+#define MAXMAPS 8
+
+struct file_map {
+	const char		*fname;
+	mips_uword		addr;
+	int				flags;
+};
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "USAGE: %s [OPTIONS] ELF [KEY]\n", argv0);
+	fprintf(stderr, "       %s [OPTIONS] --snapshot FILE [KEY]\n", argv0);
+	fprintf(stderr, "       %s [OPTIONS] --restore NAME [KEY]\n", argv0);
+	fprintf(stderr, "OPTIONS: --save-snapshot FILE\n");
+	fprintf(stderr, "         --checkpoint NAME INTERVAL\n");
+	fprintf(stderr, "         --compress-idle MS\n");
+	fprintf(stderr, "         --flush always|line|full\n");
+	fprintf(stderr, "         --async N\n");
+	fprintf(stderr, "         --native all|FUNC[,FUNC...]\n");
+	fprintf(stderr, "         --map FILE ADDR | --map-shared FILE ADDR\n");
+	exit(1);
+}
 
 int main(int argc, char **argv)
 {
 	char *base;
 	struct mips_cpu *pcpu;
-	
-	if((argc != 2) && (argc != 3)) {
-		fprintf(stderr, "USAGE: %s ELF [KEY]\n", argv[0]);
-		exit(1);
-	}
-	if(!(base = malloc(MEMSZ))) {
-		perror("malloc");
-		exit(1);
+	struct mips_checkpoint *ck = NULL;
+	const char *snapshot = NULL, *restore = NULL, *save = NULL;
+	const char *ckname = NULL, *natives = NULL, *argv0 = argv[0];
+	unsigned long interval = 0;
+	unsigned idle_ms = 0;
+	int flush = MIPS_FLUSH_AUTO;
+	int ncpus = 0;
+	struct mips_cpu **cpus = NULL;
+	struct file_map maps[MAXMAPS];
+	int i, nmaps = 0;
+
+	for(i = 1; (i < argc) && !strncmp(argv[i], "--", 2); i += 2) {
+		if(i + 1 >= argc)
+			usage(argv[0]);
+		if(!strcmp(argv[i], "--snapshot")) {
+			snapshot = argv[i+1];
+		} else if(!strcmp(argv[i], "--restore")) {
+			restore = argv[i+1];
+		} else if(!strcmp(argv[i], "--save-snapshot")) {
+			save = argv[i+1];
+		} else if(!strcmp(argv[i], "--compress-idle")) {
+			if(!(idle_ms = strtoul(argv[i+1], NULL, 0)))
+				usage(argv0);
+		} else if(!strcmp(argv[i], "--async")) {
+			if((ncpus = atoi(argv[i+1])) <= 0)
+				usage(argv0);
+		} else if(!strcmp(argv[i], "--native")) {
+			natives = argv[i+1];
+		} else if(!strcmp(argv[i], "--flush")) {
+			if(!strcmp(argv[i+1], "always"))
+				flush = MIPS_FLUSH_ALWAYS;
+			else if(!strcmp(argv[i+1], "line"))
+				flush = MIPS_FLUSH_LINE;
+			else if(!strcmp(argv[i+1], "full"))
+				flush = MIPS_FLUSH_FULL;
+			else
+				usage(argv0);
+		} else if((!strcmp(argv[i], "--map") || !strcmp(argv[i], "--map-shared"))
+				  && (i + 2 < argc) && (nmaps < MAXMAPS)) {
+			maps[nmaps].fname = argv[i+1];
+			maps[nmaps].addr = strtoul(argv[i+2], NULL, 0);
+			maps[nmaps].flags = argv[i][5] ? MIPS_MAP_SHARED : 0;
+			++nmaps;
+			++i;
+		} else if(!strcmp(argv[i], "--checkpoint") && (i + 2 < argc)) {
+			ckname = argv[i+1];
+			if(!(interval = strtoul(argv[i+2], NULL, 0)))
+				usage(argv[0]);
+			++i;
+		} else {
+			usage(argv[0]);
+		}
 	}
+	argc -= i;
+	argv += i;
+	if((snapshot && restore)
+	   || (ncpus && ckname)
+	   || ((snapshot || restore) && natives)
+	   || ((snapshot || restore) && (argc > 1))
+	   || (!snapshot && !restore && (argc != 1) && (argc != 2)))
+		usage(argv0);
 
 	mips_init();
-	pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
-	prepare_cpu(pcpu, argv[1], (argc == 3) ? argv[2] : NULL);
-	execute_loop(pcpu);
-	mips_dump_cpu(pcpu);
+	if(snapshot) {
+		if(!(pcpu = mips_snapshot_load(snapshot))) {
+			perror("mips_snapshot_load");
+			exit(1);
+		}
+		prepare_xform(pcpu, argc ? argv[0] : NULL);
+	} else if(restore) {
+		if(!(pcpu = mips_checkpoint_restore(restore))) {
+			perror("mips_checkpoint_restore");
+			exit(1);
+		}
+		prepare_xform(pcpu, argc ? argv[0] : NULL);
+	} else {
+		if(!(base = mips_alloc_memory(MEMSZ))) {
+			perror("mips_alloc_memory");
+			exit(1);
+		}
+		pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
+		prepare_cpu(pcpu, argv[0], (argc == 2) ? argv[1] : NULL);
+		if(natives)
+			bind_natives(pcpu, natives);
+	}
+
+	for(i = 0; i < nmaps; i++) {
+		int fd = open(maps[i].fname,
+					  (maps[i].flags & MIPS_MAP_SHARED) ? O_RDWR : O_RDONLY);
+
+		if((fd < 0) || (mips_map_file(pcpu, maps[i].addr,
+				pcpu->memsz - pcpu->stksz - maps[i].addr, fd, 0,
+				maps[i].flags) < 0)) {
+			perror(maps[i].fname);
+			exit(1);
+		}
+		close(fd);
+	}
+
+	if(save) {
+		if(mips_snapshot_save(pcpu, save) < 0) {
+			perror("mips_snapshot_save");
+			exit(1);
+		}
+		return 0;
+	}
+
+	if(ckname) {
+		if(!(ck = mips_checkpoint_begin(pcpu, ckname, MAXCHAIN))) {
+			perror("mips_checkpoint_begin");
+			exit(1);
+		}
+		set_checkpoint(ck, interval);
+	}
+
+	if(ncpus) {
+		if(!(cpus = malloc(ncpus * sizeof(*cpus)))) {
+			perror("malloc");
+			exit(1);
+		}
+		cpus[0] = pcpu;
+		for(i = 1; i < ncpus; i++) {
+			if(!(cpus[i] = mips_clone_cpu(pcpu))) {
+				perror("mips_clone_cpu");
+				exit(1);
+			}
+		}
+	}
+
+	if(idle_ms) {
+		for(i = 0; i < (ncpus ? ncpus : 1); i++) {
+			if(mips_compress_register(ncpus ? cpus[i] : pcpu) < 0) {
+				perror("mips_compress_register");
+				exit(1);
+			}
+		}
+		if(mips_compress_start(idle_ms, (idle_ms + 3) / 4) < 0) {
+			perror("mips_compress_start");
+			exit(1);
+		}
+	}
+
+	if(ncpus) {
+		for(i = 0; i < ncpus; i++)
+			mips_set_flush_policy(cpus[i], flush);
+		execute_many(cpus, ncpus);
+		for(i = 0; i < ncpus; i++)
+			mips_dump_cpu(cpus[i]);
+		for(i = 1; i < ncpus; i++)
+			mips_free_cpu(cpus[i]);
+		free(cpus);
+	} else {
+		mips_set_flush_policy(pcpu, flush);
+		execute_loop(pcpu);
+		mips_dump_cpu(pcpu);
+	}
+
+	if(idle_ms) {
+		struct mips_compress_stats st;
+
+		mips_compress_stop();
+		mips_compress_get_stats(&st);
+		fprintf(stderr, "COMPRESSED %lu PAGES (%lu ZERO, %lu SKIPPED), "
+				"RATIO %.2f; PAGED IN %lu, AVG %.1f us, MAX %.1f us\n",
+				(unsigned long)st.compressed, (unsigned long)st.zero,
+				(unsigned long)st.skipped,
+				st.lz_bytes ? (double)st.raw_bytes / st.lz_bytes : 0.0,
+				(unsigned long)st.paged_in,
+				st.paged_in ? st.pagein_ns / 1e3 / st.paged_in : 0.0,
+				st.pagein_max_ns / 1e3);
+	}
+
+	if(ck) {
+		set_checkpoint(NULL, 0);
+		mips_checkpoint_end(ck);
+	}
 
     return 0;
 }
@@ -31,25 +31,66 @@
  * they define two symbols: PARAMS, which is an array that specifies input
  * parameters to the benchmark, and TIME, which records the execution time
  * spent within the benchmark.
+ *
+ * Several parameter sets, separated by ':', may be given for a parameter
+ * sweep.  The benchmark is then loaded only once and the sets are run by N
+ * worker threads (-j; by default one per set), each in its own copy-on-write
+ * clone of the loaded CPU.  Before each further set, a worker resets its CPU
+ * to the loaded state.  The times are printed in the order of parameter
+ * sets.
+ *
+ * With -n, workers and their memory are spread over NUMA nodes and rebalanced
+ * between sets; per-node counts are printed to stderr at the end.
+ *
+ * With -d, each worker shares identical pages of its CPU with the other
+ * workers after each run.  The pages shared by the final states of the
+ * workers and the memory saved are printed to stderr at the end.
+ *
+ * With -r, workers do not reuse CPUs: each set is run in a new CPU whose
+ * memory comes from a pool of pre-faulted blocks and which is freed (its
+ * block scrubbed and returned to the pool) afterwards.  The ELF is read only
+ * once.  Pool statistics are printed to stderr at the end.
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
+#include <unistd.h>
 #include "cpu.h"
+#include "memory.h"
+#include "dedup.h"
+#include "pool.h"
+#include "numa.h"
 #include "rc5-16.h"
 #include "util.h"
 
 #define MEMSZ (16U << 20)		/* 16MB, needed for mmult */
 #define STKSZ (16U << 10)
 
+struct worker {
+	struct mips_cpu *pcpu;
+	pthread_t tid;
+};
+
+static Elf32_Sym *Gs_params, *Gs_time;
+static char **Gsets;					/* parameter sets */
+static unsigned long long *Gtimes;	/* results, one per set */
+static unsigned Gnsets, Gnext;
+static int Gnuma, Gdedup, Gfresh;
+static char *Gelf;						/* ELF image shared by all CPUs */
+static size_t Gelfsz;
+static const char *Gkey;
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+
 /* This destructively modifies the string. */
 static void parse_params(struct mips_cpu *pcpu, Elf32_Sym *params, char *argv)
 {
 	/* The magic constant 4 is sizeof(unsigned) on MIPS I. */
 	unsigned addr = params->st_value, n = params->st_size / 4;
 	unsigned i;
-	char *tok = strtok(argv, ",");
+	char *save;
+	char *tok = strtok_r(argv, ",", &save);
 	
 	for(i = 0; i < n; ++i) {
 		if(!tok) {
@@ -57,55 +98,259 @@ static void parse_params(struct mips_cpu *pcpu, Elf32_Sym *params, char *argv)
 			exit(1);
 		}
 		mips_poke_uw(pcpu, addr + 4*i, atoi(tok));
-		tok = strtok(NULL, ",");
+		tok = strtok_r(NULL, ",", &save);
+	}
+}
+
+static void usage(const char *argv0)
+{
+	fprintf(stderr, "USAGE: %s [-j N] [-n] [-d | -r] ELF PARAMS[:PARAMS...] [KEY]\n",
+			argv0);
+	exit(1);
+}
+
+static unsigned long long read_time(struct mips_cpu *pcpu)
+{
+	unsigned long long TIME;
+
+	TIME = mips_peek_uw(pcpu, Gs_time->st_value+4); /* high word */
+	TIME = (TIME << 32) | mips_peek_uw(pcpu, Gs_time->st_value); /* low word */
+	return TIME;
+}
+
+static void *run_worker(void *arg)
+{
+	struct mips_cpu *pcpu = ((struct worker*)arg)->pcpu;
+	unsigned i, n;
+
+	/* Placement must follow the baseline, which may remap the memory.  A
+	 * fresh clone keeps the image it shares with the loaded CPU. */
+
+	if(mips_set_baseline(pcpu) < 0) {
+		perror("mips_set_baseline");
+		exit(1);
+	}
+	if(Gnuma && (mips_numa_place(pcpu, MIPS_NUMA_BALANCE) < 0)) {
+		perror("mips_numa_place");
+		exit(1);
+	}
+	for(n = 0; ; n++) {
+		pthread_mutex_lock(&Glock);
+		i = Gnext++;
+		pthread_mutex_unlock(&Glock);
+		if(i >= Gnsets)
+			break;
+
+		if(n && (mips_reset_to_baseline(pcpu) < 0)) {
+			perror("mips_reset_to_baseline");
+			exit(1);
+		}
+		if(Gnuma && (mips_numa_rebalance(pcpu) < 0)) {
+			perror("mips_numa_rebalance");
+			exit(1);
+		}
+
+		parse_params(pcpu, Gs_params, Gsets[i]);
+		execute_loop(pcpu);
+		Gtimes[i] = read_time(pcpu);
+		if(Gdedup && (mips_dedup_cpu(pcpu) < 0)) {
+			perror("mips_dedup_cpu");
+			exit(1);
+		}
+	}
+	return NULL;
+}
+
+/* With -r: a new CPU from the memory pool for each set. */
+static void *run_fresh_worker(void *arg)
+{
+	struct mips_cpu *pcpu;
+	char *base;
+	unsigned i;
+
+	while(1) {
+		pthread_mutex_lock(&Glock);
+		i = Gnext++;
+		pthread_mutex_unlock(&Glock);
+		if(i >= Gnsets)
+			break;
+
+		if(!(base = mips_alloc_memory(MEMSZ))) {
+			perror("mips_alloc_memory");
+			exit(1);
+		}
+		pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
+		prepare_cpu_image(pcpu, Gelf, Gelfsz, Gkey);
+		if(Gnuma && (mips_numa_place(pcpu, MIPS_NUMA_BALANCE) < 0)) {
+			perror("mips_numa_place");
+			exit(1);
+		}
+
+		parse_params(pcpu, Gs_params, Gsets[i]);
+		execute_loop(pcpu);
+		Gtimes[i] = read_time(pcpu);
+		mips_free_cpu(pcpu);
 	}
+	return NULL;
 }
 
 int main(int argc, char **argv)
 {
-	char *base, *params, *key;
+	char *base, *params;
 	struct mips_cpu *pcpu;
-	Elf32_Sym *s_params, *s_time;
-	unsigned long long TIME;
+	struct worker *workers;
+	unsigned i, nworkers = 0;
 	
-	if((argc != 3) && (argc != 4)) {
-		fprintf(stderr, "USAGE: %s ELF PARAMS [KEY]\n", argv[0]);
-		exit(1);
+	while(argc > 1) {
+		if((argc > 2) && !strcmp(argv[1], "-j")) {
+			if(!(nworkers = atoi(argv[2])))
+				usage(argv[0]);
+			argv[2] = argv[0];
+			argc -= 2;
+			argv += 2;
+		} else if(!strcmp(argv[1], "-n")) {
+			Gnuma = 1;
+			argv[1] = argv[0];
+			--argc;
+			++argv;
+		} else if(!strcmp(argv[1], "-d")) {
+			Gdedup = 1;
+			argv[1] = argv[0];
+			--argc;
+			++argv;
+		} else if(!strcmp(argv[1], "-r")) {
+			Gfresh = 1;
+			argv[1] = argv[0];
+			--argc;
+			++argv;
+		} else {
+			break;
+		}
 	}
+	if(((argc != 3) && (argc != 4)) || (Gdedup && Gfresh))
+		usage(argv[0]);
 	params = argv[2];
-	key = argc == 4 ? argv[3] : NULL;
+	Gkey = argc == 4 ? argv[3] : NULL;
+
+	/* Split parameter sets. */
 
-	if(!(base = malloc(MEMSZ))) {
+	for(Gnsets = 1, i = 0; params[i]; i++)
+		Gnsets += params[i] == ':';
+	if(!nworkers || (nworkers > Gnsets))
+		nworkers = Gnsets;
+	if(!(Gsets = malloc(Gnsets * sizeof(*Gsets))) ||
+	   !(Gtimes = malloc(Gnsets * sizeof(*Gtimes))) ||
+	   !(workers = malloc(nworkers * sizeof(*workers)))) {
 		perror("malloc");
 		exit(1);
 	}
+	for(i = 0; i < Gnsets; i++) {
+		Gsets[i] = params;
+		if((params = strchr(params, ':')) != NULL)
+			*params++ = 0;
+	}
+
+	/* One pooled block per worker; the loaded CPU takes one of them. */
+
+	if(Gfresh) {
+		size_t memsz = MEMSZ;
+
+		if(mips_pool_init(&memsz, 1, nworkers, nworkers,
+						  Gnuma ? MIPS_POOL_NUMA : 0) < 0) {
+			perror("mips_pool_init");
+			exit(1);
+		}
+	}
+
+	if(!(base = mips_alloc_memory(MEMSZ))) {
+		perror("mips_alloc_memory");
+		exit(1);
+	}
 
 	mips_init();
 	pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
-	prepare_cpu(pcpu, argv[1], key);
+	read_elf(argv[1], &Gelf, &Gelfsz);
+	prepare_cpu_image(pcpu, Gelf, Gelfsz, Gkey);
 
-	if(!(s_params = mips_elf_find_symbol(pcpu, "PARAMS")) ||
-	   !(s_time = mips_elf_find_symbol(pcpu, "TIME"))) {
+	if(!(Gs_params = mips_elf_find_symbol(pcpu, "PARAMS")) ||
+	   !(Gs_time = mips_elf_find_symbol(pcpu, "TIME"))) {
 		fprintf(stderr, "ERROR: 'PARAMS' and/or 'TIME' symbols not found\n");
 		exit(1);
 	}
 
-	if((s_params->st_size % 4) || !s_params->st_size) {
-		fprintf(stderr, "ERROR: 'PARAMS' has invalid size %u\n", s_params->st_size);
+	if((Gs_params->st_size % 4) || !Gs_params->st_size) {
+		fprintf(stderr, "ERROR: 'PARAMS' has invalid size %u\n", Gs_params->st_size);
 		exit(1);
 	}
 
-	if(s_time->st_size != 8) {
-		fprintf(stderr, "ERROR: 'TIME' has size %u != 8\n", s_time->st_size);
+	if(Gs_time->st_size != 8) {
+		fprintf(stderr, "ERROR: 'TIME' has size %u != 8\n", Gs_time->st_size);
 		exit(1);
 	}
 
-	parse_params(pcpu, s_params, params);
-	execute_loop(pcpu);
+	if(Gdedup && (mips_dedup_init(nworkers * (MEMSZ / sysconf(_SC_PAGESIZE))) < 0)) {
+		perror("mips_dedup_init");
+		exit(1);
+	}
+
+	/* One worker per thread; the loaded CPU is the first worker, unless each
+	 * set gets a new CPU. */
+
+	if(Gfresh) {
+		mips_free_cpu(pcpu);
+		pcpu = NULL;
+	}
+	workers[0].pcpu = pcpu;
+	for(i = 1; i < nworkers; i++) {
+		if(Gfresh)
+			workers[i].pcpu = NULL;
+		else if(!(workers[i].pcpu = mips_clone_cpu(pcpu))) {
+			perror("mips_clone_cpu");
+			exit(1);
+		}
+	}
+	for(i = 0; i < nworkers; i++) {
+		if(pthread_create(&workers[i].tid, NULL,
+						  Gfresh ? run_fresh_worker : run_worker, &workers[i])) {
+			fprintf(stderr, "ERROR: can't create worker thread\n");
+			exit(1);
+		}
+	}
+	for(i = 0; i < nworkers; i++)
+		pthread_join(workers[i].tid, NULL);
+
+	if(Gnuma) {
+		struct mips_numa_stats stats[MIPS_NUMA_MAXNODES];
+		int n = mips_numa_get_stats(stats, MIPS_NUMA_MAXNODES), j;
+
+		for(j = 0; j < n; j++)
+			fprintf(stderr, "NODE %d: %u CPUS, %lu BYTES\n", j, stats[j].cpus,
+					(unsigned long)stats[j].memsz);
+	}
+
+	if(Gfresh) {
+		struct mips_pool_stats stats;
+
+		mips_pool_get_stats(&stats);
+		fprintf(stderr, "POOL: %lu HITS, %lu MISSES, %lu REMOTE, "
+				"%lu BYTES SCRUBBED IN %llu NS\n",
+				(unsigned long)stats.hits, (unsigned long)stats.misses,
+				(unsigned long)stats.remote, (unsigned long)stats.scrubbed,
+				stats.scrub_ns);
+	}
+
+	if(Gdedup) {
+		struct mips_dedup_stats stats;
+
+		mips_dedup_get_stats(&stats);
+		fprintf(stderr, "DEDUP: %lu PAGES SHARED, %lu DISTINCT, %lu BYTES SAVED\n",
+				(unsigned long)stats.shared_pages,
+				(unsigned long)stats.store_pages,
+				(unsigned long)stats.saved_bytes);
+	}
 
-	TIME = mips_peek_uw(pcpu, s_time->st_value+4); /* high word */
-	TIME = (TIME << 32) | mips_peek_uw(pcpu, s_time->st_value); /* low word */
-	printf("%llu\n", TIME);
+	for(i = 0; i < Gnsets; i++)
+		printf("%llu\n", Gtimes[i]);
 
     return 0;
 }
@@ -36,6 +36,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "cpu.h"
+#include "memory.h"
 #include "util.h"
 
 #define MEMSZ (2U << 20)
@@ -53,8 +54,8 @@ int main(int argc, char **argv)
 		fprintf(stderr, "USAGE: %s ELF\n", argv[0]);
 		exit(1);
 	}
-	if(!(base = malloc(MEMSZ))) {
-		perror("malloc");
+	if(!(base = mips_alloc_memory(MEMSZ))) {
+		perror("mips_alloc_memory");
 		exit(1);
 	}
 
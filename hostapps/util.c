@@ -30,16 +30,31 @@
  * Common routines for run and torture.
  */
 
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include "util.h"
 #include "rc5-16.h"
+#include "snapshot.h"
+#include "memory.h"
+#include "aio.h"
+#include "native.h"
 
-static struct rc5_key Gkey;
+/**
+ * Number of instructions a CPU executes in turn in execute_many; a multiple
+ * of MIPS_TIME_TICK, so that the time page is refreshed at the start.
+ */
+#define SLICE 8192
+
+static struct mips_checkpoint *Gckpt;
+static unsigned long Gckpt_interval;
 
-static mips_uword rc5_peek(MIPS_CPU *pcpu, mips_uword addr);
-static void rc5_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w);
+static const struct xform_backend *setup_xform(MIPS_CPU *pcpu,
+	const char *asckey, const char *elf, size_t elfsz);
+static int load_tails(MIPS_CPU *pcpu, const struct xform_backend *be);
+static int handle_stop(MIPS_CPU *pcpu, enum mips_exception err,
+					   struct mips_aio *aio, const char *tag);
 
 void read_elf(const char *fname, char **elf, size_t *elfsz)
 {
@@ -90,74 +105,253 @@ int rc5_convert_key(struct rc5_key *pk, const char *hex)
 	return 1;
 }
 
+void prepare_xform(MIPS_CPU *pcpu, const char *asckey)
+{
+	setup_xform(pcpu, asckey, pcpu->elf, pcpu->elf ? pcpu->elfsz : 0);
+}
+
+/** Return the backend of the transform, or NULL if there is no key. */
+static const struct xform_backend *setup_xform(MIPS_CPU *pcpu,
+	const char *asckey, const char *elf, size_t elfsz)
+{
+	struct rc5_key key;
+	int mode;
+
+	if(!asckey)
+		return NULL;
+	if(!rc5_convert_key(&key, asckey)) {
+		fprintf(stderr, "can't convert key\n");
+		exit(1);
+	}
+	mode = elfsz > XFORM_IDENT ? (unsigned char)elf[XFORM_IDENT] : XFORM_ECB;
+	if(mode == XFORM_IDENT_ECB)
+		mode = XFORM_ECB;
+	if(xform_attach(pcpu, xform_get(key.key), mode) < 0) {
+		fprintf(stderr, "unknown transform mode %d\n", mode);
+		exit(1);
+	}
+	if(mips_icache_enable(pcpu) < 0) {
+		perror("mips_icache_enable");
+		exit(1);
+	}
+	return xform_backend(mode);
+}
+
+/**
+ * Let the backend store the partial units at the ends of loaded segments,
+ * which the ELF loader has copied verbatim.
+ */
+static int load_tails(MIPS_CPU *pcpu, const struct xform_backend *be)
+{
+	const Elf32_Ehdr *eh = (const Elf32_Ehdr*)pcpu->elf;
+	const Elf32_Phdr *ph = (const Elf32_Phdr*)(pcpu->elf + eh->e_phoff);
+	unsigned i;
+	size_t n;
+
+	for(i = 0; i < eh->e_phnum; i++) {
+		if((ph[i].p_type != PT_LOAD) || !(n = ph[i].p_filesz % be->align))
+			continue;
+		if(be->load_tail(pcpu, ph[i].p_vaddr + ph[i].p_filesz - n,
+						 pcpu->elf + ph[i].p_offset + ph[i].p_filesz - n, n) < 0)
+			return -1;
+	}
+	return 0;
+}
+
 void prepare_cpu(MIPS_CPU *pcpu, const char *exename, const char *asckey)
 {
 	char *elf;
 	size_t elfsz;
 	
 	read_elf(exename, &elf, &elfsz);
-	if(asckey) {
-		if(!rc5_convert_key(&Gkey, asckey)) {
-			fprintf(stderr, "can't convert key\n");
-			exit(1);
-		}
-		rc5_setup(&Gkey);
-		pcpu->peek_uw = rc5_peek;
-		pcpu->poke_uw = rc5_poke;
-	}
-	if(mips_elf_load(pcpu, elf, elfsz) < 0) {
+	prepare_cpu_image(pcpu, elf, elfsz, asckey);
+}
+
+void prepare_cpu_image(MIPS_CPU *pcpu, const char *elf, size_t elfsz,
+					   const char *asckey)
+{
+	const struct xform_backend *be;
+
+	be = setup_xform(pcpu, asckey, elf, elfsz);
+	if((mips_elf_load(pcpu, elf, elfsz) < 0)
+	   || (be && be->load_tail && (load_tails(pcpu, be) < 0))) {
 		fprintf(stderr, "error preparing ELF for execution\n");
 		exit(1);
 	}
 }
 
+void set_checkpoint(struct mips_checkpoint *ck, unsigned long interval)
+{
+	Gckpt = ck;
+	Gckpt_interval = interval;
+}
+
+void bind_natives(MIPS_CPU *pcpu, const char *list)
+{
+	char name[64];
+	const char *end;
+	unsigned i;
+	size_t len;
+
+	if(!strcmp(list, "all")) {
+		for(i = 0; mips_native_name(i); i++)
+			mips_native_bind(pcpu, mips_native_name(i));
+		return;
+	}
+	for(; *list; list = *end ? end + 1 : end) {
+		end = list + strcspn(list, ",");
+		len = end - list;
+		if(len >= sizeof(name))
+			len = sizeof(name) - 1;
+		memcpy(name, list, len);
+		name[len] = 0;
+		if(mips_native_bind(pcpu, name) < 0) {
+			fprintf(stderr, "%s: %s\n", name, strerror(errno));
+			exit(1);
+		}
+	}
+}
+
 void execute_loop(MIPS_CPU *pcpu)
 {
 	enum mips_exception err;
+	unsigned long left = Gckpt_interval;
+	unsigned tick = MIPS_TIME_TICK;
+
+	do {
+		if(!Gckpt) {
+			while((err = mips_execute(pcpu)) == MIPS_E_OK) {
+				if(!--tick) {
+					mips_time_refresh(pcpu);
+					tick = MIPS_TIME_TICK;
+				}
+			}
+		} else {
+			/* The instruction count carries over syscalls. */
+			while((err = mips_execute(pcpu)) == MIPS_E_OK) {
+				if(!--tick) {
+					mips_time_refresh(pcpu);
+					tick = MIPS_TIME_TICK;
+				}
+				if(--left)
+					continue;
+				if(mips_checkpoint(Gckpt) < 0)
+					perror("mips_checkpoint");
+				left = Gckpt_interval;
+			}
+		}
+	} while(handle_stop(pcpu, err, NULL, "") == 0);
+}
+
+void execute_many(MIPS_CPU **cpus, unsigned n)
+{
+	struct mips_aio *aio;
+	MIPS_CPU *pcpu;
+	enum mips_exception err;
+	char *done, tag[16];
+	unsigned i, k, left, runnable;
+	int ret;
+
+	if(!(aio = mips_aio_create(n)) || !(done = calloc(n, 1))) {
+		perror("mips_aio_create");
+		exit(1);
+	}
+	for(left = n; left; ) {
+		runnable = 0;
+		for(i = 0; i < n; i++) {
+			if(done[i] || (cpus[i]->host && cpus[i]->host->parked))
+				continue;
+			for(k = SLICE; k; k--) {
+				if(k % MIPS_TIME_TICK == 0)
+					mips_time_refresh(cpus[i]);
+				if((err = mips_execute(cpus[i])) != MIPS_E_OK)
+					break;
+			}
+			if(k) {
+				snprintf(tag, sizeof(tag), "[%u] ", i);
+				if((ret = handle_stop(cpus[i], err, aio, tag)) > 0)
+					continue;
+				if(ret < 0) {
+					done[i] = 1;
+					--left;
+					continue;
+				}
+			}
+			++runnable;
+		}
+
+		/* Wait for a completion only if no CPU can run. */
+
+		while((ret = mips_aio_reap(aio, !runnable, &pcpu)) > 0) {
+			mips_resume(pcpu);
+			++runnable;
+		}
+		if(ret < 0) {
+			perror("mips_aio_reap");
+			exit(1);
+		}
+	}
+	free(done);
+	mips_aio_destroy(aio);
+}
+
+/**
+ * Handle a stop of the CPU with err: process a SPIM syscall, asynchronously
+ * if aio is not NULL, or a native routine, or report the end of execution
+ * (and ring_kick statistics) prefixed with tag.
+ *
+ * @return 0 if the CPU may continue, 1 if it has been parked, -1 if it has
+ * finished.
+ */
+static int handle_stop(MIPS_CPU *pcpu, enum mips_exception err,
+					   struct mips_aio *aio, const char *tag)
+{
 	Elf32_Sym *sym;
 	const char *symname;
-	int opcode, break_code;
+	int opcode, break_code, ret = 0;
 
-execute:
-	while((err = mips_execute(pcpu)) == MIPS_E_OK)
-		;
 	break_code = mips_break_code(pcpu, &opcode);
+	if((opcode == MIPS_I_SYSCALL) && (break_code == MIPS_SPIM_SYSCALL)) {
+		ret = aio ? mips_spim_syscall_async(pcpu, aio)
+			: mips_spim_syscall(pcpu);
+		if(ret == MIPS_SPIM_PARKED)
+			return 1;
+		if(ret == 0) {
+			mips_resume(pcpu);
+			return 0;
+		}
+	} else if((opcode == MIPS_I_SYSCALL)
+			  && ((ret = mips_native_call(pcpu)) == 0)) {
+		return 0;
+	}
+
+	mips_flush_output(pcpu);
 	switch(opcode) {
 	case MIPS_I_BREAK:
-		fprintf(stderr, "END: BREAK %d\n", break_code);
-		return;
+		fprintf(stderr, "%sEND: BREAK %d\n", tag, break_code);
+		break;
 	case MIPS_I_SYSCALL:
-		if(break_code != MIPS_SPIM_SYSCALL) {
-			fprintf(stderr, "END: INVALID SYSCALL CODE %d\n", break_code);
-			return;
-		}
-		if((err = mips_spim_syscall(pcpu)) != 0) {
-			fprintf(stderr, "END: SPIM SERVICE %d FAULTED (%d)\n",
-					pcpu->r.ur[2], err);
-			return;
-		}
-		mips_resume(pcpu);
-		goto execute;
+		if((break_code != MIPS_SPIM_SYSCALL) && (ret > 0))
+			fprintf(stderr, "%sEND: NATIVE %s FAULTED (%d)\n", tag,
+					mips_native_name(break_code - MIPS_NATIVE_SYSCALL), ret);
+		else if(break_code != MIPS_SPIM_SYSCALL)
+			fprintf(stderr, "%sEND: INVALID SYSCALL CODE %d\n", tag,
+					break_code);
+		else
+			fprintf(stderr, "%sEND: SPIM SERVICE %d FAULTED (%d)\n", tag,
+					pcpu->r.ur[2], ret);
+		break;
 	default:
-		fprintf(stderr, "END: EXCEPTION %d AT PC=%08x", err, pcpu->pc);
+		fprintf(stderr, "%sEND: EXCEPTION %d AT PC=%08x", tag, err, pcpu->pc);
 		if((sym = mips_elf_find_address(pcpu, pcpu->pc)) &&
 		   (symname = mips_elf_get_symname(pcpu, sym)))
 			fprintf(stderr, " (near %s)", symname);
 		fprintf(stderr, "\n");
 		break;
 	}
-	return;
-}
-
-static mips_uword rc5_peek(MIPS_CPU *pcpu, mips_uword addr)
-{
-	mips_uword ret = mips_identity_peek_uw(pcpu, addr);
-	rc5_ecb_decrypt(&Gkey, &ret, &ret);
-	return ret;
-}
-
-static void rc5_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w)
-{
-	rc5_ecb_encrypt(&Gkey, &w, &w);
-	mips_identity_poke_uw(pcpu, addr, w);
+	if(pcpu->host && pcpu->host->kicks)
+		fprintf(stderr, "%sRING: %lu OPS IN %lu KICKS, %.1f OPS/KICK\n", tag,
+				pcpu->host->ring_ops, pcpu->host->kicks,
+				(double)pcpu->host->ring_ops / pcpu->host->kicks);
+	return -1;
 }
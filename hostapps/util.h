@@ -36,6 +36,7 @@
 
 #include "cpu.h"
 #include "rc5-16.h"
+#include "xform.h"
 
 /** Allocate space and read the complete ELF into memory. */
 void read_elf(const char *fname, char **elf, size_t *elfsz);
@@ -43,13 +44,56 @@ void read_elf(const char *fname, char **elf, size_t *elfsz);
 /** Convert key from a string of 32 hex digits. */
 int rc5_convert_key(struct rc5_key *pk, const char *hex);
 
-/** Prepare CPU for execution with optional encryption key. */
+/**
+ * Set up memory access functions and their context (MIPS_CPU::xform) for the
+ * optional encryption key.  The mode is taken from the ELF image of the CPU,
+ * if any; otherwise it is ECB.
+ */
+void prepare_xform(MIPS_CPU *pcpu, const char *asckey);
+
+/**
+ * Prepare CPU for execution with optional encryption key.  Thread-safe; CPUs
+ * with different keys may be prepared and run concurrently.
+ */
 void prepare_cpu(MIPS_CPU *pcpu, const char *exename, const char *asckey);
 
+/**
+ * Like prepare_cpu, but with an ELF image already read into memory, which may
+ * be shared by several CPUs and must not be freed while any of them exists.
+ */
+void prepare_cpu_image(MIPS_CPU *pcpu, const char *elf, size_t elfsz,
+					   const char *asckey);
+
+struct mips_checkpoint;
+
+/**
+ * Make execute_loop write a checkpoint every interval executed instructions;
+ * ck == NULL turns checkpointing off.
+ */
+void set_checkpoint(struct mips_checkpoint *ck, unsigned long interval);
+
+/**
+ * Bind native routines (see native.h) to the guest functions named in the
+ * comma-separated list; "all" binds every routine whose function the program
+ * has, silently skipping the others.  Exits with a message if a named
+ * function cannot be bound.
+ */
+void bind_natives(MIPS_CPU *pcpu, const char *list);
+
 /**
  * Execute until exception and report status to stdout.  Handles SPIM
- * syscalls.
+ * syscalls and native routines; buffered output of print services is
+ * flushed when execution stops.
  */
 void execute_loop(MIPS_CPU *pcpu);
 
+/**
+ * Execute several CPUs on the calling thread until all of them stop, in
+ * turns of a fixed number of instructions.  Their open, read and write
+ * syscalls go through an io_uring: a CPU waiting for one is parked while the
+ * others execute.  The end of each CPU is reported like by execute_loop,
+ * prefixed with its index.  Checkpoints are not written.
+ */
+void execute_many(MIPS_CPU **cpus, unsigned n);
+
 #endif	/* UTIL_H__ */
@@ -0,0 +1,431 @@
+/* 
+ * File:    xform.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ *
+ * Memory transform backends.
+ *
+ * - ECB decrypts every word with RC5-16 on every access.
+ * - CTR XORs words with the RC5-16 encryption of their address; the
+ *   keystream of recently used pages is cached, so most accesses cost a
+ *   single XOR.
+ * - AES encrypts 16-byte lines with AES-128 after XORing the line address
+ *   into the first word.  A segment ending inside a line cannot carry the
+ *   whole ciphertext of that line in the file, so its last words are instead
+ *   XORed with a keystream derived from the line address, and re-encrypted
+ *   as a whole line once loaded.  Decrypted lines are cached together with
+ *   their ciphertext; a cached line is used only while the ciphertext in
+ *   memory is unchanged, so writes that bypass the hooks (snapshot restore,
+ *   baseline reset) are always seen.  Pokes update the cached line and write
+ *   its new ciphertext through to memory.
+ *
+ * Caches are per thread because CPUs of one process may run on different
+ * threads; entries are tagged with their context since CPUs on one thread
+ * may use different keys.  Allocation failures are fatal, as the hooks have
+ * no way to report them.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include "xform.h"
+#include "rc5-16.h"
+#include "aes.h"
+
+#define KS_SLOTS	128				/* pages in the keystream cache */
+#define KS_WORDS	((1U << MIPS_PAGESHIFT) / 4)
+#define LINESZ		AES_BLOCKSZ
+#define LINE_WORDS	(LINESZ / 4)
+#define LINE_SLOTS	1024			/* lines in the AES line cache */
+#define LINE_BATCH	64				/* lines encrypted at once by blocks */
+
+#define XFORM(pcpu)	((const struct xform*)(pcpu)->xform)
+
+/** Context shared by all CPUs using the same key. */
+struct xform {
+	unsigned char key[XFORM_KEYLEN];	/**!< raw key */
+	struct rc5_key rc5;			/**!< expanded RC5 key */
+	struct aes_key aes;			/**!< expanded AES key */
+	struct xform *next;			/**!< next in Gxforms */
+};
+
+/** Cached keystream of one page in CTR mode. */
+struct ks_page {
+	const struct xform *owner;	/**!< context whose keystream this is */
+	mips_uword tag;				/**!< page number + 1; 0 when empty */
+	mips_uword ks[KS_WORDS];	/**!< keystream words */
+};
+
+/** Cached line in AES mode. */
+struct aes_line {
+	const struct xform *owner;	/**!< context which decrypted the line */
+	mips_uword tag;				/**!< line address + 1; 0 when empty */
+	mips_uword ct[LINE_WORDS];	/**!< ciphertext as in memory */
+	mips_uword pt[LINE_WORDS];	/**!< plaintext */
+};
+
+static mips_uword ecb_peek(MIPS_CPU *pcpu, mips_uword addr);
+static void ecb_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w);
+static void ecb_peek_block(MIPS_CPU *pcpu, mips_uword addr, mips_uword *dst,
+						   mips_uword n);
+static void ecb_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+						   const mips_uword *src, mips_uword n);
+static void ecb_encrypt(const struct xform *x, mips_uword addr,
+						const void *src, void *dst, size_t len);
+
+static const mips_uword *ks_lookup(const struct xform *x, mips_uword addr);
+static mips_uword ctr_peek(MIPS_CPU *pcpu, mips_uword addr);
+static void ctr_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w);
+static void ctr_peek_block(MIPS_CPU *pcpu, mips_uword addr, mips_uword *dst,
+						   mips_uword n);
+static void ctr_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+						   const mips_uword *src, mips_uword n);
+static void ctr_encrypt(const struct xform *x, mips_uword addr,
+						const void *src, void *dst, size_t len);
+
+static struct aes_line *line_lookup(MIPS_CPU *pcpu, mips_uword addr);
+static mips_uword aes_peek(MIPS_CPU *pcpu, mips_uword addr);
+static void aes_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w);
+static void aes_peek_block(MIPS_CPU *pcpu, mips_uword addr, mips_uword *dst,
+						   mips_uword n);
+static void aes_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+						   const mips_uword *src, mips_uword n);
+static void aes_encrypt(const struct xform *x, mips_uword addr,
+						const void *src, void *dst, size_t len);
+static void aes_tail_keystream(const struct xform *x, mips_uword line,
+							   mips_uword *ks);
+static int aes_load_tail(MIPS_CPU *pcpu, mips_uword addr, const void *src,
+						 size_t len);
+
+static const struct xform_backend Gbackends[XFORM_NMODES] = {
+	{ "ecb", RC5_BLOCKSZ, ecb_peek, ecb_poke, ecb_peek_block, ecb_poke_block,
+	  ecb_encrypt, NULL },
+	{ "ctr", RC5_BLOCKSZ, ctr_peek, ctr_poke, ctr_peek_block, ctr_poke_block,
+	  ctr_encrypt, NULL },
+	{ "aes", LINESZ, aes_peek, aes_poke, aes_peek_block, aes_poke_block,
+	  aes_encrypt, aes_load_tail }
+};
+
+static struct xform *Gxforms;
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+static __thread struct ks_page *Gks;		/* direct-mapped */
+static __thread struct aes_line *Glines;	/* direct-mapped */
+
+const struct xform_backend *xform_backend(int mode)
+{
+	return (mode >= 0) && (mode < XFORM_NMODES) ? &Gbackends[mode] : NULL;
+}
+
+int xform_find_mode(const char *name)
+{
+	int i;
+
+	for(i = 0; i < XFORM_NMODES; i++)
+		if(!strcmp(Gbackends[i].name, name))
+			return i;
+	return -1;
+}
+
+struct xform *xform_get(const unsigned char key[XFORM_KEYLEN])
+{
+	struct xform *x;
+
+	pthread_mutex_lock(&Glock);
+	for(x = Gxforms; x; x = x->next)
+		if(!memcmp(x->key, key, XFORM_KEYLEN))
+			break;
+	if(!x) {
+		if(!(x = malloc(sizeof(*x)))) {
+			perror("malloc");
+			exit(1);
+		}
+		memcpy(x->key, key, XFORM_KEYLEN);
+		memcpy(x->rc5.key, key, RC5_KEYLEN);
+		rc5_setup(&x->rc5);
+		memcpy(x->aes.key, key, AES_KEYLEN);
+		aes_setup(&x->aes);
+		x->next = Gxforms;
+		Gxforms = x;
+	}
+	pthread_mutex_unlock(&Glock);
+	return x;
+}
+
+int xform_attach(MIPS_CPU *pcpu, struct xform *x, int mode)
+{
+	const struct xform_backend *be = xform_backend(mode);
+
+	if(!be) {
+		errno = EINVAL;
+		return -1;
+	}
+	pcpu->xform = x;
+	pcpu->peek_uw = be->peek_uw;
+	pcpu->poke_uw = be->poke_uw;
+	pcpu->peek_block = be->peek_block;
+	pcpu->poke_block = be->poke_block;
+	return 0;
+}
+
+/* ECB */
+
+static mips_uword ecb_peek(MIPS_CPU *pcpu, mips_uword addr)
+{
+	mips_uword ret = mips_identity_peek_uw(pcpu, addr);
+	rc5_ecb_decrypt(&XFORM(pcpu)->rc5, &ret, &ret);
+	return ret;
+}
+
+static void ecb_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w)
+{
+	rc5_ecb_encrypt(&XFORM(pcpu)->rc5, &w, &w);
+	mips_identity_poke_uw(pcpu, addr, w);
+}
+
+static void ecb_peek_block(MIPS_CPU *pcpu, mips_uword addr, mips_uword *dst,
+						   mips_uword n)
+{
+	rc5_ecb_decrypt_blocks(&XFORM(pcpu)->rc5, pcpu->base + addr, dst, n);
+}
+
+static void ecb_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+						   const mips_uword *src, mips_uword n)
+{
+	rc5_ecb_encrypt_blocks(&XFORM(pcpu)->rc5, src, pcpu->base + addr, n);
+}
+
+static void ecb_encrypt(const struct xform *x, mips_uword addr,
+						const void *src, void *dst, size_t len)
+{
+	(void)addr;
+	rc5_ecb_encrypt_blocks(&x->rc5, src, dst, len / RC5_BLOCKSZ);
+}
+
+/* CTR */
+
+/**
+ * Return the keystream of context x for the word at addr, computing the
+ * keystream of the whole page in bulk on a miss.
+ */
+static const mips_uword *ks_lookup(const struct xform *x, mips_uword addr)
+{
+	mips_uword page = addr >> MIPS_PAGESHIFT;
+	struct ks_page *p;
+
+	if(!Gks && !(Gks = calloc(KS_SLOTS, sizeof(*Gks)))) {
+		perror("calloc");
+		exit(1);
+	}
+	p = &Gks[page % KS_SLOTS];
+	if((p->tag != page + 1) || (p->owner != x)) {
+		rc5_ctr_keystream(&x->rc5, page << MIPS_PAGESHIFT, p->ks, KS_WORDS);
+		p->owner = x;
+		p->tag = page + 1;
+	}
+	return &p->ks[(addr % (1U << MIPS_PAGESHIFT)) / 4];
+}
+
+static mips_uword ctr_peek(MIPS_CPU *pcpu, mips_uword addr)
+{
+	return mips_identity_peek_uw(pcpu, addr) ^ *ks_lookup(XFORM(pcpu), addr);
+}
+
+static void ctr_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w)
+{
+	mips_identity_poke_uw(pcpu, addr, w ^ *ks_lookup(XFORM(pcpu), addr));
+}
+
+static void ctr_peek_block(MIPS_CPU *pcpu, mips_uword addr, mips_uword *dst,
+						   mips_uword n)
+{
+	const mips_uword *src = (const mips_uword*)(pcpu->base + addr);
+	const mips_uword *ks;
+	mips_uword i, m;
+
+	for(; n; n -= m, addr += 4*m, src += m, dst += m) {
+		ks = ks_lookup(XFORM(pcpu), addr);
+		m = KS_WORDS - (addr % (1U << MIPS_PAGESHIFT)) / 4;
+		if(m > n)
+			m = n;
+		for(i = 0; i < m; i++)
+			dst[i] = src[i] ^ ks[i];
+	}
+}
+
+static void ctr_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+						   const mips_uword *src, mips_uword n)
+{
+	mips_uword *dst = (mips_uword*)(pcpu->base + addr);
+	const mips_uword *ks;
+	mips_uword i, m;
+
+	for(; n; n -= m, addr += 4*m, src += m, dst += m) {
+		ks = ks_lookup(XFORM(pcpu), addr);
+		m = KS_WORDS - (addr % (1U << MIPS_PAGESHIFT)) / 4;
+		if(m > n)
+			m = n;
+		for(i = 0; i < m; i++)
+			dst[i] = src[i] ^ ks[i];
+	}
+}
+
+static void ctr_encrypt(const struct xform *x, mips_uword addr,
+						const void *src, void *dst, size_t len)
+{
+	rc5_ctr_crypt(&x->rc5, addr, src, dst, len / RC5_BLOCKSZ);
+}
+
+/* AES */
+
+/** Return the cached line containing addr, decrypting it if necessary. */
+static struct aes_line *line_lookup(MIPS_CPU *pcpu, mips_uword addr)
+{
+	const struct xform *x = XFORM(pcpu);
+	mips_uword line = addr - addr % LINESZ;
+	const char *mem = pcpu->base + line;
+	struct aes_line *e;
+
+	if(!Glines && !(Glines = calloc(LINE_SLOTS, sizeof(*Glines)))) {
+		perror("calloc");
+		exit(1);
+	}
+	e = &Glines[(line / LINESZ) % LINE_SLOTS];
+	if((e->tag != line + 1) || (e->owner != x)
+	   || memcmp(e->ct, mem, LINESZ)) {
+		memcpy(e->ct, mem, LINESZ);
+		aes_decrypt_blocks(&x->aes, e->ct, e->pt, 1);
+		e->pt[0] ^= line;
+		e->owner = x;
+		e->tag = line + 1;
+	}
+	return e;
+}
+
+static mips_uword aes_peek(MIPS_CPU *pcpu, mips_uword addr)
+{
+	return line_lookup(pcpu, addr)->pt[addr % LINESZ / 4];
+}
+
+static void aes_poke(MIPS_CPU *pcpu, mips_uword addr, mips_uword w)
+{
+	struct aes_line *e = line_lookup(pcpu, addr);
+	mips_uword line = e->tag - 1;
+	mips_uword t[LINE_WORDS];
+
+	e->pt[addr % LINESZ / 4] = w;
+	memcpy(t, e->pt, LINESZ);
+	t[0] ^= line;
+	aes_encrypt_blocks(&XFORM(pcpu)->aes, t, e->ct, 1);
+	memcpy(pcpu->base + line, e->ct, LINESZ);
+}
+
+/** Whole lines go straight through the cipher; partial lines by words. */
+static void aes_peek_block(MIPS_CPU *pcpu, mips_uword addr, mips_uword *dst,
+						   mips_uword n)
+{
+	mips_uword i, m;
+
+	for(; n && (addr % LINESZ); n--, addr += 4)
+		*dst++ = aes_peek(pcpu, addr);
+	if((m = n / LINE_WORDS) != 0) {
+		aes_decrypt_blocks(&XFORM(pcpu)->aes, pcpu->base + addr, dst, m);
+		for(i = 0; i < m; i++, addr += LINESZ, dst += LINE_WORDS)
+			dst[0] ^= addr;
+		n -= m * LINE_WORDS;
+	}
+	for(; n; n--, addr += 4)
+		*dst++ = aes_peek(pcpu, addr);
+}
+
+static void aes_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+						   const mips_uword *src, mips_uword n)
+{
+	mips_uword m;
+
+	for(; n && (addr % LINESZ); n--, addr += 4)
+		aes_poke(pcpu, addr, *src++);
+	if((m = n / LINE_WORDS) != 0) {
+		aes_encrypt(XFORM(pcpu), addr, src, pcpu->base + addr, m * LINESZ);
+		addr += m * LINESZ;
+		src += m * LINE_WORDS;
+		n -= m * LINE_WORDS;
+	}
+	for(; n; n--, addr += 4)
+		aes_poke(pcpu, addr, *src++);
+}
+
+static void aes_encrypt(const struct xform *x, mips_uword addr,
+						const void *src, void *dst, size_t len)
+{
+	mips_uword buf[LINE_BATCH * LINE_WORDS];
+	const char *s = src;
+	char *d = dst;
+	size_t i, m;
+
+	for(; len >= LINESZ; len -= m, addr += m, s += m, d += m) {
+		m = len < sizeof(buf) ? len - len % LINESZ : sizeof(buf);
+		memcpy(buf, s, m);
+		for(i = 0; i < m / LINESZ; i++)
+			buf[i * LINE_WORDS] ^= addr + i * LINESZ;
+		aes_encrypt_blocks(&x->aes, buf, d, m / LINESZ);
+	}
+	if(len) {
+		aes_tail_keystream(x, addr, buf);
+		memcpy(buf + LINE_WORDS, s, len);
+		for(i = 0; i < len / 4; i++)
+			buf[LINE_WORDS + i] ^= buf[i];
+		memcpy(d, buf + LINE_WORDS, len);
+	}
+}
+
+/**
+ * Compute the keystream for the partial line at the end of a segment: the
+ * encryption of the line address followed by a constant.
+ */
+static void aes_tail_keystream(const struct xform *x, mips_uword line,
+							   mips_uword *ks)
+{
+	ks[0] = line;
+	ks[1] = ks[2] = 0;
+	ks[3] = 1;
+	aes_encrypt_blocks(&x->aes, ks, ks, 1);
+}
+
+/** Decrypt the partial line and store it through the cipher as a whole line. */
+static int aes_load_tail(MIPS_CPU *pcpu, mips_uword addr, const void *src,
+						 size_t len)
+{
+	mips_uword ks[LINE_WORDS], pt[LINE_WORDS];
+	size_t i;
+
+	aes_tail_keystream(XFORM(pcpu), addr, ks);
+	memset(pt, 0, sizeof(pt));
+	memcpy(pt, src, len);
+	for(i = 0; i < len / 4; i++)
+		pt[i] ^= ks[i];
+	return mips_copyout(pcpu, addr, pt, LINESZ);
+}
@@ -0,0 +1,105 @@
+/* 
+ * File:    xform.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Memory transforms (encryption) of guest memory and ELF images.
+ *
+ * Each mode is implemented by a backend which supplies the MIPS_CPU memory
+ * access hooks and the function used by elfcrypt to encrypt file contents.
+ * Backends share one context per key (struct xform), stored in
+ * MIPS_CPU::xform.
+ */
+
+#ifndef XFORM_H__
+#define XFORM_H__
+
+#include <stddef.h>
+#include "cpu.h"
+
+/**
+ * The e_ident byte of an encrypted ELF which records the transform applied
+ * by elfcrypt: the mode, or XFORM_IDENT_ECB for ECB, so that an encrypted
+ * file is never marked 0 like a plain one.  Files from older versions have 0
+ * there, i.e. ECB.
+ */
+#define XFORM_IDENT		EI_PAD
+#define XFORM_IDENT_ECB	0xFF
+
+#define XFORM_KEYLEN	16		/* (bytes) */
+
+/** Memory transforms. */
+enum xform_mode {
+	XFORM_ECB,					/**!< RC5: every word encrypted by itself */
+	XFORM_CTR,					/**!< RC5: XOR with the encrypted word address */
+	XFORM_AES,					/**!< AES: 16-byte lines tweaked by address */
+	XFORM_NMODES
+};
+
+struct xform;
+
+/** Implementation of one mode. */
+struct xform_backend {
+	const char			*name;			/**!< Name used on command-lines. */
+	unsigned			align;			/**!< Granularity of encrypted ranges. */
+	mips_peek_uw_f		peek_uw;
+	mips_poke_uw_f		poke_uw;
+	mips_peek_block_f	peek_block;
+	mips_poke_block_f	poke_block;
+	/**
+	 * Encrypt len bytes to be loaded at addr.  addr is a multiple of align,
+	 * len a multiple of 4; a final partial unit is encrypted so that load_tail
+	 * can store it after loading.
+	 */
+	void (*encrypt)(const struct xform *x, mips_uword addr, const void *src,
+					void *dst, size_t len);
+	/**
+	 * Store len (< align) bytes, encrypted by encrypt at addr, into memory
+	 * after the ELF loader has copied them verbatim; the rest of the unit is
+	 * zeroed.  Return 0 on success and -1 if the unit is outside of memory.
+	 * NULL if align is the word size.
+	 */
+	int (*load_tail)(MIPS_CPU *pcpu, mips_uword addr, const void *src,
+					 size_t len);
+};
+
+/** Return the backend for mode, or NULL if the mode is unknown. */
+const struct xform_backend *xform_backend(int mode);
+
+/** Return the mode with the given backend name, or -1. */
+int xform_find_mode(const char *name);
+
+/**
+ * Find or create the context for the key.  Contexts are immutable and live
+ * as long as the process.  Thread-safe.
+ */
+struct xform *xform_get(const unsigned char key[XFORM_KEYLEN]);
+
+/**
+ * Install context x and the hooks of the backend for mode in pcpu.  Return
+ * 0 on success and -1 (errno = EINVAL) if the mode is unknown.
+ */
+int xform_attach(MIPS_CPU *pcpu, struct xform *x, int mode);
+
+#endif	/* XFORM_H__ */
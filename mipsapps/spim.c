@@ -10,9 +10,35 @@
 		rv;										\
 	})
 
-unsigned long long gettime(void)
+/* Time page updated by the host (see time_map); gettime falls back to the
+ * syscall when the page has not advanced since the last call, so that the
+ * time is still fine-grained and never goes backwards.  The host may refresh
+ * the page between the loads of its two words, so the high word is loaded
+ * again and the read is retried if it changed. */
+static unsigned long long Gtime_page;
+static unsigned long long Gtime_last;
+static int Gtime_mapped;
+
+static unsigned long long __attribute__((noinline)) sys_gettime(void)
 { SYSCALL(3); }
 
+unsigned long long gettime(void)
+{
+	volatile unsigned *page = (volatile unsigned*)&Gtime_page;
+	unsigned long long t;
+	unsigned hi;
+
+	if(!Gtime_mapped)
+		Gtime_mapped = time_map(&Gtime_page) ? -1 : 1;
+	do {
+		hi = page[1];
+		t = ((unsigned long long)hi << 32) | page[0];
+	} while(page[1] != hi);
+	if((Gtime_mapped > 0) && (t > Gtime_last))
+		return Gtime_last = t;
+	return Gtime_last = sys_gettime();
+}
+
 void print_int(int n)
 { SYSCALL(1); }
 
@@ -49,5 +75,105 @@ int close(int fd)
 int lseek(int fd, unsigned off, int whence)
 { return (int)SYSCALL(2); }
 
+void *mmap(void *addr, unsigned len, int flags, int fd)
+{ return SYSCALL(17); }
+
+int read_input(void *buf, unsigned len, int mode)
+{ return (int)SYSCALL(18); }
+
+int ring_kick(struct spim_ring *ring)
+{ return (int)SYSCALL(19); }
+
+void ring_init(struct spim_ring *ring, unsigned size)
+{
+	ring->size = size;
+	ring->head = ring->tail = 0;
+}
+
+/* Queue a request, kicking the ring first if it is full. */
+struct spim_op *ring_submit(struct spim_ring *ring, int service,
+							int a0, int a1, int a2)
+{
+	struct spim_op *op;
+
+	if(ring->tail - ring->head == ring->size)
+		ring_kick(ring);
+	op = &ring->op[ring->tail & (ring->size - 1)];
+	op->service = service;
+	op->arg[0] = a0;
+	op->arg[1] = a1;
+	op->arg[2] = a2;
+	++ring->tail;
+	return op;
+}
+
+struct spim_op *ring_print_int(struct spim_ring *ring, int n)
+{ return ring_submit(ring, 1, n, 0, 0); }
+
+struct spim_op *ring_print_string(struct spim_ring *ring, const char *str)
+{ return ring_submit(ring, 4, (int)str, 0, 0); }
+
+struct spim_op *ring_print_char(struct spim_ring *ring, char ch)
+{ return ring_submit(ring, 11, ch, 0, 0); }
+
+struct spim_op *ring_read(struct spim_ring *ring, int fd, void *buf,
+						  unsigned len)
+{ return ring_submit(ring, 14, fd, (int)buf, len); }
+
+struct spim_op *ring_write(struct spim_ring *ring, int fd, const void *buf,
+						   unsigned len)
+{ return ring_submit(ring, 15, fd, (int)buf, len); }
+
+int time_map(unsigned long long *page)
+{ return (int)SYSCALL(20); }
+
+void *memcpy(void *dst, const void *src, unsigned len)
+{ return SYSCALL(21); }
+
+void *memset(void *dst, int c, unsigned len)
+{ return SYSCALL(22); }
+
+int memcmp(const void *a, const void *b, unsigned len)
+{ return (int)SYSCALL(23); }
+
+unsigned strlen(const char *str)
+{ return (unsigned)SYSCALL(24); }
+
+int vprintf(const char *fmt, __builtin_va_list ap)
+{ return (int)SYSCALL(25); }
+
+int printf(const char *fmt, ...)
+{
+	__builtin_va_list ap;
+	int n;
+
+	__builtin_va_start(ap, fmt);
+	n = vprintf(fmt, ap);
+	__builtin_va_end(ap);
+	return n;
+}
+
+/* The compiler may turn printf calls into puts and putchar. */
+int puts(const char *str)
+{ return printf("%s\n", str); }
+
+int putchar(int ch)
+{
+	print_char(ch);
+	return (unsigned char)ch;
+}
+
+void *malloc(unsigned size)
+{ return SYSCALL(26); }
+
+void free(void *ptr)
+{ SYSCALL(27); }
+
+void *realloc(void *ptr, unsigned size)
+{ return SYSCALL(28); }
+
+void *calloc(unsigned n, unsigned size)
+{ return SYSCALL(29); }
+
 void _start(void)
 { asm volatile("jal main ; break 0"); }
@@ -20,6 +20,33 @@
 #define SEEK_CUR 1
 #define SEEK_END 2
 
+#define MAP_PRIVATE 0
+#define MAP_SHARED  1
+#define MAP_FAILED  ((void*)-1)
+
+#define READ_LINE  0
+#define READ_BLOCK 1
+
+/* Batch of service requests performed by a single ring_kick.  Entries are
+ * queued at tail and performed from head up to tail; the result of a request
+ * is valid after the kick which performed it, until its entry is reused.
+ * gettime, mmap and ring_kick cannot be queued (their result is -1). */
+
+struct spim_op {
+	int service;
+	int arg[3];
+	int result;
+};
+
+struct spim_ring {
+	unsigned size;				/* Number of entries, a power of two. */
+	unsigned head;				/* Advanced by the host. */
+	unsigned tail;				/* Advanced by the program. */
+	struct spim_op op[];
+};
+
+#define SPIM_RING_BYTES(size) (sizeof(struct spim_ring) + (size)*sizeof(struct spim_op))
+
 unsigned long long gettime(void);
 void print_int(int);
 void print_string(const char*);
@@ -33,5 +60,29 @@ int read(int, void*, unsigned);
 int write(int, void*, unsigned);
 int close(int);
 int lseek(int, unsigned, int);
+void *mmap(void*, unsigned, int, int);
+int read_input(void*, unsigned, int);
+int ring_kick(struct spim_ring*);
+int time_map(unsigned long long*);
+void *memcpy(void*, const void*, unsigned);
+void *memset(void*, int, unsigned);
+int memcmp(const void*, const void*, unsigned);
+unsigned strlen(const char*);
+int vprintf(const char*, __builtin_va_list);
+int printf(const char*, ...);
+int puts(const char*);
+int putchar(int);
+void *malloc(unsigned);
+void free(void*);
+void *realloc(void*, unsigned);
+void *calloc(unsigned, unsigned);
+
+void ring_init(struct spim_ring*, unsigned);
+struct spim_op *ring_submit(struct spim_ring*, int, int, int, int);
+struct spim_op *ring_print_int(struct spim_ring*, int);
+struct spim_op *ring_print_string(struct spim_ring*, const char*);
+struct spim_op *ring_print_char(struct spim_ring*, char);
+struct spim_op *ring_read(struct spim_ring*, int, void*, unsigned);
+struct spim_op *ring_write(struct spim_ring*, int, const void*, unsigned);
 
 #endif	/* SPIM_H__ */
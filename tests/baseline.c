@@ -0,0 +1,204 @@
+/* 
+ * File:    baseline.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Baselines of clones: a fresh clone must reuse the image it shares with its
+ * parent, a modified one must get an image of its own, and resetting must
+ * restore memory and registers in both cases, as well as the heap along with
+ * the break.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "cpu.h"
+#include "memory.h"
+#include "heap.h"
+#include "syscalls.h"
+#include "util.h"
+
+#define MEMSZ (2U << 20)
+#define STKSZ (16U << 10)
+#define FIRST 0x10000		/* first modified address */
+#define NPAGES 8			/* number of modified pages */
+
+static void set_baseline(MIPS_CPU *pcpu);
+static void modify(MIPS_CPU *pcpu, unsigned round);
+static void reset(MIPS_CPU *pcpu);
+static void compare(MIPS_CPU *pcpu, const char *mem, const MIPS_CPU *regs,
+					const char *what);
+static ino_t image_ino(MIPS_CPU *pcpu);
+static void check_heap(MIPS_CPU *pcpu);
+static mips_uword service(MIPS_CPU *pcpu, mips_uword n, mips_uword a0);
+
+int main(int argc, char **argv)
+{
+	MIPS_CPU *parent, *clone, saved;
+	char *base, *mem;
+
+	if(argc != 2) {
+		fprintf(stderr, "USAGE: %s ELF\n", argv[0]);
+		exit(1);
+	}
+	mips_init();
+	if(!(base = mips_alloc_memory(MEMSZ)) || !(mem = malloc(MEMSZ))) {
+		perror("malloc");
+		exit(1);
+	}
+	parent = mips_init_cpu(base, MEMSZ, STKSZ);
+	prepare_cpu(parent, argv[1], NULL);
+	if(!(clone = mips_clone_cpu(parent))) {
+		perror("mips_clone_cpu");
+		exit(1);
+	}
+
+	set_baseline(clone);
+	if(image_ino(clone) != image_ino(parent)) {
+		fprintf(stderr, "FAIL: fresh clone froze a new image\n");
+		exit(1);
+	}
+	modify(clone, 1);
+	reset(clone);
+	compare(clone, parent->base, parent, "reset of fresh clone");
+
+	modify(clone, 2);
+	memcpy(mem, clone->base, MEMSZ);
+	saved = *clone;
+	set_baseline(clone);
+	if(image_ino(clone) == image_ino(parent)) {
+		fprintf(stderr, "FAIL: modified clone reused the parent's image\n");
+		exit(1);
+	}
+	modify(clone, 3);
+	reset(clone);
+	compare(clone, mem, &saved, "reset of modified clone");
+	check_heap(clone);
+
+	mips_free_cpu(clone);
+	mips_free_cpu(parent);
+	free(mem);
+	printf("OK\n");
+	return 0;
+}
+
+static void set_baseline(MIPS_CPU *pcpu)
+{
+	if(mips_set_baseline(pcpu) < 0) {
+		perror("mips_set_baseline");
+		exit(1);
+	}
+}
+
+/** Modify memory and registers differently in each round. */
+static void modify(MIPS_CPU *pcpu, unsigned round)
+{
+	mips_uword addr;
+	int i;
+
+	for(addr = FIRST; addr < FIRST + (NPAGES << MIPS_PAGESHIFT); addr += 4)
+		mips_poke_uw(pcpu, addr, addr * round);
+	for(i = 1; i < 32; i++)
+		pcpu->r.ur[i] += round;
+	pcpu->pc += 4 * round;
+}
+
+static void reset(MIPS_CPU *pcpu)
+{
+	if(mips_reset_to_baseline(pcpu) < 0) {
+		perror("mips_reset_to_baseline");
+		exit(1);
+	}
+}
+
+/** Compare guest memory with mem and registers with those of regs. */
+static void compare(MIPS_CPU *pcpu, const char *mem, const MIPS_CPU *regs,
+					const char *what)
+{
+	if(((char*)pcpu != pcpu->base) || !pcpu->host
+	   || memcmp(pcpu->base + MIPS_LOWBASE, mem + MIPS_LOWBASE,
+				 MEMSZ - MIPS_LOWBASE)
+	   || memcmp(&pcpu->r, &regs->r, sizeof(pcpu->r)) || (pcpu->pc != regs->pc)) {
+		fprintf(stderr, "FAIL: %s\n", what);
+		exit(1);
+	}
+}
+
+/** Return the inode number of the memory image of the CPU. */
+static ino_t image_ino(MIPS_CPU *pcpu)
+{
+	struct stat st;
+
+	if(fstat(pcpu->host->image_fd, &st) < 0) {
+		perror("fstat");
+		exit(1);
+	}
+	return st.st_ino;
+}
+
+/**
+ * The heap must not hand out memory which the program has obtained with sbrk
+ * from the restored break, and a block allocated before the baseline must
+ * stay allocated after a reset.
+ */
+static void check_heap(MIPS_CPU *pcpu)
+{
+	mips_uword brk, p, q, s;
+
+	set_baseline(pcpu);
+	brk = pcpu->brk;
+	if(!service(pcpu, 26, 100) || (pcpu->brk == brk))
+		goto fail;
+	reset(pcpu);
+	if((pcpu->brk != brk) || ((s = service(pcpu, 9, 4096)) != brk))
+		goto fail;
+	if(!(q = service(pcpu, 26, 100)) || ((q < s + 4096) && (q + 100 > s)))
+		goto fail;
+
+	set_baseline(pcpu);
+	if(!(p = service(pcpu, 26, 100)))
+		goto fail;
+	reset(pcpu);
+	if((mips_heap_size(pcpu, q) < 100) || mips_heap_size(pcpu, p))
+		goto fail;
+	return;
+
+fail:
+	fprintf(stderr, "FAIL: heap after reset\n");
+	exit(1);
+}
+
+/** Perform a service with one argument and return $v0. */
+static mips_uword service(MIPS_CPU *pcpu, mips_uword n, mips_uword a0)
+{
+	int err;
+
+	pcpu->r.ur[4] = a0;
+	if((err = mips_spim_service(pcpu, n)) != 0) {
+		fprintf(stderr, "FAIL: service %u: error %d\n", n, err);
+		exit(1);
+	}
+	return pcpu->r.ur[2];
+}
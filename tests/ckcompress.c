@@ -0,0 +1,150 @@
+/* 
+ * File:    ckcompress.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Checkpoints and snapshots of a CPU whose memory has been compressed: pages
+ * are filled with a pattern and compressed before each checkpoint and before
+ * saving the snapshot, and the restored memory must match the live one.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "compress.h"
+#include "memory.h"
+#include "snapshot.h"
+#include "util.h"
+
+#define MEMSZ (2U << 20)
+#define STKSZ (16U << 10)
+#define FIRST 0x10000		/* first filled address */
+#define NPAGES 16			/* number of filled pages */
+
+static void fill(MIPS_CPU *pcpu, unsigned round);
+static void compress(MIPS_CPU *pcpu);
+static void compare(MIPS_CPU *pcpu, MIPS_CPU *copy, const char *what);
+
+int main(int argc, char **argv)
+{
+	struct mips_checkpoint *ck;
+	char *base, snap[256];
+	MIPS_CPU *pcpu, *copy;
+	unsigned round;
+	int n;
+
+	if(argc != 3) {
+		fprintf(stderr, "USAGE: %s ELF NAME\n", argv[0]);
+		exit(1);
+	}
+	snprintf(snap, sizeof(snap), "%s.snap", argv[2]);
+
+	mips_init();
+	if(!(base = mips_alloc_memory(MEMSZ))) {
+		perror("mips_alloc_memory");
+		exit(1);
+	}
+	pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
+	prepare_cpu(pcpu, argv[1], NULL);
+	if(mips_compress_register(pcpu) < 0) {
+		perror("mips_compress_register");
+		exit(1);
+	}
+	if(!(ck = mips_checkpoint_begin(pcpu, argv[2], 0))) {
+		perror("mips_checkpoint_begin");
+		exit(1);
+	}
+
+	for(round = 1; round <= 2; round++) {
+		fill(pcpu, round);
+		compress(pcpu);
+		if((n = mips_checkpoint(ck)) < 0) {
+			perror("mips_checkpoint");
+			exit(1);
+		}
+		if(n < NPAGES) {
+			fprintf(stderr, "FAIL: checkpoint wrote %d pages\n", n);
+			exit(1);
+		}
+	}
+	if(!(copy = mips_checkpoint_restore(argv[2]))) {
+		perror("mips_checkpoint_restore");
+		exit(1);
+	}
+	compare(pcpu, copy, "checkpoint");
+	mips_snapshot_unload(copy);
+
+	compress(pcpu);
+	if(mips_snapshot_save(pcpu, snap) < 0) {
+		perror("mips_snapshot_save");
+		exit(1);
+	}
+	if(!(copy = mips_snapshot_load(snap))) {
+		perror("mips_snapshot_load");
+		exit(1);
+	}
+	compare(pcpu, copy, "snapshot");
+	mips_snapshot_unload(copy);
+
+	mips_checkpoint_end(ck);
+	mips_free_cpu(pcpu);
+	printf("OK\n");
+	return 0;
+}
+
+/** Fill the pages with a compressible pattern that differs in each round. */
+static void fill(MIPS_CPU *pcpu, unsigned round)
+{
+	mips_uword addr;
+
+	for(addr = FIRST; addr < FIRST + (NPAGES << MIPS_PAGESHIFT); addr += 4)
+		mips_poke_uw(pcpu, addr, (addr >> MIPS_PAGESHIFT) * 0x01010101U + round);
+}
+
+/** Compress the CPU's memory; the filled pages must all be compressed. */
+static void compress(MIPS_CPU *pcpu)
+{
+	int n;
+
+	if((n = mips_compress_cpu(pcpu)) < 0) {
+		perror("mips_compress_cpu");
+		exit(1);
+	}
+	if(n < NPAGES) {
+		fprintf(stderr, "FAIL: only %d pages compressed\n", n);
+		exit(1);
+	}
+}
+
+/** Compare guest memory and registers of the CPU and its restored copy. */
+static void compare(MIPS_CPU *pcpu, MIPS_CPU *copy, const char *what)
+{
+	if(memcmp(pcpu->base + MIPS_LOWBASE, copy->base + MIPS_LOWBASE,
+			  MEMSZ - MIPS_LOWBASE)
+	   || memcmp(&pcpu->r, &copy->r, sizeof(pcpu->r)) || (pcpu->pc != copy->pc)) {
+		fprintf(stderr, "FAIL: %s differs from the live CPU\n", what);
+		exit(1);
+	}
+}
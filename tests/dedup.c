@@ -0,0 +1,186 @@
+/* 
+ * File:    dedup.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Sharing of identical pages among clones: checks the statistics reported by
+ * the store as clones are deduplicated, written to, cloned, reset and freed,
+ * and that every CPU keeps seeing its own memory.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "cpu.h"
+#include "memory.h"
+#include "dedup.h"
+#include "util.h"
+
+#define MEMSZ (2U << 20)
+#define STKSZ (16U << 10)
+#define FIRST 0x10000		/* first modified address */
+#define NPAGES 8			/* number of modified host pages */
+#define PATTERN 0x5a5a5a5a	/* common contents: address ^ PATTERN */
+#define ODD 0xdeadbeef		/* word making a page distinct */
+
+static size_t Gpagesz;
+
+static void fill(MIPS_CPU *pcpu);
+static void dedup(MIPS_CPU *pcpu, int expected);
+static void check_stats(size_t shared, size_t store, const char *what);
+static void check(MIPS_CPU *pcpu, mips_uword odd, const char *what);
+
+int main(int argc, char **argv)
+{
+	MIPS_CPU *parent, *clone[4];
+	mips_uword last;
+	char *base;
+	int i;
+
+	if(argc != 2) {
+		fprintf(stderr, "USAGE: %s ELF\n", argv[0]);
+		exit(1);
+	}
+	Gpagesz = sysconf(_SC_PAGESIZE);
+	last = FIRST + NPAGES * Gpagesz - 4;
+
+	mips_init();
+	if(!(base = mips_alloc_memory(MEMSZ))) {
+		perror("mips_alloc_memory");
+		exit(1);
+	}
+	parent = mips_init_cpu(base, MEMSZ, STKSZ);
+	prepare_cpu(parent, argv[1], NULL);
+	if(mips_dedup_init(4 * NPAGES) < 0) {
+		perror("mips_dedup_init");
+		exit(1);
+	}
+
+	/* Three clones with identical pages, except that the last page of the
+	 * third one differs. */
+
+	for(i = 0; i < 3; i++) {
+		if(!(clone[i] = mips_clone_cpu(parent))
+		   || (mips_set_baseline(clone[i]) < 0)) {
+			perror("clone");
+			exit(1);
+		}
+		fill(clone[i]);
+	}
+	mips_poke_uw(clone[2], last, ODD);
+	for(i = 0; i < 3; i++)
+		dedup(clone[i], NPAGES);
+	check_stats(3 * NPAGES, NPAGES + 1, "after dedup");
+	check(clone[2], last, "third clone after dedup");
+
+	/* A write breaks sharing of one page, which is then shared again. */
+
+	mips_poke_uw(clone[1], FIRST, ODD);
+	dedup(clone[1], 1);
+	check_stats(3 * NPAGES, NPAGES + 2, "after write");
+	check(clone[0], 0, "first clone after write");
+	check(clone[1], FIRST, "second clone after write");
+
+	/* A clone of a deduplicated CPU copies its shared pages. */
+
+	if(!(clone[3] = mips_clone_cpu(clone[0]))) {
+		perror("mips_clone_cpu");
+		exit(1);
+	}
+	check(clone[3], 0, "clone of deduplicated clone");
+
+	/* Reset maps the shared pages from the image again. */
+
+	if(mips_reset_to_baseline(clone[0]) < 0) {
+		perror("mips_reset_to_baseline");
+		exit(1);
+	}
+	check_stats(2 * NPAGES, NPAGES + 2, "after reset");
+	if(memcmp(clone[0]->base + MIPS_LOWBASE, parent->base + MIPS_LOWBASE,
+			  MEMSZ - MIPS_LOWBASE)) {
+		fprintf(stderr, "FAIL: reset of deduplicated clone\n");
+		exit(1);
+	}
+	check(clone[2], last, "third clone after reset");
+
+	for(i = 0; i < 4; i++)
+		mips_free_cpu(clone[i]);
+	mips_free_cpu(parent);
+	check_stats(0, 0, "after free");
+	printf("OK\n");
+	return 0;
+}
+
+/** Fill the modified pages with the common contents. */
+static void fill(MIPS_CPU *pcpu)
+{
+	mips_uword addr;
+
+	for(addr = FIRST; addr < FIRST + NPAGES * Gpagesz; addr += 4)
+		mips_poke_uw(pcpu, addr, addr ^ PATTERN);
+}
+
+static void dedup(MIPS_CPU *pcpu, int expected)
+{
+	int n;
+
+	if((n = mips_dedup_cpu(pcpu)) < 0) {
+		perror("mips_dedup_cpu");
+		exit(1);
+	}
+	if(n != expected) {
+		fprintf(stderr, "FAIL: %d pages shared, expected %d\n", n, expected);
+		exit(1);
+	}
+}
+
+static void check_stats(size_t shared, size_t store, const char *what)
+{
+	struct mips_dedup_stats stats;
+
+	mips_dedup_get_stats(&stats);
+	if((stats.shared_pages != shared) || (stats.store_pages != store)
+	   || (stats.saved_bytes != (shared - store) * Gpagesz)) {
+		fprintf(stderr, "FAIL: %s: %lu shared, %lu distinct, %lu bytes saved\n",
+				what, (unsigned long)stats.shared_pages,
+				(unsigned long)stats.store_pages,
+				(unsigned long)stats.saved_bytes);
+		exit(1);
+	}
+}
+
+/** Check the common contents, except for ODD at address odd (if nonzero). */
+static void check(MIPS_CPU *pcpu, mips_uword odd, const char *what)
+{
+	mips_uword addr, expected;
+
+	for(addr = FIRST; addr < FIRST + NPAGES * Gpagesz; addr += 4) {
+		expected = addr == odd ? ODD : addr ^ PATTERN;
+		if(mips_peek_uw(pcpu, addr) != expected) {
+			fprintf(stderr, "FAIL: %s at 0x%x\n", what, addr);
+			exit(1);
+		}
+	}
+}
@@ -0,0 +1,106 @@
+/* 
+ * File:    heap.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * The heap services: calloc must return cleared memory also when it reuses a
+ * freed block, and NULL when the size overflows.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include "cpu.h"
+#include "memory.h"
+#include "syscalls.h"
+#include "util.h"
+
+#define MEMSZ (2U << 20)
+#define STKSZ (16U << 10)
+#define SIZE 1000			/* bytes per block */
+
+static mips_uword service(MIPS_CPU *pcpu, mips_uword n, mips_uword a0,
+						  mips_uword a1);
+static void fail(const char *what);
+
+int main(int argc, char **argv)
+{
+	MIPS_CPU *pcpu;
+	mips_uword p, q, i;
+	char *base;
+
+	if(argc != 2) {
+		fprintf(stderr, "USAGE: %s ELF\n", argv[0]);
+		exit(1);
+	}
+	mips_init();
+	if(!(base = mips_alloc_memory(MEMSZ))) {
+		perror("mips_alloc_memory");
+		exit(1);
+	}
+	pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
+	prepare_cpu(pcpu, argv[1], NULL);
+
+	/* Dirty a block, free it and get it back from calloc. */
+
+	if(!(p = service(pcpu, 26, SIZE, 0)))
+		fail("malloc");
+	for(i = 0; i < SIZE; i += 4)
+		mips_poke_uw(pcpu, p + i, 0xdeadbeef);
+	service(pcpu, 27, p, 0);
+	if(!(q = service(pcpu, 29, SIZE / 4, 4)))
+		fail("calloc");
+	if(q != p)
+		fail("calloc did not reuse the freed block");
+	for(i = 0; i < SIZE; i += 4)
+		if(mips_peek_uw(pcpu, q + i))
+			fail("calloc returned memory that is not cleared");
+
+	if(service(pcpu, 29, 0x10000, 0x10000))
+		fail("calloc did not detect overflow");
+
+	mips_free_cpu(pcpu);
+	printf("OK\n");
+	return 0;
+}
+
+/** Perform a service with two arguments and return $v0. */
+static mips_uword service(MIPS_CPU *pcpu, mips_uword n, mips_uword a0,
+						  mips_uword a1)
+{
+	int err;
+
+	pcpu->r.ur[4] = a0;
+	pcpu->r.ur[5] = a1;
+	if((err = mips_spim_service(pcpu, n)) != 0) {
+		fprintf(stderr, "FAIL: service %u: error %d\n", n, err);
+		exit(1);
+	}
+	return pcpu->r.ur[2];
+}
+
+static void fail(const char *what)
+{
+	fprintf(stderr, "FAIL: %s\n", what);
+	exit(1);
+}
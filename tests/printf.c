@@ -0,0 +1,115 @@
+/* 
+ * File:    printf.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * The printf service: floating-point conversions must consume their 8-byte
+ * aligned double, so that the conversions after them get the right arguments.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cpu.h"
+#include "memory.h"
+#include "syscalls.h"
+#include "util.h"
+
+#define MEMSZ (2U << 20)
+#define STKSZ (16U << 10)
+#define FMT 0x10000			/* format string */
+#define ARGS 0x10100		/* argument block */
+
+static void put_double(MIPS_CPU *pcpu, mips_uword addr, double d);
+static void check(MIPS_CPU *pcpu, const char *fmt, const char *expected);
+
+int main(int argc, char **argv)
+{
+	MIPS_CPU *pcpu;
+	char *base;
+
+	if(argc != 2) {
+		fprintf(stderr, "USAGE: %s ELF\n", argv[0]);
+		exit(1);
+	}
+	mips_init();
+	if(!(base = mips_alloc_memory(MEMSZ))) {
+		perror("mips_alloc_memory");
+		exit(1);
+	}
+	pcpu = mips_init_cpu(base, MEMSZ, STKSZ);
+	prepare_cpu(pcpu, argv[1], NULL);
+	mips_set_flush_policy(pcpu, MIPS_FLUSH_FULL);
+
+	/* int, then a double aligned to 8 after a 4-byte gap, then more. */
+
+	mips_poke_uw(pcpu, ARGS, 7);
+	put_double(pcpu, ARGS + 8, 3.25);
+	mips_poke_uw(pcpu, ARGS + 16, 42);
+	put_double(pcpu, ARGS + 24, 0.5);
+	mips_poke_uw(pcpu, ARGS + 32, 0xbeef);
+	mips_poke_uw(pcpu, ARGS + 40, 0xffffffff);
+	mips_poke_uw(pcpu, ARGS + 44, 0x7fffffff);
+
+	check(pcpu, "%d %.2f %d %g %x %lld\n",
+		  "7 3.25 42 0.5 beef 9223372036854775807\n");
+	check(pcpu, "%d|%8.3e|%d|%-6G|%X\n", "7|3.250e+00|42|0.5   |BEEF\n");
+	check(pcpu, "%d %a %d %Lf\n", "7 0x1.ap+1 42 0.500000\n");
+
+	mips_free_cpu(pcpu);
+	printf("OK\n");
+	return 0;
+}
+
+/** Store a double as o32 passes it: low word first (little-endian). */
+static void put_double(MIPS_CPU *pcpu, mips_uword addr, double d)
+{
+	unsigned long long bits;
+
+	memcpy(&bits, &d, sizeof(bits));
+	mips_poke_uw(pcpu, addr, (mips_uword)bits);
+	mips_poke_uw(pcpu, addr + 4, (mips_uword)(bits >> 32));
+}
+
+/** Format the argument block with fmt and compare the buffered output. */
+static void check(MIPS_CPU *pcpu, const char *fmt, const char *expected)
+{
+	size_t len = strlen(expected);
+	int err;
+
+	mips_copyout(pcpu, FMT, (void*)fmt, strlen(fmt) + 1);
+	pcpu->r.ur[4] = FMT;
+	pcpu->r.ur[5] = ARGS;
+	if((err = mips_spim_service(pcpu, 25)) != 0) {
+		fprintf(stderr, "FAIL: '%s': error %d\n", fmt, err);
+		exit(1);
+	}
+	if((pcpu->r.ur[2] != len) || (pcpu->host->outlen != len)
+	   || memcmp(pcpu->host->outbuf, expected, len)) {
+		fprintf(stderr, "FAIL: '%s': got %u bytes '%.*s'\n", fmt,
+				pcpu->r.ur[2], (int)pcpu->host->outlen, pcpu->host->outbuf);
+		exit(1);
+	}
+	pcpu->host->outlen = 0;
+}
@@ -52,6 +52,12 @@ extern "C" {
 /** Magic code in syscall instruction signifying SPIM syscall. */
 #define MIPS_SPIM_SYSCALL	0x9107C
 
+/** Log2 of the page size used for tracking of modified memory. */
+#define MIPS_PAGESHIFT		12
+
+/** Number of entries in the instruction cache; must be a power of 2. */
+#define MIPS_ICACHE_SIZE	4096
+
 /**
  * Type of the function which peeks a word at the given address within the MIPS
  * address space (i.e. the address is an offset from pcpu->base).  The caller
@@ -79,6 +85,43 @@ typedef void (*mips_poke_uw_f)(MIPS_CPU*, mips_uword, mips_uword);
  */
 void mips_identity_poke_uw(MIPS_CPU *pcpu, mips_uword addr, mips_uword val);
 
+/**
+ * Type of the function which reads n consecutive words starting at the given
+ * address into a host buffer, applying the same transformation as the peek
+ * function.  It is used for bulk transfers, where a transformation can be
+ * applied to many words at once.  Same precautions apply as for the peek
+ * function; in addition, the whole range must be within MIPS memory.
+ */
+typedef void (*mips_peek_block_f)(MIPS_CPU*, mips_uword, mips_uword*, mips_uword);
+
+/** Default block peek function which performs no transformations. */
+void mips_identity_peek_block(MIPS_CPU *pcpu, mips_uword addr,
+							  mips_uword *dst, mips_uword n);
+
+/**
+ * Type of the function which writes n consecutive words from a host buffer
+ * starting at the given address; the counterpart of mips_peek_block_f.
+ */
+typedef void (*mips_poke_block_f)(MIPS_CPU*, mips_uword, const mips_uword*,
+								  mips_uword);
+
+/** Default block poke function which performs no transformations. */
+void mips_identity_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+							  const mips_uword *src, mips_uword n);
+
+/**
+ * Instruction cache entry.  The cache is direct-mapped by word address and
+ * holds instructions after the memory transformation and decoding.  An entry
+ * is valid only while the untransformed word in memory equals raw, so that
+ * modified code is transformed again.
+ */
+struct mips_icache_entry {
+	mips_uword		addr;				/**!< Address of the instruction; 0 if empty. */
+	mips_uword		raw;				/**!< Word in memory. */
+	mips_uword		insn;				/**!< Transformed instruction. */
+	int				opcode;				/**!< Result of mips_decode. */
+};
+
 /** MIPS CPU state. */
 struct mips_cpu {
 	union {
@@ -99,7 +142,13 @@ struct mips_cpu {
 	jmp_buf			exn;				/**!< Exception handler. */
 	mips_peek_uw_f	peek_uw;			/**!< How to read words from memory. */
 	mips_poke_uw_f	poke_uw;			/**!< How to write words to memory. */
+	mips_peek_block_f peek_block;		/**!< Bulk variant of peek_uw. */
+	mips_poke_block_f poke_block;		/**!< Bulk variant of poke_uw. */
+	void			*xform;				/**!< Opaque context of the above, or NULL. */
+	struct mips_icache_entry *icache;	/**!< MIPS_ICACHE_SIZE entries, or NULL. */
 	int				fds[MIPS_MAXFDS];	/**!< File descriptor map. */
+	mips_uword		*dirty;				/**!< Bitmap of modified pages, or NULL. */
+	struct mips_hostdata *host;			/**!< Host environment's private data. */
 };
 
 /** Execution exception code. */
@@ -125,6 +174,7 @@ void mips_init(void);
  * - initialize the file descriptor mapping table: identity mapping for fds
  *   0, 1 and 2; the rest is set to invalid (-1).
  * - set memory access functions to identity mapping
+ * - initialize host environment's private data (mips_init_hostdata)
  *
  * @param base  Start of memory area allocated for MIPS memory.
  * @param memsz Size of MIPS memory.
@@ -253,7 +303,9 @@ int mips_resume(MIPS_CPU *pcpu);
  * Memory access to the simulated CPU with range and alignment checks.  Peek
  * functions come in signed/unsigned variants for bytes, halfwords and words,
  * while poke functions come only in unsigned variant.  These functions are
- * implemented in terms of peek_uw and poke_uw.
+ * implemented in terms of peek_uw and poke_uw.  If pcpu->dirty is not NULL,
+ * poke functions also set the bit of the modified page (addr >>
+ * MIPS_PAGESHIFT) in that bitmap.
  *
  * @param pcpu CPU state.
  * @param addr Address to read/write.
@@ -278,19 +330,28 @@ void mips_poke_uw(MIPS_CPU *pcpu, mips_uword addr, mips_uword val);
 /**
  * Copy (potentially unaligned) data from host to the simulator (out), or from
  * simulator to the host (in).  In the case of failure, the state of the MIPS
- * simulator has not been altered.
+ * simulator has not been altered.  Whole aligned words are transferred with
+ * peek_block and poke_block (directly from or to the host buffer if it is
+ * word-aligned), the rest with byte peeks and pokes.
  *
  * @param pcpu CPU state.
  * @param dst  Destination address in MIPS (out) or host (in).
  * @param src  Source address in host (out) or MIPS (in).
  * @param n    Number of bytes to copy.
  * @return 0 on success, -1 on failure (i.e. the transfer would access memory
- * outside of MIPS segment).
+ * outside of MIPS segment or below MIPS_LOWBASE).
  */
 int mips_copyout(MIPS_CPU *pcpu, mips_uword dst, void *src, mips_uword n);
 int mips_copyin(MIPS_CPU *pcpu, void *dst, mips_uword src, mips_uword n);
 /*@}*/
 
+/**
+ * Record modification of len bytes at addr in pcpu->dirty, if tracking is
+ * enabled.  Must be called by code that writes MIPS memory directly through
+ * pcpu->base instead of using poke functions or mips_copyout.
+ */
+void mips_mark_dirty(MIPS_CPU *pcpu, mips_uword addr, mips_uword len);
+
 #ifdef	__cplusplus
 }
 #endif
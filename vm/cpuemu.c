@@ -49,11 +49,17 @@ static void do_alu3(int, int, MIPS_CPU*);
 static void do_divmult(int, int, MIPS_CPU*);
 
 static inline void validate_address(MIPS_CPU*, mips_uword, int);
+static inline mips_uword fetch(MIPS_CPU*, mips_uword, int*);
+static inline void mark_dirty(MIPS_CPU*, mips_uword);
+static inline void mark_dirty_range(MIPS_CPU*, mips_uword, mips_uword);
 static inline mips_sword add_ovf(MIPS_CPU*, mips_sword, mips_sword);
 static inline mips_sword sub_ovf(MIPS_CPU*, mips_sword, mips_sword);
 static inline void multu(mips_uword, mips_uword, mips_uword*, mips_uword*);
 static inline void mult(mips_sword, mips_sword, mips_uword*, mips_uword*);
 
+/** Number of words transferred at once by mips_copyout and mips_copyin. */
+#define COPY_CHUNK 256
+
 #define PC (pcpu->pc)
 #define DELAY_SLOT (pcpu->delay_slot)
 #define MEMSZ (pcpu->memsz)
@@ -86,8 +92,6 @@ static inline void mult(mips_sword, mips_sword, mips_uword*, mips_uword*);
 
 #define THROW(pcpu, code) longjmp((pcpu)->exn, code)
 
-void mips_init_hostdata(MIPS_CPU*);
-
 MIPS_CPU *mips_init_cpu(char *base, size_t memsz, size_t stksz)
 {
 	MIPS_CPU *pcpu = (MIPS_CPU*)base;
@@ -113,7 +117,12 @@ MIPS_CPU *mips_init_cpu(char *base, size_t memsz, size_t stksz)
 
 	pcpu->peek_uw = mips_identity_peek_uw;
 	pcpu->poke_uw = mips_identity_poke_uw;
+	pcpu->peek_block = mips_identity_peek_block;
+	pcpu->poke_block = mips_identity_poke_block;
+	pcpu->xform = NULL;
+	pcpu->icache = NULL;
 
+	mips_init_hostdata(pcpu);
 	return pcpu;
 }
 
@@ -129,15 +138,8 @@ enum mips_exception mips_execute(MIPS_CPU *pcpu)
 	mips_uword insn;
 	
 	if((err = setjmp(pcpu->exn)) == 0) {
-		if(DELAY_SLOT) {
-			insn   = uMEMW(DELAY_SLOT);
-			fdelay = 1;		/* mark that delay slot is being executed */
-		} else {
-			insn   = uMEMW(PC);
-			fdelay = 0;		/* delay slot is NOT being executed */
-		}
-
-		opcode = mips_decode(insn);
+		fdelay = DELAY_SLOT != 0;	/* delay slot is being executed */
+		insn   = fetch(pcpu, fdelay ? DELAY_SLOT : PC, &opcode);
 
 		if((opcode == MIPS_I_SPECIAL) || (opcode == MIPS_I_REGIMM))
 			THROW(pcpu, MIPS_E_ABORT);
@@ -172,9 +174,8 @@ enum mips_exception mips_execute(MIPS_CPU *pcpu)
 int mips_break_code(MIPS_CPU *pcpu, int *opcode)
 {
 	if(setjmp(pcpu->exn) == 0) {
-		mips_insn insn = uMEMW(PC);
+		mips_insn insn = fetch(pcpu, PC, opcode);
 
-		*opcode = mips_decode(insn);
 		switch(*opcode) {
 		case MIPS_I_BREAK:
 			return (insn >> 16) & 0x3FF;
@@ -188,9 +189,9 @@ int mips_break_code(MIPS_CPU *pcpu, int *opcode)
 int mips_resume(MIPS_CPU *pcpu)
 {
 	if(setjmp(pcpu->exn) == 0) {
-		mips_insn insn = uMEMW(PC);
-		int opcode = mips_decode(insn);
+		int opcode;
 
+		fetch(pcpu, PC, &opcode);
 		if((opcode == MIPS_I_BREAK) || (opcode == MIPS_I_SYSCALL)) {
 			PC += 4;
 			return 0;
@@ -492,6 +493,26 @@ void mips_identity_poke_uw(MIPS_CPU *pcpu, mips_uword addr, mips_uword w)
 	*(mips_uword*)(pcpu->base + addr) = w;
 }
 
+/** Identity function to peek a block of words. */
+void mips_identity_peek_block(MIPS_CPU *pcpu, mips_uword addr,
+							  mips_uword *dst, mips_uword n)
+{
+	const mips_uword *src = (const mips_uword*)(pcpu->base + addr);
+
+	while(n--)
+		*dst++ = *src++;
+}
+
+/** Identity function to poke a block of words. */
+void mips_identity_poke_block(MIPS_CPU *pcpu, mips_uword addr,
+							  const mips_uword *src, mips_uword n)
+{
+	mips_uword *dst = (mips_uword*)(pcpu->base + addr);
+
+	while(n--)
+		*dst++ = *src++;
+}
+
 /* The peek and poke functions must be implemented exclusively in terms of
  * mips_peek_uw and mips_poke_uw functions.  They do not check for proper
  * alignment for the datatype; this must be done in higher-level routines. */
@@ -546,6 +567,7 @@ void mips_poke_ub(MIPS_CPU *pcpu, mips_uword addr, mips_ubyte v)
 {
 	int s = addr & 3U;
 	validate_address(pcpu, addr, 0);
+	mark_dirty(pcpu, addr);
 	{
 		mips_uword w = pcpu->peek_uw(pcpu, addr-s);
 		mips_uword m = ~(0xFFU << (8*s));
@@ -557,6 +579,7 @@ void mips_poke_uh(MIPS_CPU *pcpu, mips_uword addr, mips_uhalf v)
 {
 	int s = addr & 3U;
 	validate_address(pcpu, addr, 1);
+	mark_dirty(pcpu, addr);
 	{
 		mips_uword w = pcpu->peek_uw(pcpu, addr-s);
 		mips_uword m = ~(0xFFFFU << (8*s));
@@ -567,20 +590,41 @@ void mips_poke_uh(MIPS_CPU *pcpu, mips_uword addr, mips_uhalf v)
 void mips_poke_uw(MIPS_CPU *pcpu, mips_uword addr, mips_uword v)
 {
 	validate_address(pcpu, addr, 3);
+	mark_dirty(pcpu, addr);
 	pcpu->poke_uw(pcpu, addr, v);
 }
 
 int mips_copyout(MIPS_CPU *pcpu, mips_uword dst, void *src, mips_uword n)
 {
+	mips_uword buf[COPY_CHUNK];
 	mips_ubyte *pch = src;
+	mips_uword i, k;
 	
-	if(dst + n >= pcpu->memsz)
+	if((dst + n >= pcpu->memsz) || (n && (dst < MIPS_LOWBASE)))
 		return -1;
-	
-	/* TODO: this is _very_ inefficient (look up the implementation of byte
-	 * peek/poke).  Should be fixed to do copying in at least words, after
-	 * the unaligned part has been copied. */
-	
+
+	/* Unaligned head and tail are copied byte by byte; whole words in
+	 * between go through poke_block, so that a transformation can process
+	 * them in bulk.  An aligned source is passed directly, otherwise the
+	 * words are staged in chunks through an intermediate buffer. */
+
+	for(; n && (dst & 3); n--)
+		mips_poke_ub(pcpu, dst++, *pch++);
+	if((n >= 4) && !((size_t)pch & 3)) {
+		k = n/4;
+		mark_dirty_range(pcpu, dst, 4*k);
+		pcpu->poke_block(pcpu, dst, (const mips_uword*)pch, k);
+		pch += 4*k;
+		dst += 4*k;
+		n -= 4*k;
+	}
+	for(; n >= 4; n -= 4*k, dst += 4*k) {
+		k = n/4 < COPY_CHUNK ? n/4 : COPY_CHUNK;
+		for(i = 0; i < 4*k; i++)
+			((mips_ubyte*)buf)[i] = *pch++;
+		mark_dirty_range(pcpu, dst, 4*k);
+		pcpu->poke_block(pcpu, dst, buf, k);
+	}
 	while(n--)
 		mips_poke_ub(pcpu, dst++, *pch++);
 	return 0;
@@ -588,20 +632,39 @@ int mips_copyout(MIPS_CPU *pcpu, mips_uword dst, void *src, mips_uword n)
 
 int mips_copyin(MIPS_CPU *pcpu, void *dst, mips_uword src, mips_uword n)
 {
+	mips_uword buf[COPY_CHUNK];
 	mips_ubyte *pch = dst;
+	mips_uword i, k;
 
-	/* TODO: this is _very_ inefficient (look up the implementation of byte
-	 * peek/poke).  Should be fixed to do copying in at least words, after
-	 * the unaligned part has been copied. */
-	
-	if(src + n >= pcpu->memsz)
+	if((src + n >= pcpu->memsz) || (n && (src < MIPS_LOWBASE)))
 		return -1;
 	
+	for(; n && (src & 3); n--)
+		*pch++ = mips_peek_ub(pcpu, src++);
+	if((n >= 4) && !((size_t)pch & 3)) {
+		k = n/4;
+		pcpu->peek_block(pcpu, src, (mips_uword*)pch, k);
+		pch += 4*k;
+		src += 4*k;
+		n -= 4*k;
+	}
+	for(; n >= 4; n -= 4*k, src += 4*k) {
+		k = n/4 < COPY_CHUNK ? n/4 : COPY_CHUNK;
+		pcpu->peek_block(pcpu, src, buf, k);
+		for(i = 0; i < 4*k; i++)
+			*pch++ = ((mips_ubyte*)buf)[i];
+	}
 	while(n--)
 		*pch++ = mips_peek_ub(pcpu, src++);
 	return 0;
 }
 
+void mips_mark_dirty(MIPS_CPU *pcpu, mips_uword addr, mips_uword len)
+{
+	if(len)
+		mark_dirty_range(pcpu, addr, len);
+}
+
 /**
  * Check that addr is within the MIPS memory range and is aligned at align,
  * which must be 1 less than the required alignment (e.g. align == 3 if
@@ -615,6 +678,57 @@ static inline void validate_address(MIPS_CPU *pcpu,
 		THROW(pcpu, MIPS_E_ADDRESS);
 }
 
+/**
+ * Fetch the instruction at addr and store its decoded opcode.  With the
+ * instruction cache, the word is transformed and decoded only if the cached
+ * entry is for another address or the word in memory has changed.
+ */
+static inline mips_uword fetch(MIPS_CPU *pcpu, mips_uword addr, int *opcode)
+{
+	struct mips_icache_entry *e;
+	mips_uword insn;
+
+	if(!pcpu->icache) {
+		insn = uMEMW(addr);
+		*opcode = mips_decode(insn);
+		return insn;
+	}
+
+	validate_address(pcpu, addr, 3);
+	e = &pcpu->icache[(addr >> 2) & (MIPS_ICACHE_SIZE-1)];
+	insn = *(mips_uword*)(pcpu->base + addr);
+	if((e->addr != addr) || (e->raw != insn)) {
+		e->raw = insn;
+		e->insn = pcpu->peek_uw(pcpu, addr);
+		e->opcode = mips_decode(e->insn);
+		e->addr = addr;
+	}
+	*opcode = e->opcode;
+	return e->insn;
+}
+
+/** Record modification of the page containing addr, if tracking is enabled. */
+static inline void mark_dirty(MIPS_CPU *pcpu, mips_uword addr)
+{
+	if(pcpu->dirty) {
+		mips_uword page = addr >> MIPS_PAGESHIFT;
+		pcpu->dirty[page >> 5] |= 1U << (page & 31);
+	}
+}
+
+/** Record modification of all pages overlapping [addr, addr+len); len > 0. */
+static inline void mark_dirty_range(MIPS_CPU *pcpu, mips_uword addr,
+		mips_uword len)
+{
+	if(pcpu->dirty) {
+		mips_uword page = addr >> MIPS_PAGESHIFT;
+		mips_uword last = (addr + len - 1) >> MIPS_PAGESHIFT;
+
+		for(; page <= last; page++)
+			pcpu->dirty[page >> 5] |= 1U << (page & 31);
+	}
+}
+
 /** Perform signed addition, but throw exception in case of overflow. */
 static inline mips_sword add_ovf(MIPS_CPU *pcpu,
 		mips_sword x, mips_sword y)
@@ -50,3 +50,9 @@ static int do_forward(MIPS_CPU *pcpu)
 	return 0;
 }
 
+
+void mips_init_hostdata(MIPS_CPU *pcpu)
+{
+	pcpu->dirty = 0;
+	pcpu->host = 0;
+}
@@ -66,6 +66,9 @@ int mips_spim_syscall(MIPS_CPU *pcpu);
 /** Debug routine: print out CPU state to stdout. */
 void mips_dump_cpu(MIPS_CPU *pcpu);
 
+/** Initialize host data for a CPU; no host data is needed by CSPIM. */
+void mips_init_hostdata(MIPS_CPU *pcpu);
+
 #ifdef	__cplusplus
 }
 #endif
@@ -247,10 +247,11 @@ static int load_segments(struct mips_cpu *pcpu)
  */
 static int load_segment(struct mips_cpu *pcpu, const Elf32_Phdr *ph)
 {
+	static const mips_uword zeros[256];
 	const char *elf = pcpu->elf;
 	size_t elfsz = pcpu->elfsz;
 	size_t memsz = pcpu->memsz - pcpu->stksz;
-	unsigned i;
+	unsigned i, n;
 	
 	if(ph->p_offset + ph->p_filesz > elfsz)
 		return -1;
@@ -265,14 +266,17 @@ static int load_segment(struct mips_cpu *pcpu, const Elf32_Phdr *ph)
 	  Because of the above checks, the pokes below shall not throw.  The
 	  segment data is copied verbatim (identity_poke).  However, the zeros
 	  are written through vectored poke in order to have correct data in
-	  case memory transformation (e.g. encryption) is applied.
+	  case memory transformation (e.g. encryption) is applied; copyout does
+	  it in blocks.
 	*/
 
 	for(i = 0; i < ph->p_filesz; i += 4)
 		mips_identity_poke_uw(pcpu, ph->p_vaddr+i,
 							  *(mips_uword*)(elf + ph->p_offset+i));
-	for(; i < ph->p_memsz; i += 4)
-		mips_poke_uw(pcpu, ph->p_vaddr+i, 0);
+	for(; i < ph->p_memsz; i += n) {
+		n = ph->p_memsz - i < sizeof(zeros) ? ph->p_memsz - i : sizeof(zeros);
+		mips_copyout(pcpu, ph->p_vaddr+i, (void*)zeros, n);
+	}
 
 	return 0;
 }
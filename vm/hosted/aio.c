@@ -0,0 +1,228 @@
+/* 
+ * File:    aio.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Asynchronous system calls through io_uring; hosted implementation.  See
+ * aio.h for the overview.
+ *
+ * Operations are queued in the submission ring and submitted in batches by
+ * mips_aio_reap.  The user data of an operation is its CPU.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "aio.h"
+
+struct mips_aio {
+	int			fd;					/* ring */
+	unsigned	entries;			/* of the submission ring */
+	unsigned	*sq_head, *sq_tail, *sq_mask, *sq_array;
+	unsigned	*cq_head, *cq_tail, *cq_mask;
+	struct io_uring_sqe *sqes;
+	struct io_uring_cqe *cqes;
+	void		*sq_ring, *cq_ring;
+	size_t		sq_ringsz, cq_ringsz;
+	unsigned	queued;				/* not yet submitted */
+	unsigned	inflight;			/* submitted and not reaped */
+};
+
+static int enter(struct mips_aio*, unsigned);
+
+struct mips_aio *mips_aio_create(unsigned entries)
+{
+	struct io_uring_params p;
+	struct mips_aio *aio;
+	char *sq, *cq;
+
+	if(!(aio = calloc(1, sizeof(*aio))))
+		return NULL;
+	memset(&p, 0, sizeof(p));
+	if((aio->fd = syscall(__NR_io_uring_setup, entries ? entries : 1, &p)) < 0) {
+		free(aio);
+		return NULL;
+	}
+
+	aio->entries = p.sq_entries;
+	aio->sq_ringsz = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	aio->cq_ringsz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if(p.features & IORING_FEAT_SINGLE_MMAP) {
+		if(aio->cq_ringsz > aio->sq_ringsz)
+			aio->sq_ringsz = aio->cq_ringsz;
+		aio->cq_ringsz = aio->sq_ringsz;
+	}
+	aio->sq_ring = mmap(NULL, aio->sq_ringsz, PROT_READ | PROT_WRITE,
+						MAP_SHARED | MAP_POPULATE, aio->fd, IORING_OFF_SQ_RING);
+	if(aio->sq_ring == MAP_FAILED)
+		goto fail;
+	if(p.features & IORING_FEAT_SINGLE_MMAP)
+		aio->cq_ring = aio->sq_ring;
+	else
+		aio->cq_ring = mmap(NULL, aio->cq_ringsz, PROT_READ | PROT_WRITE,
+							MAP_SHARED | MAP_POPULATE, aio->fd,
+							IORING_OFF_CQ_RING);
+	if(aio->cq_ring == MAP_FAILED)
+		goto fail;
+	aio->sqes = mmap(NULL, p.sq_entries * sizeof(struct io_uring_sqe),
+					 PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+					 aio->fd, IORING_OFF_SQES);
+	if(aio->sqes == MAP_FAILED)
+		goto fail;
+
+	sq = aio->sq_ring;
+	aio->sq_head = (unsigned*)(sq + p.sq_off.head);
+	aio->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+	aio->sq_mask = (unsigned*)(sq + p.sq_off.ring_mask);
+	aio->sq_array = (unsigned*)(sq + p.sq_off.array);
+	cq = aio->cq_ring;
+	aio->cq_head = (unsigned*)(cq + p.cq_off.head);
+	aio->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+	aio->cq_mask = (unsigned*)(cq + p.cq_off.ring_mask);
+	aio->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+	return aio;
+
+fail:
+	if(aio->cq_ring && (aio->cq_ring != MAP_FAILED)
+	   && (aio->cq_ring != aio->sq_ring))
+		munmap(aio->cq_ring, aio->cq_ringsz);
+	if(aio->sq_ring != MAP_FAILED)
+		munmap(aio->sq_ring, aio->sq_ringsz);
+	close(aio->fd);
+	free(aio);
+	return NULL;
+}
+
+void mips_aio_destroy(struct mips_aio *aio)
+{
+	if(!aio)
+		return;
+	munmap(aio->sqes, aio->entries * sizeof(struct io_uring_sqe));
+	if(aio->cq_ring != aio->sq_ring)
+		munmap(aio->cq_ring, aio->cq_ringsz);
+	munmap(aio->sq_ring, aio->sq_ringsz);
+	close(aio->fd);
+	free(aio);
+}
+
+int mips_aio_submit(struct mips_aio *aio, MIPS_CPU *pcpu, enum mips_aio_op op,
+					int fd, void *buf, unsigned len, int flags, int mode)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail = *aio->sq_tail, i;
+
+	if((tail - __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE) == aio->entries)
+	   && (enter(aio, 0) < 0))
+		return -1;
+	if(tail - __atomic_load_n(aio->sq_head, __ATOMIC_ACQUIRE) == aio->entries) {
+		errno = EBUSY;
+		return -1;
+	}
+
+	i = tail & *aio->sq_mask;
+	sqe = &aio->sqes[i];
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->fd = fd;
+	sqe->addr = (uintptr_t)buf;
+	sqe->user_data = (uintptr_t)pcpu;
+	switch(op) {
+	case MIPS_AIO_OPEN:
+		sqe->opcode = IORING_OP_OPENAT;
+		sqe->fd = AT_FDCWD;
+		sqe->open_flags = flags;
+		sqe->len = mode;
+		break;
+	case MIPS_AIO_READ:
+	case MIPS_AIO_WRITE:
+		sqe->opcode = op == MIPS_AIO_READ ? IORING_OP_READ : IORING_OP_WRITE;
+		sqe->len = len;
+		sqe->off = (__u64)-1;			/* current file offset */
+		break;
+	}
+	aio->sq_array[i] = i;
+	__atomic_store_n(aio->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	++aio->queued;
+	return 0;
+}
+
+int mips_aio_reap(struct mips_aio *aio, int wait, MIPS_CPU **ppcpu)
+{
+	struct io_uring_cqe *cqe;
+	MIPS_CPU *pcpu;
+	unsigned head;
+	int res;
+
+	while(1) {
+		if(aio->queued && (enter(aio, 0) < 0))
+			return -1;
+		head = *aio->cq_head;
+		if(head == __atomic_load_n(aio->cq_tail, __ATOMIC_ACQUIRE)) {
+			if(!wait || !aio->inflight)
+				return 0;
+			if(enter(aio, 1) < 0)
+				return -1;
+			continue;
+		}
+
+		cqe = &aio->cqes[head & *aio->cq_mask];
+		pcpu = (MIPS_CPU*)(uintptr_t)cqe->user_data;
+		res = cqe->res;
+		__atomic_store_n(aio->cq_head, head + 1, __ATOMIC_RELEASE);
+		--aio->inflight;
+		if(mips_spim_syscall_complete(pcpu, aio, res) == 0) {
+			*ppcpu = pcpu;
+			return 1;
+		}
+	}
+}
+
+unsigned mips_aio_pending(const struct mips_aio *aio)
+{
+	return aio->queued + aio->inflight;
+}
+
+/**
+ * Submit the queued operations and wait for at least min_complete
+ * completions.  An interrupted wait is not an error.
+ */
+static int enter(struct mips_aio *aio, unsigned min_complete)
+{
+	int n;
+
+	n = syscall(__NR_io_uring_enter, aio->fd, aio->queued, min_complete,
+				min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+	if(n < 0)
+		return errno == EINTR ? 0 : -1;
+	aio->queued -= n;
+	aio->inflight += n;
+	return 0;
+}
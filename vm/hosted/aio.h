@@ -0,0 +1,96 @@
+/* 
+ * File:    aio.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Asynchronous system calls through io_uring; hosted implementation (Linux
+ * only).
+ *
+ * A ring serves the CPUs executed by one host thread.  When a CPU stops at
+ * a SPIM open, read or write, mips_spim_syscall_async submits the operation
+ * to the ring and parks the CPU, and the thread is free to execute other
+ * CPUs.  mips_aio_reap returns a CPU whose operation has completed, with the
+ * result already stored in $v0; the CPU is then resumed with mips_resume
+ * like after mips_spim_syscall.  Each CPU has at most one operation in
+ * flight.  The ring is driven with raw system calls, so liburing is not
+ * needed.
+ */
+
+#ifndef MIPS_AIO_H_
+#define	MIPS_AIO_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Operations that can be submitted. */
+enum mips_aio_op {
+	MIPS_AIO_OPEN,						/**!< buf is the path; uses flags, mode. */
+	MIPS_AIO_READ,						/**!< At the current file offset. */
+	MIPS_AIO_WRITE						/**!< At the current file offset. */
+};
+
+struct mips_aio;
+
+/**
+ * Create a ring.
+ *
+ * @param entries Maximum number of operations in flight, i.e. the number of
+ *                CPUs that will use the ring.
+ * @return The ring, or NULL on failure (errno is set).
+ */
+struct mips_aio *mips_aio_create(unsigned entries);
+
+/** Destroy a ring; operations still in flight are abandoned. */
+void mips_aio_destroy(struct mips_aio *aio);
+
+/**
+ * Queue an operation on behalf of a CPU; it is submitted to the kernel by
+ * the next mips_aio_reap.  Used by mips_spim_syscall_async.  The buffer must
+ * stay valid until the operation completes.
+ *
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_aio_submit(struct mips_aio *aio, MIPS_CPU *pcpu, enum mips_aio_op op,
+					int fd, void *buf, unsigned len, int flags, int mode);
+
+/**
+ * Submit the queued operations and take completions until the syscall of a
+ * CPU is finished by mips_spim_syscall_complete.
+ *
+ * @param wait  If nonzero and operations are in flight, wait for one.
+ * @param ppcpu Set to the CPU which may be resumed.
+ * @return 1 if a CPU has been returned, 0 if none, -1 on failure (errno is
+ * set).
+ */
+int mips_aio_reap(struct mips_aio *aio, int wait, MIPS_CPU **ppcpu);
+
+/** Return the number of operations queued or in flight. */
+unsigned mips_aio_pending(const struct mips_aio *aio);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_AIO_H_ */
@@ -0,0 +1,668 @@
+/* 
+ * File:    compress.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Compression of idle CPUs' memory; hosted implementation.  See compress.h
+ * for the overview.
+ *
+ * Each compression round packs the compressed pages into one segment.  Pages
+ * refer to their segment, which counts the pages still compressed in it and
+ * is freed (outside of the signal handler) once that drops to 0.  The
+ * SIGSEGV handler finds the CPU in a fixed-size registry and claims the page
+ * with an atomic state transition, so it takes no locks and allocates no
+ * memory.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "memory.h"
+#include "syscalls.h"
+#include "compress.h"
+
+#define MAXCPUS 1024
+
+/* Page states. */
+#define ZP_RESIDENT		0
+#define ZP_COMPRESSED	1
+#define ZP_LOADING		2
+
+struct zseg {
+	struct zseg		*next;
+	size_t			live;			/* pages still compressed here */
+	unsigned char	data[];
+};
+
+struct zpage {
+	struct zseg		*seg;
+	uint32_t		off;			/* offset in seg->data */
+	uint16_t		len;			/* compressed length; 0 for zero page */
+	unsigned char	state;			/* ZP_* */
+};
+
+struct mips_zcpu {
+	MIPS_CPU		*pcpu;
+	char			*base;
+	size_t			npages;			/* whole host pages in memory */
+	struct zpage	*pages;
+	struct zseg		*segs;
+	size_t			ncompressed;	/* pages compressed in last rounds */
+	pthread_mutex_t	lock;			/* held while compressing */
+	int				idle;
+	int				done;			/* compressed during this idle period */
+	unsigned long long idle_since;
+};
+
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+static struct mips_zcpu *Gzcpus[MAXCPUS];
+static struct sigaction Gold_action;
+static int Ghandler;
+static size_t Gpagesz;
+static struct mips_compress_stats Gstats;
+
+static pthread_t Gthread;
+static pthread_cond_t Gstop_cond = PTHREAD_COND_INITIALIZER;
+static int Grunning, Gstop;
+static unsigned Gidle_ms, Gperiod_ms;
+
+static int compress_locked(struct mips_zcpu*);
+static void free_segments(struct mips_zcpu*);
+static int page_in(struct mips_zcpu*, size_t);
+static void segv_handler(int, siginfo_t*, void*);
+static void *policy_thread(void*);
+static unsigned long long now_ns(void);
+static size_t lz_compress(const unsigned char*, size_t, unsigned char*, size_t);
+static void lz_decompress(const unsigned char*, size_t, unsigned char*, size_t);
+
+int mips_compress_register(MIPS_CPU *pcpu)
+{
+	struct mips_zcpu *z;
+	struct sigaction sa;
+	int i;
+
+	if(!Gpagesz)
+		Gpagesz = sysconf(_SC_PAGESIZE);
+	if(!pcpu->host || pcpu->host->zcpu || ((uintptr_t)pcpu->base % Gpagesz)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(!(z = calloc(1, sizeof(*z)))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	z->pcpu = pcpu;
+	z->base = pcpu->base;
+	z->npages = pcpu->memsz / Gpagesz;
+	if(!(z->pages = calloc(z->npages, sizeof(*z->pages)))) {
+		free(z);
+		errno = ENOMEM;
+		return -1;
+	}
+	pthread_mutex_init(&z->lock, NULL);
+
+	pthread_mutex_lock(&Glock);
+	if(!Ghandler) {
+		memset(&sa, 0, sizeof(sa));
+		sa.sa_sigaction = segv_handler;
+		sa.sa_flags = SA_SIGINFO;
+		sigemptyset(&sa.sa_mask);
+		if(sigaction(SIGSEGV, &sa, &Gold_action) < 0)
+			goto fail;
+		Ghandler = 1;
+	}
+	for(i = 0; (i < MAXCPUS) && Gzcpus[i]; i++)
+		;
+	if(i == MAXCPUS) {
+		errno = ENOSPC;
+		goto fail;
+	}
+	__atomic_store_n(&Gzcpus[i], z, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&Glock);
+	pcpu->host->zcpu = z;
+	return 0;
+
+fail:
+	i = errno;
+	pthread_mutex_unlock(&Glock);
+	pthread_mutex_destroy(&z->lock);
+	free(z->pages);
+	free(z);
+	errno = i;
+	return -1;
+}
+
+void mips_compress_unregister(MIPS_CPU *pcpu, int discard)
+{
+	struct mips_zcpu *z;
+	size_t i;
+
+	if(!pcpu->host || !(z = pcpu->host->zcpu))
+		return;
+
+	/* Once the CPU is out of the registry, the background thread will not
+	 * pick it again; a compression in progress is waited for. */
+
+	pthread_mutex_lock(&Glock);
+	for(i = 0; i < MAXCPUS; i++)
+		if(Gzcpus[i] == z)
+			__atomic_store_n(&Gzcpus[i], NULL, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&Glock);
+	pthread_mutex_lock(&z->lock);
+	pthread_mutex_unlock(&z->lock);
+
+	for(i = 1; i < z->npages; i++) {
+		if(z->pages[i].state != ZP_COMPRESSED)
+			continue;
+		if(discard)
+			mprotect(z->base + i * Gpagesz, Gpagesz, PROT_READ | PROT_WRITE);
+		else
+			page_in(z, i);
+	}
+	z->ncompressed = 0;
+	free_segments(z);
+	pthread_mutex_destroy(&z->lock);
+	free(z->pages);
+	free(z);
+	pcpu->host->zcpu = NULL;
+}
+
+int mips_compress_cpu(MIPS_CPU *pcpu)
+{
+	struct mips_zcpu *z;
+	int ret;
+
+	if(!pcpu->host || !(z = pcpu->host->zcpu)) {
+		errno = EINVAL;
+		return -1;
+	}
+	pthread_mutex_lock(&z->lock);
+	ret = compress_locked(z);
+	pthread_mutex_unlock(&z->lock);
+	return ret;
+}
+
+void mips_compress_expand(MIPS_CPU *pcpu)
+{
+	struct mips_zcpu *z;
+	size_t i;
+
+	if(!pcpu->host || !(z = pcpu->host->zcpu) || !z->ncompressed)
+		return;
+	for(i = 1; i < z->npages; i++)
+		if(z->pages[i].state == ZP_COMPRESSED)
+			page_in(z, i);
+	z->ncompressed = 0;
+	free_segments(z);
+}
+
+int mips_compress_start(unsigned idle_ms, unsigned period_ms)
+{
+	int err;
+
+	pthread_mutex_lock(&Glock);
+	if(Grunning) {
+		pthread_mutex_unlock(&Glock);
+		errno = EBUSY;
+		return -1;
+	}
+	Gidle_ms = idle_ms;
+	Gperiod_ms = period_ms ? period_ms : 1;
+	Gstop = 0;
+	if((err = pthread_create(&Gthread, NULL, policy_thread, NULL)) != 0) {
+		pthread_mutex_unlock(&Glock);
+		errno = err;
+		return -1;
+	}
+	Grunning = 1;
+	pthread_mutex_unlock(&Glock);
+	return 0;
+}
+
+void mips_compress_stop(void)
+{
+	pthread_mutex_lock(&Glock);
+	if(!Grunning) {
+		pthread_mutex_unlock(&Glock);
+		return;
+	}
+	Gstop = 1;
+	pthread_cond_signal(&Gstop_cond);
+	pthread_mutex_unlock(&Glock);
+	pthread_join(Gthread, NULL);
+	Grunning = 0;
+}
+
+void mips_idle_enter(MIPS_CPU *pcpu)
+{
+	struct mips_zcpu *z;
+
+	if(!pcpu->host || !(z = pcpu->host->zcpu))
+		return;
+	pthread_mutex_lock(&z->lock);
+	z->idle = 1;
+	z->done = 0;
+	z->idle_since = now_ns();
+	pthread_mutex_unlock(&z->lock);
+}
+
+void mips_idle_leave(MIPS_CPU *pcpu)
+{
+	struct mips_zcpu *z;
+
+	if(!pcpu->host || !(z = pcpu->host->zcpu))
+		return;
+	pthread_mutex_lock(&z->lock);
+	z->idle = 0;
+	pthread_mutex_unlock(&z->lock);
+}
+
+void mips_compress_get_stats(struct mips_compress_stats *stats)
+{
+	pthread_mutex_lock(&Glock);
+	*stats = Gstats;
+	stats->paged_in = __atomic_load_n(&Gstats.paged_in, __ATOMIC_RELAXED);
+	stats->pagein_ns = __atomic_load_n(&Gstats.pagein_ns, __ATOMIC_RELAXED);
+	stats->pagein_max_ns = __atomic_load_n(&Gstats.pagein_max_ns,
+										   __ATOMIC_RELAXED);
+	pthread_mutex_unlock(&Glock);
+}
+
+/**
+ * Compress all private, resident pages except page 0 into a new segment,
+ * release them and make them inaccessible.  Called with z->lock held.
+ */
+static int compress_locked(struct mips_zcpu *z)
+{
+	unsigned char *state, *tmp;
+	struct zseg *seg;
+	size_t i, j, used = 0, n = 0, nzero = 0, nskip = 0, raw = 0;
+	uint32_t *offs;
+	uint16_t *lens;
+	int err;
+
+	free_segments(z);
+	state = malloc(z->npages);
+	tmp = malloc(z->npages * Gpagesz);
+	offs = malloc(z->npages * sizeof(*offs));
+	lens = malloc(z->npages * sizeof(*lens));
+	if(!state || !tmp || !offs || !lens) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	if(mips_page_state(z->base, z->npages, state) < 0)
+		goto fail;
+
+	/* Compress into a temporary buffer first; the segment size is known only
+	 * at the end.  Pages compressing to more than 3/4 of their size are not
+	 * worth the page-in cost. */
+
+	for(i = 1; i < z->npages; i++) {
+		const unsigned char *page = (unsigned char*)z->base + i * Gpagesz;
+		size_t len;
+
+		state[i] = (state[i] & MIPS_PAGE_PRIVATE)
+			&& (z->pages[i].state == ZP_RESIDENT);
+		if(!state[i])
+			continue;
+		if(mips_is_zero((const char*)page, Gpagesz)) {
+			len = 0;
+			++nzero;
+		} else if(!(len = lz_compress(page, Gpagesz, tmp + used,
+									   Gpagesz * 3 / 4))) {
+			state[i] = 0;
+			++nskip;
+			continue;
+		}
+		offs[i] = used;
+		lens[i] = len;
+		used += len;
+		++n;
+	}
+
+	if(!(seg = malloc(sizeof(*seg) + used))) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	memcpy(seg->data, tmp, used);
+	seg->live = n;
+	seg->next = z->segs;
+	z->segs = seg;
+
+	/* Publish page states before protecting the pages so that the handler
+	 * recognizes every fault; runs of pages are handled by a single call. */
+
+	for(i = 1; i < z->npages; i = j) {
+		if(!state[i]) {
+			j = i + 1;
+			continue;
+		}
+		for(j = i; (j < z->npages) && state[j]; j++) {
+			z->pages[j].seg = seg;
+			z->pages[j].off = offs[j];
+			z->pages[j].len = lens[j];
+			__atomic_store_n(&z->pages[j].state, ZP_COMPRESSED,
+							 __ATOMIC_RELEASE);
+			raw += Gpagesz;
+		}
+		if(mprotect(z->base + i * Gpagesz, (j - i) * Gpagesz, PROT_NONE) < 0)
+			abort();
+		madvise(z->base + i * Gpagesz, (j - i) * Gpagesz, MADV_DONTNEED);
+	}
+	z->ncompressed += n;
+
+	pthread_mutex_lock(&Glock);
+	Gstats.compressed += n;
+	Gstats.zero += nzero;
+	Gstats.skipped += nskip;
+	Gstats.raw_bytes += raw;
+	Gstats.lz_bytes += used;
+	pthread_mutex_unlock(&Glock);
+
+	free(state); free(tmp); free(offs); free(lens);
+	return n;
+
+fail:
+	err = errno;
+	free(state); free(tmp); free(offs); free(lens);
+	errno = err;
+	return -1;
+}
+
+/** Free segments whose pages have all been paged in. */
+static void free_segments(struct mips_zcpu *z)
+{
+	struct zseg **pp = &z->segs, *seg;
+
+	while((seg = *pp)) {
+		if(__atomic_load_n(&seg->live, __ATOMIC_ACQUIRE) && z->ncompressed) {
+			pp = &seg->next;
+			continue;
+		}
+		*pp = seg->next;
+		free(seg);
+	}
+}
+
+/**
+ * Decompress page i if it is compressed; wait if another thread is doing it.
+ * Returns false if the page was resident, i.e., the fault was not caused by
+ * compression.  Async-signal-safe.
+ */
+static int page_in(struct mips_zcpu *z, size_t i)
+{
+	struct zpage *p = &z->pages[i];
+	unsigned char expected = ZP_COMPRESSED;
+	unsigned char *page = (unsigned char*)z->base + i * Gpagesz;
+	unsigned long long t0, dt, max;
+
+	if(!__atomic_compare_exchange_n(&p->state, &expected, ZP_LOADING, 0,
+									__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+		if(expected == ZP_RESIDENT)
+			return 0;
+		while(__atomic_load_n(&p->state, __ATOMIC_ACQUIRE) == ZP_LOADING)
+			;
+		return 1;
+	}
+
+	t0 = now_ns();
+	mprotect(page, Gpagesz, PROT_READ | PROT_WRITE);
+	if(p->len)
+		lz_decompress(p->seg->data + p->off, p->len, page, Gpagesz);
+	else
+		memset(page, 0, Gpagesz);
+	__atomic_sub_fetch(&p->seg->live, 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&p->state, ZP_RESIDENT, __ATOMIC_RELEASE);
+	dt = now_ns() - t0;
+
+	__atomic_add_fetch(&Gstats.paged_in, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&Gstats.pagein_ns, dt, __ATOMIC_RELAXED);
+	max = __atomic_load_n(&Gstats.pagein_max_ns, __ATOMIC_RELAXED);
+	while((dt > max) && !__atomic_compare_exchange_n(&Gstats.pagein_max_ns,
+			&max, dt, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+		;
+	return 1;
+}
+
+/** Page in compressed memory on access; other faults go to the old handler. */
+static void segv_handler(int sig, siginfo_t *si, void *uctx)
+{
+	char *addr = si->si_addr;
+	struct mips_zcpu *z;
+	int i;
+
+	for(i = 0; i < MAXCPUS; i++) {
+		if(!(z = __atomic_load_n(&Gzcpus[i], __ATOMIC_ACQUIRE)))
+			continue;
+		if((addr >= z->base) && (addr < z->base + z->npages * Gpagesz)) {
+			if(page_in(z, (addr - z->base) / Gpagesz))
+				return;
+			break;
+		}
+	}
+
+	if(Gold_action.sa_flags & SA_SIGINFO) {
+		Gold_action.sa_sigaction(sig, si, uctx);
+	} else if((Gold_action.sa_handler == SIG_DFL)
+			  || (Gold_action.sa_handler == SIG_IGN)) {
+		/* Returning re-executes the faulting access with the default action
+		 * in place. */
+		sigaction(SIGSEGV, &Gold_action, NULL);
+	} else {
+		Gold_action.sa_handler(sig);
+	}
+}
+
+/** Background thread: compress CPUs idle for longer than Gidle_ms. */
+static void *policy_thread(void *arg)
+{
+	unsigned long long threshold = (unsigned long long)Gidle_ms * 1000000;
+	struct timespec ts;
+	struct mips_zcpu *z;
+	int i;
+
+	(void)arg;
+	pthread_mutex_lock(&Glock);
+	while(!Gstop) {
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += Gperiod_ms / 1000;
+		ts.tv_nsec += (Gperiod_ms % 1000) * 1000000L;
+		if(ts.tv_nsec >= 1000000000L) {
+			++ts.tv_sec;
+			ts.tv_nsec -= 1000000000L;
+		}
+		pthread_cond_timedwait(&Gstop_cond, &Glock, &ts);
+		if(Gstop)
+			break;
+
+		/* A CPU is picked under Glock and z->lock is taken before Glock is
+		 * dropped for compressing, so mips_compress_unregister, which waits
+		 * for z->lock after removing the CPU, cannot free it meanwhile. */
+
+		for(i = 0; i < MAXCPUS; i++) {
+			if(!(z = Gzcpus[i]))
+				continue;
+			if(pthread_mutex_trylock(&z->lock) != 0)
+				continue;
+			if(z->idle && !z->done && (now_ns() - z->idle_since >= threshold)) {
+				z->done = 1;
+				pthread_mutex_unlock(&Glock);
+				compress_locked(z);
+				pthread_mutex_lock(&Glock);
+			}
+			pthread_mutex_unlock(&z->lock);
+		}
+	}
+	pthread_mutex_unlock(&Glock);
+	return NULL;
+}
+
+static unsigned long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/*
+ * LZ77 codec in the spirit of LZ4.  The stream is a sequence of
+ *   token, [literal length bytes], literals, offset (2 bytes, LE),
+ *   [match length bytes]
+ * where the high nibble of the token is the literal count and the low nibble
+ * the match length minus 4; a nibble of 15 is continued by bytes that are
+ * added to it, 255 meaning another byte follows.  The last sequence has only
+ * literals.  Offsets are limited to 16 bits, which is plenty for a page.
+ */
+
+#define LZ_HASHBITS	12
+#define LZ_MINMATCH	4
+
+static inline uint32_t read32(const unsigned char *p)
+{
+	uint32_t v;
+
+	memcpy(&v, p, 4);
+	return v;
+}
+
+/** Emit a length continuation; returns the new output pointer or NULL. */
+static unsigned char *lz_putlen(unsigned char *op, unsigned char *oend,
+	size_t len)
+{
+	for(; len >= 255; len -= 255) {
+		if(op >= oend)
+			return NULL;
+		*op++ = 255;
+	}
+	if(op >= oend)
+		return NULL;
+	*op++ = len;
+	return op;
+}
+
+/** Emit one sequence; mlen == 0 for the final literal-only sequence. */
+static unsigned char *lz_emit(unsigned char *op, unsigned char *oend,
+	const unsigned char *lit, size_t nlit, size_t off, size_t mlen)
+{
+	unsigned char *token = op++;
+	size_t ml = mlen ? mlen - LZ_MINMATCH : 0;
+
+	if(token >= oend)
+		return NULL;
+	*token = ((nlit < 15 ? nlit : 15) << 4) | (ml < 15 ? ml : 15);
+	if((nlit >= 15) && !(op = lz_putlen(op, oend, nlit - 15)))
+		return NULL;
+	if(op + nlit > oend)
+		return NULL;
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if(!mlen)
+		return op;
+	if(op + 2 > oend)
+		return NULL;
+	*op++ = off & 0xFF;
+	*op++ = off >> 8;
+	if((ml >= 15) && !(op = lz_putlen(op, oend, ml - 15)))
+		return NULL;
+	return op;
+}
+
+/**
+ * Compress n bytes (n < 64k) into at most cap bytes.  Returns the compressed
+ * size, or 0 if it would exceed cap.
+ */
+static size_t lz_compress(const unsigned char *src, size_t n,
+	unsigned char *dst, size_t cap)
+{
+	uint16_t table[1 << LZ_HASHBITS];	/* position+1, 0 = empty */
+	unsigned char *op = dst, *oend = dst + cap;
+	size_t i = 0, anchor = 0;
+
+	memset(table, 0, sizeof(table));
+	while(i + LZ_MINMATCH <= n) {
+		uint32_t seq = read32(src + i);
+		uint32_t h = (seq * 2654435761U) >> (32 - LZ_HASHBITS);
+		size_t ref = table[h], m;
+
+		table[h] = i + 1;
+		if(!ref || (read32(src + ref - 1) != seq)) {
+			++i;
+			continue;
+		}
+		--ref;
+		for(m = LZ_MINMATCH; (i + m < n) && (src[ref + m] == src[i + m]); m++)
+			;
+		if(!(op = lz_emit(op, oend, src + anchor, i - anchor, i - ref, m)))
+			return 0;
+		i += m;
+		anchor = i;
+	}
+	if(!(op = lz_emit(op, oend, src + anchor, n - anchor, 0, 0)))
+		return 0;
+	return op - dst;
+}
+
+/** Decompress a stream produced by lz_compress.  Async-signal-safe. */
+static void lz_decompress(const unsigned char *src, size_t n,
+	unsigned char *dst, size_t cap)
+{
+	const unsigned char *ip = src, *iend = src + n;
+	unsigned char *op = dst, *oend = dst + cap;
+	size_t len, off;
+
+	while(ip < iend) {
+		unsigned token = *ip++;
+
+		len = token >> 4;
+		if(len == 15)
+			do len += *ip; while((*ip++ == 255) && (ip < iend));
+		if((len > (size_t)(iend - ip)) || (len > (size_t)(oend - op)))
+			return;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+		if(ip + 2 > iend)
+			return;
+
+		off = ip[0] | (ip[1] << 8);
+		ip += 2;
+		len = (token & 15);
+		if(len == 15)
+			do len += *ip; while((*ip++ == 255) && (ip < iend));
+		len += LZ_MINMATCH;
+		if((off > (size_t)(op - dst)) || (len > (size_t)(oend - op)))
+			return;
+		for(; len; len--, op++)
+			*op = op[-off];
+	}
+}
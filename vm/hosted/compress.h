@@ -0,0 +1,123 @@
+/* 
+ * File:    compress.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Compression of idle CPUs' memory; hosted implementation (Linux only).
+ *
+ * A CPU registered for compression is considered idle while its program
+ * waits for input in one of the reading SPIM services.  A background thread
+ * compresses the private pages of CPUs that have been idle for longer than a
+ * threshold with a simple LZ77 codec (LZ4-like format, no external
+ * dependency).  A compressed page is released to the OS and made
+ * inaccessible; the first access to it, from any code, raises SIGSEGV whose
+ * handler decompresses the page in place.  Pages that are shared with an
+ * image or file, or that do not compress well, are left alone.  Page 0 with
+ * the control state is never compressed.
+ *
+ * Memory of a CPU must not be written by other threads while the CPU is idle
+ * (which is never done by the emulator itself).  Compressed pages appear as
+ * not resident to mips_page_state; functions relying on it page the memory
+ * in first.
+ */
+
+#ifndef MIPS_COMPRESS_H_
+#define	MIPS_COMPRESS_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Compression statistics. */
+struct mips_compress_stats {
+	size_t				compressed;	/**!< Pages compressed in total. */
+	size_t				zero;		/**!< Of which zero pages (stored empty). */
+	size_t				skipped;	/**!< Pages that did not compress well. */
+	size_t				raw_bytes;	/**!< Size of compressed pages. */
+	size_t				lz_bytes;	/**!< Their size after compression. */
+	size_t				paged_in;	/**!< Pages decompressed on access. */
+	unsigned long long	pagein_ns;	/**!< Total page-in time. */
+	unsigned long long	pagein_max_ns; /**!< Longest page-in. */
+};
+
+/**
+ * Register a CPU for compression.  Its memory must be page-aligned, as
+ * returned by mips_alloc_memory, mips_clone_cpu or mips_snapshot_load.
+ *
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_compress_register(MIPS_CPU *pcpu);
+
+/**
+ * Unregister a CPU.  Called by mips_free_hostdata.
+ *
+ * @param pcpu    Registered CPU; nothing is done for other CPUs.
+ * @param discard If true, the memory is about to be freed and the contents of
+ * compressed pages are not restored.
+ */
+void mips_compress_unregister(MIPS_CPU *pcpu, int discard);
+
+/**
+ * Compress the private pages of a registered CPU immediately, regardless of
+ * whether it is idle.  The CPU must not be executing.
+ *
+ * @return Number of pages compressed, or -1 on failure (errno is set).
+ */
+int mips_compress_cpu(MIPS_CPU *pcpu);
+
+/** Decompress all compressed pages of a CPU; no-op if none. */
+void mips_compress_expand(MIPS_CPU *pcpu);
+
+/**
+ * Start the background thread compressing idle CPUs.
+ *
+ * @param idle_ms   Idle time after which a CPU is compressed.
+ * @param period_ms How often the registered CPUs are checked.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_compress_start(unsigned idle_ms, unsigned period_ms);
+
+/** Stop the background thread. */
+void mips_compress_stop(void);
+
+/**
+ * Mark the CPU idle: its program is blocked waiting for input.  Called by the
+ * reading SPIM services; no-op for unregistered CPUs.
+ */
+void mips_idle_enter(MIPS_CPU *pcpu);
+
+/**
+ * Mark the CPU running again; waits for a compression of its memory that is
+ * in progress.
+ */
+void mips_idle_leave(MIPS_CPU *pcpu);
+
+/** Get compression statistics. */
+void mips_compress_get_stats(struct mips_compress_stats *stats);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_COMPRESS_H_ */
@@ -0,0 +1,264 @@
+/* 
+ * File:    dedup.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Content-based sharing of identical memory pages among CPUs; hosted
+ * implementation.  See dedup.h for the overview.
+ *
+ * The store is a memfd of fixed capacity, mapped MAP_SHARED into the host so
+ * that pages can be compared and filled.  Store pages are reference-counted
+ * and found through a hash table with chaining; chains and the free list are
+ * kept in per-slot arrays.  All store state is protected by a single mutex.
+ * Each CPU records the store slot of every shared page in its host data
+ * (dedup_slots, slot+1 or 0).
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "memory.h"
+#include "dedup.h"
+
+#define NIL ((uint32_t)-1)
+
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+static int Gfd = -1;				/* store file */
+static char *Gstore;				/* store mapping */
+static size_t Gpagesz;
+static size_t Gmaxpages;
+static uint32_t Gnbuckets;			/* power of 2 */
+static uint32_t *Gbuckets;			/* hash chain heads */
+static uint32_t *Gnext;				/* next slot in chain or free list */
+static uint32_t *Grefs;				/* reference counts */
+static uint64_t *Ghash;				/* slot hashes */
+static uint32_t Gfree = NIL;		/* free slot list */
+static uint32_t Gused;				/* slots ever used */
+static struct mips_dedup_stats Gstats;
+
+static uint64_t hash_page(const char*);
+static uint32_t find_slot(const char*, uint64_t);
+static uint32_t add_slot(const char*, uint64_t);
+static void unref_slot(uint32_t);
+
+int mips_dedup_init(size_t maxpages)
+{
+	int err;
+
+	Gpagesz = sysconf(_SC_PAGESIZE);
+	Gmaxpages = maxpages;
+	for(Gnbuckets = 1; Gnbuckets < maxpages; Gnbuckets <<= 1)
+		;
+	if((Gfd = memfd_create("cspim-dedup", MFD_CLOEXEC)) < 0)
+		return -1;
+	if(ftruncate(Gfd, maxpages * Gpagesz) < 0)
+		goto fail;
+	Gstore = mmap(NULL, maxpages * Gpagesz, PROT_READ | PROT_WRITE,
+				  MAP_SHARED, Gfd, 0);
+	if(Gstore == MAP_FAILED)
+		goto fail;
+	Gbuckets = malloc(Gnbuckets * sizeof(*Gbuckets));
+	Gnext = malloc(maxpages * sizeof(*Gnext));
+	Grefs = calloc(maxpages, sizeof(*Grefs));
+	Ghash = malloc(maxpages * sizeof(*Ghash));
+	if(!Gbuckets || !Gnext || !Grefs || !Ghash) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	memset(Gbuckets, 0xFF, Gnbuckets * sizeof(*Gbuckets));
+	return 0;
+
+fail:
+	err = errno;
+	close(Gfd);
+	Gfd = -1;
+	errno = err;
+	return -1;
+}
+
+int mips_dedup_cpu(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+	size_t npages, i;
+	unsigned char *state;
+	uint32_t slot;
+	int merged = 0;
+
+	if((Gfd < 0) || !host) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	npages = pcpu->memsz / Gpagesz;
+	if(!host->dedup_slots &&
+	   !(host->dedup_slots = calloc(npages, sizeof(*host->dedup_slots))))
+		return -1;
+	if(!(state = malloc(npages)))
+		return -1;
+	if(mips_page_state(pcpu->base, npages, state) < 0) {
+		free(state);
+		errno = ENOTSUP;
+		return -1;
+	}
+
+	pthread_mutex_lock(&Glock);
+	for(i = 1; i < npages; i++) {
+		char *page = pcpu->base + i * Gpagesz;
+		uint64_t h;
+
+		if(!(state[i] & MIPS_PAGE_PRIVATE))
+			continue;			/* untouched, or still shared */
+		if(host->dedup_slots[i]) {
+			/* Written to since it was shared. */
+			unref_slot(host->dedup_slots[i] - 1);
+			host->dedup_slots[i] = 0;
+		}
+
+		h = hash_page(page);
+		if((slot = find_slot(page, h)) == NIL) {
+			if((slot = add_slot(page, h)) == NIL)
+				continue;		/* store is full */
+		}
+		if(mmap(page, Gpagesz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+				Gfd, (off_t)slot * Gpagesz) == MAP_FAILED) {
+			if(!Grefs[slot])
+				unref_slot(slot);
+			continue;
+		}
+		++Grefs[slot];
+		++Gstats.shared_pages;
+		host->dedup_slots[i] = slot + 1;
+		++merged;
+	}
+	Gstats.saved_bytes = (Gstats.shared_pages - Gstats.store_pages) * Gpagesz;
+	pthread_mutex_unlock(&Glock);
+
+	free(state);
+	return merged;
+}
+
+void mips_dedup_release(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+	size_t npages, i;
+
+	if(!host || !host->dedup_slots)
+		return;
+	npages = pcpu->memsz / Gpagesz;
+
+	pthread_mutex_lock(&Glock);
+	for(i = 0; i < npages; i++)
+		if(host->dedup_slots[i])
+			unref_slot(host->dedup_slots[i] - 1);
+	Gstats.saved_bytes = (Gstats.shared_pages - Gstats.store_pages) * Gpagesz;
+	pthread_mutex_unlock(&Glock);
+
+	free(host->dedup_slots);
+	host->dedup_slots = NULL;
+}
+
+void mips_dedup_get_stats(struct mips_dedup_stats *stats)
+{
+	pthread_mutex_lock(&Glock);
+	*stats = Gstats;
+	pthread_mutex_unlock(&Glock);
+}
+
+/** FNV-1a hash over 64-bit words of a page. */
+static uint64_t hash_page(const char *page)
+{
+	const uint64_t *w = (const uint64_t*)page;
+	uint64_t h = 0xcbf29ce484222325ULL;
+	size_t i;
+
+	for(i = 0; i < Gpagesz / sizeof(*w); i++)
+		h = (h ^ w[i]) * 0x100000001b3ULL;
+	return h;
+}
+
+/** Find the store slot with the same contents as page, or NIL. */
+static uint32_t find_slot(const char *page, uint64_t h)
+{
+	uint32_t slot;
+
+	for(slot = Gbuckets[h & (Gnbuckets-1)]; slot != NIL; slot = Gnext[slot])
+		if((Ghash[slot] == h) &&
+		   !memcmp(Gstore + (size_t)slot * Gpagesz, page, Gpagesz))
+			return slot;
+	return NIL;
+}
+
+/** Copy page to a free store slot (with 0 references); NIL if full. */
+static uint32_t add_slot(const char *page, uint64_t h)
+{
+	uint32_t slot, b = h & (Gnbuckets-1);
+
+	if(Gfree != NIL) {
+		slot = Gfree;
+		Gfree = Gnext[slot];
+	} else if(Gused < Gmaxpages) {
+		slot = Gused++;
+	} else {
+		return NIL;
+	}
+
+	memcpy(Gstore + (size_t)slot * Gpagesz, page, Gpagesz);
+	Ghash[slot] = h;
+	Gnext[slot] = Gbuckets[b];
+	Gbuckets[b] = slot;
+	++Gstats.store_pages;
+	return slot;
+}
+
+/**
+ * Drop a reference to the slot.  When no references remain, the slot is
+ * removed from its hash chain, its memory is returned to the OS and the slot
+ * is put on the free list.
+ */
+static void unref_slot(uint32_t slot)
+{
+	uint32_t *p;
+
+	if(Grefs[slot]) {
+		--Gstats.shared_pages;
+		if(--Grefs[slot])
+			return;
+	}
+
+	for(p = &Gbuckets[Ghash[slot] & (Gnbuckets-1)]; *p != slot; p = &Gnext[*p])
+		;
+	*p = Gnext[slot];
+	fallocate(Gfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			  (off_t)slot * Gpagesz, Gpagesz);
+	Gnext[slot] = Gfree;
+	Gfree = slot;
+	--Gstats.store_pages;
+}
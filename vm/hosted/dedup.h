@@ -0,0 +1,95 @@
+/* 
+ * File:    dedup.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Content-based sharing of identical memory pages among CPUs; hosted
+ * implementation (Linux only).
+ *
+ * Pages are hashed and identical pages are stored once in a shared store (a
+ * memfd).  Each guest page found in the store is replaced by a MAP_PRIVATE
+ * mapping of the store page, so all CPUs read the same physical page and a
+ * write to it transparently gives the writer a private copy again (i.e.,
+ * breaks sharing).
+ *
+ * Only private pages are considered, i.e., pages written to since the memory
+ * was allocated or, for clones and CPUs with a baseline, since the image was
+ * frozen; the remaining pages of such CPUs are already shared through the
+ * image.  Resetting to a baseline and freezing an image release the CPU's
+ * shared pages.  Page 0 (the control state) is never shared.
+ */
+
+#ifndef MIPS_DEDUP_H_
+#define	MIPS_DEDUP_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Statistics of the shared page store. */
+struct mips_dedup_stats {
+	size_t	shared_pages;		/**!< Guest pages mapped to the store. */
+	size_t	store_pages;		/**!< Distinct pages held by the store. */
+	size_t	saved_bytes;		/**!< Memory saved by sharing. */
+};
+
+/**
+ * Initialize the shared page store.  Must be called once before any other
+ * mips_dedup_* function.
+ *
+ * @param maxpages Maximum number of distinct pages in the store.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_dedup_init(size_t maxpages);
+
+/**
+ * Share the CPU's pages with identical pages in the store, adding the pages
+ * not yet in the store.  Pages that have been shared but have since been
+ * written to are considered again.  The CPU must not be executing during the
+ * call; other CPUs may.
+ *
+ * @param pcpu CPU state.
+ * @return Number of newly shared pages, or -1 on failure (errno is set).
+ * When the store is full, pages which are not already in it are left alone.
+ */
+int mips_dedup_cpu(MIPS_CPU *pcpu);
+
+/**
+ * Drop all references of the CPU to the store.  The CPU's memory must be
+ * unmapped or replaced afterwards, since the store pages may be reused.  This
+ * is done by mips_free_cpu and when an image is frozen.
+ */
+void mips_dedup_release(MIPS_CPU *pcpu);
+
+/**
+ * Get store statistics.  Sharing broken by writes is accounted for only at
+ * the next mips_dedup_cpu or mips_dedup_release of the writing CPU.
+ */
+void mips_dedup_get_stats(struct mips_dedup_stats *stats);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_DEDUP_H_ */
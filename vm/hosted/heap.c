@@ -0,0 +1,492 @@
+/* 
+ * File:    heap.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Heap allocator for MIPS programs; hosted implementation.  See heap.h for
+ * the overview.
+ *
+ * Every block of the heap, allocated or free, is described by a node.  Nodes
+ * are found by block address through an open-addressing hash table; the
+ * block physically following a node is the one starting at its end, and the
+ * one preceding it is linked by phys_prev.  Adjacent free blocks are always
+ * merged.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "../cpu.h"
+#include "syscalls.h"
+#include "heap.h"
+
+/** Number of free lists: 128 exact classes, then one per power of two. */
+#define NBINS	(128 + 32)
+
+/** Smallest remainder split off a free block. */
+#define MIN_SPLIT 16
+
+struct heap_node {
+	mips_uword	addr, size;
+	int			phys_prev;			/* node of the block below, or -1 */
+	int			free;
+	int			prev, next;			/* in the free list, or spare nodes */
+};
+
+struct mips_heap {
+	struct heap_node *nodes;
+	unsigned	nnodes, maxnodes;
+	int			spare;				/* list of unused nodes */
+	int			*table;				/* node indices by address, -1 if empty */
+	unsigned	tsize, tcount;
+	int			bins[NBINS];
+	mips_uword	end;				/* end of the last grown region */
+	int			last;				/* node of the block ending at end */
+};
+
+static struct mips_heap *get_heap(MIPS_CPU*);
+static unsigned bin_index(mips_uword);
+static unsigned hash(struct mips_heap*, mips_uword);
+static int lookup(struct mips_heap*, mips_uword);
+static int table_insert(struct mips_heap*, int);
+static void table_remove(struct mips_heap*, mips_uword);
+static int new_node(struct mips_heap*, mips_uword, mips_uword, int);
+static void drop_node(struct mips_heap*, int);
+static void set_size(struct mips_heap*, int, mips_uword);
+static void bin_insert(struct mips_heap*, int);
+static void bin_remove(struct mips_heap*, int);
+static int next_block(struct mips_heap*, int);
+static void absorb_next(struct mips_heap*, int);
+static void coalesce(struct mips_heap*, int);
+static void split(struct mips_heap*, int, mips_uword);
+static int find_free(struct mips_heap*, mips_uword);
+static int grow(MIPS_CPU*, struct mips_heap*, mips_uword);
+static struct mips_heap *copy_heap(const struct mips_heap*);
+static void free_heap(struct mips_heap*);
+
+mips_uword mips_heap_alloc(MIPS_CPU *pcpu, mips_uword size)
+{
+	struct mips_heap *h;
+	mips_uword need = (size + 7) & ~7U;
+	int i;
+
+	if(!(h = get_heap(pcpu)) || (size > pcpu->memsz))
+		return 0;
+	if(!need)
+		need = 8;
+	if((i = find_free(h, need)) < 0) {
+		if((grow(pcpu, h, need) < 0) || ((i = find_free(h, need)) < 0))
+			return 0;
+	}
+	bin_remove(h, i);
+	split(h, i, need);
+	return h->nodes[i].addr;
+}
+
+void mips_heap_free(MIPS_CPU *pcpu, mips_uword addr)
+{
+	struct mips_heap *h = pcpu->host ? pcpu->host->heap : NULL;
+	int i;
+
+	if(h && ((i = lookup(h, addr)) >= 0) && !h->nodes[i].free)
+		coalesce(h, i);
+}
+
+mips_uword mips_heap_size(MIPS_CPU *pcpu, mips_uword addr)
+{
+	struct mips_heap *h = pcpu->host ? pcpu->host->heap : NULL;
+	int i;
+
+	if(!h || ((i = lookup(h, addr)) < 0) || h->nodes[i].free)
+		return 0;
+	return h->nodes[i].size;
+}
+
+int mips_heap_resize(MIPS_CPU *pcpu, mips_uword addr, mips_uword size)
+{
+	struct mips_heap *h = pcpu->host ? pcpu->host->heap : NULL;
+	mips_uword need = (size + 7) & ~7U;
+	int i, j;
+
+	if(!h || (size > pcpu->memsz) || ((i = lookup(h, addr)) < 0)
+	   || h->nodes[i].free)
+		return -1;
+	if(!need)
+		need = 8;
+	if(need > h->nodes[i].size) {
+		/* A block at the end of the heap can grow with it. */
+		if((i == h->last) && (((pcpu->brk + 7) & ~7U) == h->end)
+		   && (grow(pcpu, h, need - h->nodes[i].size) < 0))
+			return -1;
+		j = next_block(h, i);
+		if((j < 0) || !h->nodes[j].free
+		   || (h->nodes[i].size + h->nodes[j].size < need))
+			return -1;
+		absorb_next(h, i);
+	}
+	split(h, i, need);
+	return 0;
+}
+
+int mips_heap_save(MIPS_CPU *pcpu)
+{
+	struct mips_heap *copy = NULL;
+
+	if(!pcpu->host)
+		return 0;
+	if(pcpu->host->heap && !(copy = copy_heap(pcpu->host->heap)))
+		return -1;
+	free_heap(pcpu->host->heap_saved);
+	pcpu->host->heap_saved = copy;
+	return 0;
+}
+
+int mips_heap_restore(MIPS_CPU *pcpu)
+{
+	if(!pcpu->host)
+		return 0;
+	free_heap(pcpu->host->heap);
+	pcpu->host->heap = NULL;
+	if(pcpu->host->heap_saved
+	   && !(pcpu->host->heap = copy_heap(pcpu->host->heap_saved)))
+		return -1;
+	return 0;
+}
+
+void mips_heap_destroy(MIPS_CPU *pcpu)
+{
+	if(!pcpu->host)
+		return;
+	free_heap(pcpu->host->heap);
+	free_heap(pcpu->host->heap_saved);
+	pcpu->host->heap = pcpu->host->heap_saved = NULL;
+}
+
+/** Return a deep copy of the heap, or NULL if out of memory. */
+static struct mips_heap *copy_heap(const struct mips_heap *h)
+{
+	struct mips_heap *copy = malloc(sizeof(*copy));
+
+	if(!copy)
+		return NULL;
+	*copy = *h;
+	copy->nodes = malloc(h->maxnodes * sizeof(*h->nodes));
+	copy->table = malloc(h->tsize * sizeof(*h->table));
+	if((h->maxnodes && !copy->nodes) || !copy->table) {
+		free_heap(copy);
+		return NULL;
+	}
+	memcpy(copy->nodes, h->nodes, h->nnodes * sizeof(*h->nodes));
+	memcpy(copy->table, h->table, h->tsize * sizeof(*h->table));
+	return copy;
+}
+
+static void free_heap(struct mips_heap *h)
+{
+	if(!h)
+		return;
+	free(h->nodes);
+	free(h->table);
+	free(h);
+}
+
+static struct mips_heap *get_heap(MIPS_CPU *pcpu)
+{
+	struct mips_heap *h;
+	unsigned i;
+
+	if(!pcpu->host)
+		return NULL;
+	if(pcpu->host->heap)
+		return pcpu->host->heap;
+	if(!(h = calloc(1, sizeof(*h))))
+		return NULL;
+	h->tsize = 1024;
+	if(!(h->table = malloc(h->tsize * sizeof(*h->table)))) {
+		free(h);
+		return NULL;
+	}
+	for(i = 0; i < h->tsize; i++)
+		h->table[i] = -1;
+	for(i = 0; i < NBINS; i++)
+		h->bins[i] = -1;
+	h->spare = h->last = -1;
+	return pcpu->host->heap = h;
+}
+
+static unsigned bin_index(mips_uword size)
+{
+	unsigned b = 128;
+
+	if(size < 1024)
+		return size / 8;
+	for(size >>= 11; size; size >>= 1)
+		++b;
+	return b;
+}
+
+static unsigned hash(struct mips_heap *h, mips_uword addr)
+{
+	return ((addr >> 3) * 2654435761U) & (h->tsize - 1);
+}
+
+static int lookup(struct mips_heap *h, mips_uword addr)
+{
+	unsigned k;
+	int i;
+
+	for(k = hash(h, addr); (i = h->table[k]) >= 0; k = (k + 1) & (h->tsize - 1))
+		if(h->nodes[i].addr == addr)
+			return i;
+	return -1;
+}
+
+/** Insert node i, doubling the table when it becomes half full. */
+static int table_insert(struct mips_heap *h, int i)
+{
+	int *old = h->table, *table;
+	unsigned k, oldsize = h->tsize;
+
+	if(2 * (h->tcount + 1) > h->tsize) {
+		if(!(table = malloc(2 * oldsize * sizeof(*table))))
+			return -1;
+		h->table = table;
+		h->tsize = 2 * oldsize;
+		for(k = 0; k < h->tsize; k++)
+			table[k] = -1;
+		h->tcount = 0;
+		for(k = 0; k < oldsize; k++)
+			if(old[k] >= 0)
+				table_insert(h, old[k]);
+		free(old);
+	}
+	for(k = hash(h, h->nodes[i].addr); h->table[k] >= 0; k = (k + 1) & (h->tsize - 1))
+		;
+	h->table[k] = i;
+	++h->tcount;
+	return 0;
+}
+
+/** Remove the entry of addr, moving back the entries of its probe chain. */
+static void table_remove(struct mips_heap *h, mips_uword addr)
+{
+	unsigned mask = h->tsize - 1, k, j, home;
+
+	for(k = hash(h, addr); h->nodes[h->table[k]].addr != addr; k = (k + 1) & mask)
+		;
+	for(j = (k + 1) & mask; h->table[j] >= 0; j = (j + 1) & mask) {
+		home = hash(h, h->nodes[h->table[j]].addr);
+		if(((j - home) & mask) >= ((j - k) & mask)) {
+			h->table[k] = h->table[j];
+			k = j;
+		}
+	}
+	h->table[k] = -1;
+	--h->tcount;
+}
+
+/** Create an allocated node for a block; return its index or -1. */
+static int new_node(struct mips_heap *h, mips_uword addr, mips_uword size,
+					int phys_prev)
+{
+	struct heap_node *nodes;
+	unsigned max;
+	int i;
+
+	if(h->spare >= 0) {
+		i = h->spare;
+		h->spare = h->nodes[i].next;
+	} else {
+		if(h->nnodes == h->maxnodes) {
+			max = h->maxnodes ? 2 * h->maxnodes : 256;
+			if(!(nodes = realloc(h->nodes, max * sizeof(*nodes))))
+				return -1;
+			h->nodes = nodes;
+			h->maxnodes = max;
+		}
+		i = h->nnodes++;
+	}
+	h->nodes[i].addr = addr;
+	h->nodes[i].phys_prev = phys_prev;
+	h->nodes[i].free = 0;
+	h->nodes[i].prev = h->nodes[i].next = -1;
+	if(table_insert(h, i) < 0) {
+		h->nodes[i].next = h->spare;
+		h->spare = i;
+		return -1;
+	}
+	set_size(h, i, size);
+	return i;
+}
+
+static void drop_node(struct mips_heap *h, int i)
+{
+	table_remove(h, h->nodes[i].addr);
+	h->nodes[i].next = h->spare;
+	h->spare = i;
+}
+
+/** Set the size of a node; keeps track of the last node. */
+static void set_size(struct mips_heap *h, int i, mips_uword size)
+{
+	h->nodes[i].size = size;
+	if(h->nodes[i].addr + size == h->end)
+		h->last = i;
+}
+
+static void bin_insert(struct mips_heap *h, int i)
+{
+	struct heap_node *n = &h->nodes[i];
+	unsigned b = bin_index(n->size);
+
+	n->free = 1;
+	n->prev = -1;
+	if((n->next = h->bins[b]) >= 0)
+		h->nodes[n->next].prev = i;
+	h->bins[b] = i;
+}
+
+static void bin_remove(struct mips_heap *h, int i)
+{
+	struct heap_node *n = &h->nodes[i];
+
+	if(n->prev >= 0)
+		h->nodes[n->prev].next = n->next;
+	else
+		h->bins[bin_index(n->size)] = n->next;
+	if(n->next >= 0)
+		h->nodes[n->next].prev = n->prev;
+	n->free = 0;
+}
+
+static int next_block(struct mips_heap *h, int i)
+{
+	return lookup(h, h->nodes[i].addr + h->nodes[i].size);
+}
+
+/** Merge the following block into the node i, which is not in a free list. */
+static void absorb_next(struct mips_heap *h, int i)
+{
+	int j = next_block(h, i), k;
+
+	if(h->nodes[j].free)
+		bin_remove(h, j);
+	if((k = next_block(h, j)) >= 0)
+		h->nodes[k].phys_prev = i;
+	set_size(h, i, h->nodes[i].size + h->nodes[j].size);
+	drop_node(h, j);
+}
+
+/** Free the block i, merging it with free neighbours. */
+static void coalesce(struct mips_heap *h, int i)
+{
+	int j = next_block(h, i);
+
+	if((j >= 0) && h->nodes[j].free)
+		absorb_next(h, i);
+	if(((j = h->nodes[i].phys_prev) >= 0) && h->nodes[j].free) {
+		bin_remove(h, j);
+		absorb_next(h, j);
+		i = j;
+	}
+	bin_insert(h, i);
+}
+
+/**
+ * Shrink the allocated block i to size, freeing the remainder if it is big
+ * enough.  If the remainder cannot be given a node, the block stays whole.
+ */
+static void split(struct mips_heap *h, int i, mips_uword size)
+{
+	mips_uword rest = h->nodes[i].size - size;
+	int j, k;
+
+	if(rest < MIN_SPLIT)
+		return;
+	k = next_block(h, i);
+	if((j = new_node(h, h->nodes[i].addr + size, rest, i)) < 0)
+		return;
+	h->nodes[i].size = size;
+	if(k >= 0)
+		h->nodes[k].phys_prev = j;
+	coalesce(h, j);
+}
+
+/**
+ * Find a free block of at least size bytes: the first one in its exact size
+ * class or power-of-two list, otherwise any in a larger list.
+ */
+static int find_free(struct mips_heap *h, mips_uword size)
+{
+	unsigned b = bin_index(size);
+	int i;
+
+	for(i = h->bins[b]; i >= 0; i = h->nodes[i].next)
+		if(h->nodes[i].size >= size)
+			return i;
+	while(++b < NBINS)
+		if(h->bins[b] >= 0)
+			return h->bins[b];
+	return -1;
+}
+
+/**
+ * Move the break up to add a free block of at least size bytes to the heap.
+ * If the break has not moved since the last growth, the new memory extends
+ * the last block.
+ */
+static int grow(MIPS_CPU *pcpu, struct mips_heap *h, mips_uword size)
+{
+	mips_uword start = (pcpu->brk + 7) & ~7U;
+	mips_uword limit = pcpu->memsz - pcpu->stksz;
+	mips_uword amount = size > MIPS_HEAP_GROW ? size : MIPS_HEAP_GROW;
+	mips_uword oldend = h->end;
+	int i, last = h->last;
+
+	/* Like in sbrk, the break must stay below the stack. */
+	if((start >= limit) || (size > ((limit - start - 1) & ~7U)))
+		return -1;
+	if(amount > ((limit - start - 1) & ~7U))
+		amount = (limit - start - 1) & ~7U;
+
+	h->end = start + amount;
+	if((start == oldend) && (last >= 0)) {
+		if(h->nodes[last].free) {
+			bin_remove(h, last);
+			set_size(h, last, h->nodes[last].size + amount);
+			bin_insert(h, last);
+			pcpu->brk = h->end;
+			return 0;
+		}
+		i = new_node(h, start, amount, last);
+	} else {
+		i = new_node(h, start, amount, -1);
+	}
+	if(i < 0) {
+		h->end = oldend;
+		return -1;
+	}
+	pcpu->brk = h->end;
+	bin_insert(h, i);
+	return 0;
+}
@@ -0,0 +1,108 @@
+/* 
+ * File:    heap.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Heap allocator for MIPS programs; hosted implementation.
+ *
+ * The heap occupies MIPS memory above the break: when it runs out of free
+ * blocks, it moves pcpu->brk up by at least MIPS_HEAP_GROW bytes like sbrk
+ * would, so the program may still use sbrk as well.  All bookkeeping (block
+ * sizes, free lists) is kept in host memory, so MIPS memory holds only the
+ * blocks themselves and the program cannot corrupt the heap.  Blocks are
+ * aligned to 8 bytes.  Free blocks are kept in segregated lists (exact size
+ * classes of 8 bytes up to 1 KiB, powers of two above) and coalesced with
+ * their free neighbours.
+ *
+ * The heap is part of the host data, so it is not carried over to clones and
+ * snapshots.  Blocks allocated before are then unknown: they are never
+ * reused, mips_heap_free ignores them and mips_heap_size returns 0.  A
+ * baseline, on the other hand, saves the heap along with memory, and
+ * resetting to the baseline restores it, so that the heap agrees with the
+ * restored break.
+ */
+
+#ifndef MIPS_HEAP_H_
+#define	MIPS_HEAP_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Minimum number of bytes by which the heap grows the break. */
+#define MIPS_HEAP_GROW 65536
+
+struct mips_heap;
+
+/**
+ * Allocate a block of at least size bytes; the heap is created on first use.
+ *
+ * @return MIPS address of the block, or 0 if there is not enough MIPS memory
+ * below the stack or host memory for the bookkeeping.
+ */
+mips_uword mips_heap_alloc(MIPS_CPU *pcpu, mips_uword size);
+
+/** Free the block at addr; unknown addresses are ignored. */
+void mips_heap_free(MIPS_CPU *pcpu, mips_uword addr);
+
+/** Return the usable size of the allocated block at addr, or 0 if unknown. */
+mips_uword mips_heap_size(MIPS_CPU *pcpu, mips_uword addr);
+
+/**
+ * Resize the allocated block at addr to at least size bytes in place, by
+ * splitting it or by merging it with the following free block (growing the
+ * heap if the block is at its end).
+ *
+ * @return 0 on success, -1 if the block has to be moved or is unknown.
+ */
+int mips_heap_resize(MIPS_CPU *pcpu, mips_uword addr, mips_uword size);
+
+/**
+ * Save a copy of the heap (or its absence), replacing a previously saved one;
+ * called by mips_set_baseline.
+ *
+ * @return 0 on success, -1 if out of host memory.
+ */
+int mips_heap_save(MIPS_CPU *pcpu);
+
+/**
+ * Replace the heap by a copy of the saved one; called by
+ * mips_reset_to_baseline.  If the copy cannot be made, the CPU is left
+ * without a heap, so that no block is handed out twice.
+ *
+ * @return 0 on success, -1 if out of host memory.
+ */
+int mips_heap_restore(MIPS_CPU *pcpu);
+
+/**
+ * Release the bookkeeping of the heap and of its saved copy; called by
+ * mips_free_hostdata.
+ */
+void mips_heap_destroy(MIPS_CPU *pcpu);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_HEAP_H_ */
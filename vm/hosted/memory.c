@@ -0,0 +1,498 @@
+/* 
+ * File:    memory.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Allocation and sharing of MIPS memory; hosted implementation.  See
+ * memory.h for the overview.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "memory.h"
+#include "compress.h"
+#include "dedup.h"
+#include "heap.h"
+#include "pool.h"
+#include "numa.h"
+
+/* Bits of a /proc/self/pagemap entry. */
+#define PM_PRESENT	(1ULL << 63)
+#define PM_SWAPPED	(1ULL << 62)
+#define PM_FILE		(1ULL << 61)
+
+static int freeze_image(MIPS_CPU*, int);
+static int is_pristine(MIPS_CPU*);
+static int copy_private_pages(MIPS_CPU*, char*);
+static int compare_pages(MIPS_CPU*, char*);
+
+char *mips_alloc_memory(size_t memsz)
+{
+	char *base;
+
+	if((base = mips_pool_acquire(memsz)) != NULL)
+		return base;
+	base = mmap(NULL, memsz, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return base == MAP_FAILED ? NULL : base;
+}
+
+void mips_free_memory(char *base, size_t memsz)
+{
+	if(mips_pool_release(base) < 0)
+		munmap(base, memsz);
+}
+
+MIPS_CPU *mips_clone_cpu(MIPS_CPU *parent)
+{
+	MIPS_CPU *pcpu;
+	char *base;
+	int i;
+
+	mips_compress_expand(parent);
+	if(freeze_image(parent, 0) < 0)
+		return NULL;
+	base = mmap(NULL, parent->memsz, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+				parent->host->image_fd, 0);
+	if(base == MAP_FAILED)
+		return NULL;
+	if(copy_private_pages(parent, base) < 0) {
+		i = errno;
+		munmap(base, parent->memsz);
+		errno = i;
+		return NULL;
+	}
+
+	/* The control state has been copied along with memory; re-bind the
+	 * pointers that must be private to the clone. */
+
+	pcpu = (MIPS_CPU*)base;
+	pcpu->base = base;
+	mips_init_hostdata(pcpu);
+	if(!pcpu->host) {
+		munmap(base, parent->memsz);
+		errno = ENOMEM;
+		return NULL;
+	}
+	for(i = 3; i < MIPS_MAXFDS; i++)
+		if(pcpu->fds[i] >= 0)
+			pcpu->fds[i] = dup(pcpu->fds[i]);
+
+	/* The clone's memory differs from the image only in its private pages,
+	 * so it can serve as the clone's image too; without it, the clone would
+	 * freeze an image of its own when needed. */
+
+	pcpu->host->image_fd = dup(parent->host->image_fd);
+	if(parent->icache && (mips_icache_enable(pcpu) < 0)) {
+		mips_free_cpu(pcpu);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	return pcpu;
+}
+
+void mips_free_cpu(MIPS_CPU *pcpu)
+{
+	char *base = pcpu->base;
+	size_t memsz = pcpu->memsz;
+	int i;
+
+	for(i = 3; i < MIPS_MAXFDS; i++)
+		if(pcpu->fds[i] >= 0)
+			close(pcpu->fds[i]);
+	mips_dedup_release(pcpu);
+	mips_free_hostdata(pcpu);
+	mips_free_memory(base, memsz);
+}
+
+int mips_set_baseline(MIPS_CPU *pcpu)
+{
+	size_t nwords = ((pcpu->memsz >> MIPS_PAGESHIFT) + 32) / 32;
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t n = pcpu->memsz < pagesz ? pcpu->memsz : pagesz;
+	char *first;
+	int err;
+
+	if(!pcpu->host) {
+		errno = ENOMEM;
+		return -1;
+	}
+	mips_compress_expand(pcpu);
+	free(pcpu->dirty);
+	pcpu->dirty = calloc(nwords, sizeof(mips_uword));
+	if(!pcpu->dirty || !(first = malloc(n))) {
+		err = ENOMEM;
+		goto fail;
+	}
+	if(freeze_image(pcpu, !is_pristine(pcpu)) < 0) {
+		err = errno;
+		free(first);
+		goto fail;
+	}
+	if(mips_heap_save(pcpu) < 0) {
+		err = ENOMEM;
+		free(first);
+		goto fail;
+	}
+
+	/* The first page holds the control state, which is not in a reused
+	 * image (it differs at least in host pointers), so it is restored from
+	 * a copy. */
+
+	memcpy(first, pcpu->base, n);
+	free(pcpu->host->baseline);
+	pcpu->host->baseline = first;
+	return 0;
+
+fail:
+	free(pcpu->dirty);
+	pcpu->dirty = NULL;
+	errno = err;
+	return -1;
+}
+
+int mips_reset_to_baseline(MIPS_CPU *pcpu)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t npages = (pcpu->memsz + (1U << MIPS_PAGESHIFT) - 1) >> MIPS_PAGESHIFT;
+	mips_uword *dirty = pcpu->dirty;
+	int fds[MIPS_MAXFDS];
+	size_t i, j, start, end;
+	int nreset = 0;
+
+	if(!dirty || !pcpu->host || (pcpu->host->image_fd < 0)
+	   || !pcpu->host->baseline) {
+		errno = EINVAL;
+		return -1;
+	}
+	memcpy(fds, pcpu->fds, sizeof(fds));
+	mips_compress_expand(pcpu);
+
+	/* Pages shared through the dedup store are backed by the store rather
+	 * than by the image, so discarding would not restore them; map them from
+	 * the image again before dropping their references. */
+
+	if(pcpu->host->dedup_slots) {
+		for(i = 1; i < pcpu->memsz / pagesz; i++) {
+			if(!pcpu->host->dedup_slots[i])
+				continue;
+			if(mmap(pcpu->base + i * pagesz, pagesz, PROT_READ | PROT_WRITE,
+					MAP_PRIVATE | MAP_FIXED, pcpu->host->image_fd,
+					(off_t)(i * pagesz)) == MAP_FAILED)
+				return -1;
+			++nreset;
+		}
+		mips_dedup_release(pcpu);
+	}
+
+	/* Discard private copies of dirty pages so that they are again backed by
+	 * the image.  Runs of consecutive dirty pages are discarded with a single
+	 * call.  The first host page holds the control state (registers etc.),
+	 * which is modified without going through poke; it is always restored
+	 * from the copy taken at the baseline. */
+
+	for(i = 0; i < npages; i = j) {
+		if(!dirty[i >> 5]) {
+			j = (i | 31) + 1;
+			continue;
+		}
+		for(j = i; (j < npages) && (dirty[j >> 5] & (1U << (j & 31))); j++)
+			;
+		if(j == i) {
+			++j;
+			continue;
+		}
+		nreset += j - i;
+		start = (i << MIPS_PAGESHIFT) & ~(pagesz - 1);
+		end = j << MIPS_PAGESHIFT;
+		if(end > pcpu->memsz)
+			end = pcpu->memsz;
+		if(madvise(pcpu->base + start, end - start, MADV_DONTNEED) < 0)
+			return -1;
+	}
+	memcpy(pcpu->base, pcpu->host->baseline,
+		   pcpu->memsz < pagesz ? pcpu->memsz : pagesz);
+	memset(dirty, 0, ((npages + 32) / 32) * sizeof(mips_uword));
+	++nreset;
+
+	/* Close files opened since the baseline. */
+
+	for(i = 3; i < MIPS_MAXFDS; i++)
+		if((fds[i] >= 0) && (fds[i] != pcpu->fds[i]))
+			close(fds[i]);
+
+	/* The heap must agree with the restored break. */
+
+	if(mips_heap_restore(pcpu) < 0)
+		return -1;
+	return nreset;
+}
+
+int mips_map_file(MIPS_CPU *pcpu, mips_uword addr, size_t len, int fd,
+				  off_t off, int flags)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t lowbase = (MIPS_LOWBASE + pagesz - 1) & ~(pagesz - 1);
+	size_t limit = pcpu->memsz - pcpu->stksz;
+	struct stat st;
+	void *p;
+
+	if(!pcpu->host || (pcpu->peek_uw != mips_identity_peek_uw)
+	   || ((uintptr_t)pcpu->base % pagesz) || (addr % pagesz) || (off % pagesz)
+	   || (addr < lowbase) || (addr >= limit) || !len) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(fstat(fd, &st) < 0)
+		return -1;
+	if(off >= st.st_size) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Pages past the end of the file would raise SIGBUS on access. */
+
+	if(len > (size_t)(st.st_size - off))
+		len = st.st_size - off;
+	len = (len + pagesz - 1) & ~(pagesz - 1);
+	if(len > limit - addr) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	mips_compress_expand(pcpu);
+	p = mmap(pcpu->base + addr, len, PROT_READ | PROT_WRITE,
+			 ((flags & MIPS_MAP_SHARED) ? MAP_SHARED : MAP_PRIVATE) | MAP_FIXED,
+			 fd, off);
+	if(p == MAP_FAILED)
+		return -1;
+	++pcpu->host->nregions;
+	return 0;
+}
+
+int mips_icache_enable(MIPS_CPU *pcpu)
+{
+	size_t sz = MIPS_ICACHE_SIZE * sizeof(struct mips_icache_entry);
+	void *p;
+
+	if(pcpu->icache)
+		return 0;
+	if(!pcpu->host) {
+		errno = ENOMEM;
+		return -1;
+	}
+	p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS,
+			 -1, 0);
+	if(p == MAP_FAILED)
+		return -1;
+	if((pcpu->host->node >= 0)
+	   && (mips_numa_bind_memory(p, sz, pcpu->host->node) < 0)) {
+		munmap(p, sz);
+		return -1;
+	}
+	pcpu->icache = p;
+	return 0;
+}
+
+int mips_page_state(const char *p, size_t npages, unsigned char *state)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	uint64_t pm[512];
+	size_t i, j, n;
+	int fd;
+
+	if((fd = open("/proc/self/pagemap", O_RDONLY)) < 0)
+		return -1;
+	for(i = 0; i < npages; i += n) {
+		off_t pmoff = ((uintptr_t)p / pagesz + i) * sizeof(*pm);
+
+		n = npages - i < 512 ? npages - i : 512;
+		if(pread(fd, pm, n * sizeof(*pm), pmoff) != (ssize_t)(n * sizeof(*pm))) {
+			close(fd);
+			return -1;
+		}
+		for(j = 0; j < n; j++) {
+			state[i+j] = 0;
+			if((pm[j] & PM_SWAPPED) || ((pm[j] & PM_PRESENT) && !(pm[j] & PM_FILE)))
+				state[i+j] |= MIPS_PAGE_PRIVATE;
+		}
+	}
+	close(fd);
+	return 0;
+}
+
+int mips_is_zero(const char *p, size_t n)
+{
+	const unsigned long *w = (const unsigned long*)p;
+	size_t i;
+
+	for(i = 0; i < n / sizeof(*w); i++)
+		if(w[i])
+			return 0;
+	for(i *= sizeof(*w); i < n; i++)
+		if(p[i])
+			return 0;
+	return 1;
+}
+
+/**
+ * Move the CPU's memory into a memfd image, unless already done (and refreeze
+ * is false), and replace the memory with a private mapping of the image.
+ * Since the image is mapped only privately, it never changes afterwards; a
+ * new image is created on refreeze.
+ */
+static int freeze_image(MIPS_CPU *pcpu, int refreeze)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	struct mips_hostdata *host = pcpu->host;
+	size_t off, n;
+	int fd, err;
+
+	if(!host) {
+		errno = ENOMEM;
+		return -1;
+	}
+	if(host->nregions) {
+		errno = EINVAL;
+		return -1;
+	}
+	if((host->image_fd >= 0) && !refreeze)
+		return 0;
+	if((uintptr_t)pcpu->base % pagesz) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	if((fd = memfd_create("cspim-image", MFD_CLOEXEC)) < 0)
+		return -1;
+	if(ftruncate(fd, pcpu->memsz) < 0)
+		goto fail;
+	for(off = 0; off < pcpu->memsz; off += pagesz) {
+		n = pcpu->memsz - off < pagesz ? pcpu->memsz - off : pagesz;
+		if(mips_is_zero(pcpu->base + off, n))
+			continue;
+		if(pwrite(fd, pcpu->base + off, n, off) != (ssize_t)n)
+			goto fail;
+	}
+	if(mmap(pcpu->base, pcpu->memsz, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_FIXED, fd, 0) == MAP_FAILED)
+		goto fail;
+
+	if(host->image_fd >= 0)
+		close(host->image_fd);
+	host->image_fd = fd;
+	mips_dedup_release(pcpu);
+	return 0;
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+/**
+ * Return true if the CPU's memory, apart from the first page, is still
+ * identical to its image: no page has a private copy or has been mapped from
+ * the shared page store.  Returns false if this cannot be determined.
+ */
+static int is_pristine(MIPS_CPU *pcpu)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t npages = (pcpu->memsz + pagesz - 1) / pagesz;
+	unsigned char *state;
+	size_t i;
+
+	if((pcpu->host->image_fd < 0) || pcpu->host->dedup_slots
+	   || !(state = malloc(npages)))
+		return 0;
+	if(mips_page_state(pcpu->base, npages, state) < 0) {
+		free(state);
+		return 0;
+	}
+	for(i = 1; (i < npages) && !(state[i] & MIPS_PAGE_PRIVATE); i++)
+		;
+	free(state);
+	return i == npages;
+}
+
+/**
+ * Copy into dst the pages which the parent has modified since its image was
+ * frozen.  These are exactly the pages of the parent's mapping that are no
+ * longer backed by the image file: private copies and pages mapped from the
+ * dedup store.
+ */
+static int copy_private_pages(MIPS_CPU *parent, char *dst)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t npages = (parent->memsz + pagesz - 1) / pagesz;
+	unsigned *slots = parent->host->dedup_slots;
+	unsigned char *state;
+	size_t i, off;
+
+	if(!(state = malloc(npages)))
+		return -1;
+	if(mips_page_state(parent->base, npages, state) < 0) {
+		free(state);
+		return compare_pages(parent, dst);
+	}
+	for(i = 0; i < npages; i++) {
+		off = i * pagesz;
+		if((state[i] & MIPS_PAGE_PRIVATE) || (slots && slots[i]))
+			memcpy(dst + off, parent->base + off,
+				   parent->memsz - off < pagesz ? parent->memsz - off : pagesz);
+	}
+	free(state);
+	return 0;
+}
+
+/** Fallback for copy_private_pages: compare every page against the image. */
+static int compare_pages(MIPS_CPU *parent, char *dst)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t off, n;
+	char *image;
+
+	image = mmap(NULL, parent->memsz, PROT_READ, MAP_SHARED,
+				 parent->host->image_fd, 0);
+	if(image == MAP_FAILED)
+		return -1;
+	for(off = 0; off < parent->memsz; off += pagesz) {
+		n = parent->memsz - off < pagesz ? parent->memsz - off : pagesz;
+		if(memcmp(image + off, parent->base + off, n))
+			memcpy(dst + off, parent->base + off, n);
+	}
+	munmap(image, parent->memsz);
+	return 0;
+}
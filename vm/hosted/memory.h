@@ -0,0 +1,184 @@
+/* 
+ * File:    memory.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Allocation and sharing of MIPS memory; hosted implementation.
+ *
+ * Memory allocated by mips_alloc_memory is page-aligned and obtained directly
+ * from the OS, which makes it possible to replace parts of it with other
+ * mappings.  This is used by mips_clone_cpu: the first clone moves the
+ * parent's memory into an anonymous memory file (memfd) which is then mapped
+ * MAP_PRIVATE by the parent and by all clones, so that pages are shared
+ * copy-on-write and each CPU consumes memory only for pages it has modified.
+ * Cloning is supported only on Linux.
+ *
+ * The same image serves as a baseline to which a CPU can be cheaply reset:
+ * pages modified by poke functions are recorded in the pcpu->dirty bitmap, and
+ * resetting discards their private copies.
+ */
+
+#ifndef MIPS_MEMORY_H_
+#define	MIPS_MEMORY_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/**
+ * Allocate zero-filled, page-aligned memory for a CPU.  The memory is taken
+ * from the pool if one has been initialized (see pool.h).
+ *
+ * @param memsz Size of MIPS memory.
+ * @return Pointer to the memory to be passed to mips_init_cpu, or NULL on
+ * failure.
+ */
+char *mips_alloc_memory(size_t memsz);
+
+/**
+ * Release memory allocated by mips_alloc_memory or mips_clone_cpu; pool memory
+ * is returned to the pool.
+ */
+void mips_free_memory(char *base, size_t memsz);
+
+/**
+ * Create an independent copy of a CPU with its memory shared copy-on-write.
+ * The clone has its own registers, host data and file descriptor table;
+ * guest file descriptors other than 0, 1 and 2 are duplicated (dup), so the
+ * clone may close them independently, but the file offsets are shared.
+ *
+ * The first clone freezes the parent's memory into an image which is also
+ * mapped by the parent.  The parent may continue to execute: its subsequent
+ * modifications are private, and later clones copy only the pages that
+ * differ from the image.  The clone keeps the image as its own, so it is
+ * frozen again only when the clone gets a baseline after modifying memory.
+ *
+ * @param parent CPU state whose memory has been allocated with
+ * mips_alloc_memory or by a previous mips_clone_cpu.
+ * @return Pointer to the new CPU state, or NULL on failure (errno is set).
+ */
+MIPS_CPU *mips_clone_cpu(MIPS_CPU *parent);
+
+/**
+ * Release a CPU created by mips_init_cpu on memory from mips_alloc_memory, or
+ * by mips_clone_cpu: close its guest file descriptors other than 0, 1 and 2,
+ * and free its host data and memory.
+ */
+void mips_free_cpu(MIPS_CPU *pcpu);
+
+/**
+ * Make the current state of the CPU its baseline and start tracking modified
+ * pages (pcpu->dirty).  The memory is frozen into an image just like for
+ * mips_clone_cpu, replacing a previous baseline or image, unless it is still
+ * identical to the image (e.g. in a fresh clone), which is then reused.
+ * Either way, a copy of the first page with the control state is kept, as is
+ * a copy of the heap of the malloc services (see heap.h).
+ *
+ * @param pcpu CPU state whose memory has been allocated with
+ * mips_alloc_memory or mips_clone_cpu.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_set_baseline(MIPS_CPU *pcpu);
+
+/**
+ * Restore the CPU to its baseline.  Only pages modified since the baseline
+ * (or the last reset) and the control state are restored: private copies of
+ * the former are discarded and the latter is copied back, so the cost is
+ * proportional to the number of modified pages and not to the memory size.
+ * Pages shared through the dedup store are mapped from the image again.
+ * Guest files opened since the baseline are closed, and the heap is restored
+ * along with the break.
+ *
+ * @param pcpu CPU state prepared with mips_set_baseline.
+ * @return Number of restored pages, or -1 on failure (errno is set).
+ *
+ * @note Memory modified directly through pcpu->base instead of poke
+ * functions is not tracked and will not be restored.
+ */
+int mips_reset_to_baseline(MIPS_CPU *pcpu);
+
+/** File mapping flag: writes go to the file instead of private copies. */
+#define MIPS_MAP_SHARED		1
+
+/**
+ * Map a file over a range of MIPS memory, so that the program accesses the
+ * file's contents directly through the page cache.  By default the mapping is
+ * copy-on-write: the program may modify the data, but the file is never
+ * changed; with MIPS_MAP_SHARED, modifications are written to the file, which
+ * must then be open for writing.  The range is truncated to the end of the
+ * file; memory beyond it is left as it was.  May be called before or after
+ * mips_elf_load; in the former case the region must not overlap the ELF
+ * segments.
+ *
+ * A CPU with file-backed memory cannot be cloned and cannot have a baseline,
+ * since its memory is not entirely its own.  Memory must not be transformed
+ * (e.g. encrypted) because the file data is used verbatim.
+ *
+ * @param pcpu  CPU state whose memory has been allocated with
+ * mips_alloc_memory, mips_clone_cpu or mips_snapshot_load.
+ * @param addr  MIPS address of the range; page-aligned and not below
+ *              MIPS_LOWBASE.
+ * @param len   Length of the range; it must end below the stack.
+ * @param fd    Host file descriptor; may be closed after the call.
+ * @param off   Page-aligned offset in the file.
+ * @param flags MIPS_MAP_* flags.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_map_file(MIPS_CPU *pcpu, mips_uword addr, size_t len, int fd,
+				  off_t off, int flags);
+
+/**
+ * Give the CPU an instruction cache (see struct mips_icache_entry), which pays
+ * off when the memory transform makes every fetch expensive.  Only a small
+ * table of individual instructions is kept in plain form; text pages stay
+ * transformed.  The cache is released with the host data and clones get a
+ * cache of their own.  If the CPU is placed on a NUMA node, so is the cache.
+ *
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_icache_enable(MIPS_CPU *pcpu);
+
+/** Page state flag: the page has a private (anonymous) copy. */
+#define MIPS_PAGE_PRIVATE	1
+
+/**
+ * Query the state of host pages, which is used to find pages that consume
+ * memory of their own instead of being shared with a file or an image.  Only
+ * supported on Linux.
+ *
+ * @param p      Page-aligned start of the memory area.
+ * @param npages Number of host pages to query.
+ * @param state  Array of npages elements receiving MIPS_PAGE_* flags.
+ * @return 0 on success, -1 if the state cannot be determined.
+ */
+int mips_page_state(const char *p, size_t npages, unsigned char *state);
+
+/** Return true if the memory area contains only 0s. */
+int mips_is_zero(const char *p, size_t n);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_MEMORY_H_ */
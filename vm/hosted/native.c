@@ -0,0 +1,192 @@
+/* 
+ * File:    native.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "../cpu.h"
+#include "syscalls.h"
+#include "native.h"
+
+static int native_printf(MIPS_CPU *pcpu);
+static int native_divdi3(MIPS_CPU *pcpu);
+static int native_udivdi3(MIPS_CPU *pcpu);
+static int native_moddi3(MIPS_CPU *pcpu);
+static int native_umoddi3(MIPS_CPU *pcpu);
+
+/**
+ * Native routines, in the order of their SYSCALL codes: those with fn == NULL
+ * are performed by the SPIM service.
+ */
+static const struct native {
+	const char	*name;
+	mips_uword	service;
+	int			(*fn)(MIPS_CPU*);
+} Gnatives[] = {
+	{ "memcpy",		21, NULL },
+	{ "memmove",	21, NULL },
+	{ "memset",		22, NULL },
+	{ "memcmp",		23, NULL },
+	{ "strlen",		24, NULL },
+	{ "vprintf",	25, NULL },
+	{ "printf",		0,	native_printf },
+	{ "malloc",		26, NULL },
+	{ "free",		27, NULL },
+	{ "realloc",	28, NULL },
+	{ "calloc",		29, NULL },
+	{ "__divdi3",	0,	native_divdi3 },
+	{ "__udivdi3",	0,	native_udivdi3 },
+	{ "__moddi3",	0,	native_moddi3 },
+	{ "__umoddi3",	0,	native_umoddi3 }
+};
+
+#define NNATIVES (sizeof(Gnatives) / sizeof(Gnatives[0]))
+
+int mips_native_bind(MIPS_CPU *pcpu, const char *name)
+{
+	Elf32_Sym *sym;
+	mips_uword addr;
+	unsigned i;
+
+	for(i = 0; (i < NNATIVES) && strcmp(Gnatives[i].name, name); i++)
+		;
+	if(i == NNATIVES) {
+		errno = ENOSYS;
+		return -1;
+	}
+	if(!pcpu->elf || !pcpu->shsymtab
+	   || !(sym = mips_elf_find_symbol(pcpu, name))
+	   || (ELF_ST_TYPE(sym->st_info) != STT_FUNC)) {
+		errno = ENOENT;
+		return -1;
+	}
+	addr = sym->st_value;
+	if((addr & 3) || (addr < MIPS_LOWBASE) || (addr > pcpu->memsz - 4)) {
+		errno = EINVAL;
+		return -1;
+	}
+	mips_poke_uw(pcpu, addr, ((MIPS_NATIVE_SYSCALL + i) << 6) | 0x0C);
+	return 0;
+}
+
+const char *mips_native_name(unsigned i)
+{
+	return i < NNATIVES ? Gnatives[i].name : NULL;
+}
+
+int mips_native_call(MIPS_CPU *pcpu)
+{
+	const struct native *native;
+	int opcode = -1, code, err;
+
+	code = mips_break_code(pcpu, &opcode);
+	if((opcode != MIPS_I_SYSCALL) || (code < MIPS_NATIVE_SYSCALL)
+	   || (code >= MIPS_NATIVE_SYSCALL + (int)NNATIVES))
+		return -1;
+	native = &Gnatives[code - MIPS_NATIVE_SYSCALL];
+	err = native->fn ? native->fn(pcpu)
+		: mips_spim_service(pcpu, native->service);
+	if(err)
+		return err;
+	pcpu->pc = pcpu->r.ur[31];
+	return 0;
+}
+
+/**
+ * The o32 caller reserves the home area for $a0-$a3 at $sp, so storing $a1-$a3
+ * there turns the variable arguments into a va_list for vprintf.
+ */
+static int native_printf(MIPS_CPU *pcpu)
+{
+	mips_uword sp = pcpu->r.ur[29];
+	mips_uword home[3];
+
+	home[0] = pcpu->r.ur[5];
+	home[1] = pcpu->r.ur[6];
+	home[2] = pcpu->r.ur[7];
+	if(mips_copyout(pcpu, sp + 4, home, sizeof(home)) < 0)
+		return MIPS_E_ADDRESS;
+	pcpu->r.ur[5] = sp + 4;
+	return mips_spim_service(pcpu, 25);
+}
+
+/** Return the 64-bit argument in $a0:$a1 (i == 0) or $a2:$a3 (i == 1). */
+static inline unsigned long long get_arg64(MIPS_CPU *pcpu, int i)
+{
+	return pcpu->r.ur[4+2*i] | ((unsigned long long)pcpu->r.ur[5+2*i] << 32);
+}
+
+/** Return a 64-bit result in $v0:$v1. */
+static inline int set_result64(MIPS_CPU *pcpu, unsigned long long v)
+{
+	pcpu->r.ur[2] = (mips_uword)v;
+	pcpu->r.ur[3] = (mips_uword)(v >> 32);
+	return 0;
+}
+
+/*
+ * Division by zero faults with MIPS_E_BREAK, like the BREAK 7 with which
+ * compiled division checks trap, so binding does not change the outcome.
+ * The most negative number divided by -1 wraps around like in hardware.
+ */
+
+static int native_divdi3(MIPS_CPU *pcpu)
+{
+	long long a = get_arg64(pcpu, 0), b = get_arg64(pcpu, 1);
+
+	if(!b)
+		return MIPS_E_BREAK;
+	if(b == -1)
+		return set_result64(pcpu, -(unsigned long long)a);
+	return set_result64(pcpu, a / b);
+}
+
+static int native_udivdi3(MIPS_CPU *pcpu)
+{
+	unsigned long long a = get_arg64(pcpu, 0), b = get_arg64(pcpu, 1);
+
+	if(!b)
+		return MIPS_E_BREAK;
+	return set_result64(pcpu, a / b);
+}
+
+static int native_moddi3(MIPS_CPU *pcpu)
+{
+	long long a = get_arg64(pcpu, 0), b = get_arg64(pcpu, 1);
+
+	if(!b)
+		return MIPS_E_BREAK;
+	if(b == -1)
+		return set_result64(pcpu, 0);
+	return set_result64(pcpu, a % b);
+}
+
+static int native_umoddi3(MIPS_CPU *pcpu)
+{
+	unsigned long long a = get_arg64(pcpu, 0), b = get_arg64(pcpu, 1);
+
+	if(!b)
+		return MIPS_E_BREAK;
+	return set_result64(pcpu, a % b);
+}
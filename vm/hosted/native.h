@@ -0,0 +1,87 @@
+/* 
+ * File:    native.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Native host implementations of guest library functions; hosted
+ * implementation.
+ *
+ * mips_native_bind looks up a GLOBAL function of the loaded ELF by name and
+ * overwrites its first instruction with a SYSCALL whose code field is
+ * MIPS_NATIVE_SYSCALL plus the index of the native routine.  When the CPU
+ * stops at it, mips_native_call performs the routine on the o32 argument
+ * registers $a0-$a3 (64-bit values in pairs, low word first), puts the result
+ * into $v0 (and $v1) and returns to $ra as if the guest function had run.
+ * Other instructions pay nothing for the binding, and since it lives in MIPS
+ * memory alone it is carried over to clones and snapshots.
+ *
+ * Routines that correspond to SPIM services (memcpy, malloc, printf, ...)
+ * are performed through mips_spim_service, so they behave exactly like the
+ * services.  The guest function must follow the C semantics of its name; the
+ * binding is not checked against its code.
+ */
+
+#ifndef MIPS_NATIVE_H_
+#define	MIPS_NATIVE_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Base of the codes in SYSCALL instructions that call native routines. */
+#define MIPS_NATIVE_SYSCALL 0x91000
+
+/**
+ * Bind the native routine of the given name to the guest function with the
+ * same name.  Must be called before the function is executed, normally right
+ * after loading.
+ *
+ * @return 0 on success, -1 on failure with errno set to ENOSYS if there is no
+ * native routine of that name, ENOENT if the CPU has no ELF image or the ELF
+ * has no GLOBAL function of that name, or EINVAL if its address is invalid.
+ */
+int mips_native_bind(MIPS_CPU *pcpu, const char *name);
+
+/**
+ * Return the name of the i-th native routine, or NULL if i is past the last
+ * one; used to enumerate them.
+ */
+const char *mips_native_name(unsigned i);
+
+/**
+ * Perform the native routine if the CPU stopped at a SYSCALL placed by
+ * mips_native_bind, and continue the CPU at $ra.
+ *
+ * @return 0 if the routine has been performed, -1 if the CPU did not stop at
+ * a native SYSCALL, or a MIPS_E_* code if the routine faulted (e.g.
+ * MIPS_E_ADDRESS on an invalid pointer, MIPS_E_BREAK on division by zero), in
+ * which case the CPU is left at the SYSCALL.
+ */
+int mips_native_call(MIPS_CPU *pcpu);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_NATIVE_H_ */
@@ -0,0 +1,274 @@
+/* 
+ * File:    numa.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * NUMA placement of CPUs; hosted implementation.  See numa.h for the
+ * overview.  The node topology is read once from sysfs.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "syscalls.h"
+#include "numa.h"
+
+/* From <numaif.h>, which is part of libnuma and may not be installed. */
+#define MPOL_BIND		2
+#define MPOL_MF_MOVE	(1 << 1)
+
+#define SYSFS_NODES "/sys/devices/system/node"
+
+static pthread_once_t Gonce = PTHREAD_ONCE_INIT;
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+static int Gnnodes;						/* highest node id + 1 */
+static cpu_set_t Gnode_cpus[MIPS_NUMA_MAXNODES];
+static int Gpopulated[MIPS_NUMA_MAXNODES];	/* nodes with usable processors */
+static int Gnpopulated;
+static struct mips_numa_stats Gstats[MIPS_NUMA_MAXNODES];
+
+static void init_nodes(void);
+static int parse_list(const char*, cpu_set_t*);
+static int current_node(void);
+static int least_loaded(void);
+
+int mips_numa_nodes(void)
+{
+	pthread_once(&Gonce, init_nodes);
+	return Gnnodes;
+}
+
+int mips_numa_place(MIPS_CPU *pcpu, int node)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	struct mips_hostdata *host = pcpu->host;
+
+	pthread_once(&Gonce, init_nodes);
+	if(!host || ((uintptr_t)pcpu->base % pagesz)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	pthread_mutex_lock(&Glock);
+	if(node == MIPS_NUMA_BALANCE)
+		node = least_loaded();
+	pthread_mutex_unlock(&Glock);
+	if(node == MIPS_NUMA_LOCAL)
+		node = current_node();
+	if((node < 0) || (node >= Gnnodes)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* A node without usable processors (a gap in the node ids, or a node
+	 * outside of the thread's affinity) is only accounted for: neither the
+	 * thread nor the memory is bound.  Likewise, the memory is left unbound
+	 * on a node without memory, which rejects the binding with EINVAL. */
+
+	if((Gnnodes > 1) && CPU_COUNT(&Gnode_cpus[node])
+	   && (sched_setaffinity(0, sizeof(cpu_set_t), &Gnode_cpus[node]) == 0)) {
+		if((mips_numa_bind_memory(pcpu->base, pcpu->memsz, node) < 0)
+		   && (errno != EINVAL))
+			return -1;
+		if(pcpu->icache
+		   && (mips_numa_bind_memory(pcpu->icache, MIPS_ICACHE_SIZE
+									 * sizeof(*pcpu->icache), node) < 0)
+		   && (errno != EINVAL))
+			return -1;
+	}
+
+	pthread_mutex_lock(&Glock);
+	if(host->node >= 0) {
+		--Gstats[host->node].cpus;
+		Gstats[host->node].memsz -= pcpu->memsz;
+	}
+	++Gstats[node].cpus;
+	Gstats[node].memsz += pcpu->memsz;
+	host->node = node;
+	pthread_mutex_unlock(&Glock);
+	return node;
+}
+
+int mips_numa_rebalance(MIPS_CPU *pcpu)
+{
+	int node, target;
+
+	if(!pcpu->host) {
+		errno = EINVAL;
+		return -1;
+	}
+	if((node = pcpu->host->node) < 0)
+		return mips_numa_place(pcpu, MIPS_NUMA_BALANCE);
+
+	pthread_mutex_lock(&Glock);
+	target = least_loaded();
+	if(Gstats[node].cpus < Gstats[target].cpus + 2)
+		target = node;
+	pthread_mutex_unlock(&Glock);
+	return target == node ? node : mips_numa_place(pcpu, target);
+}
+
+void mips_numa_release(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+
+	if(!host || (host->node < 0))
+		return;
+	pthread_mutex_lock(&Glock);
+	--Gstats[host->node].cpus;
+	Gstats[host->node].memsz -= pcpu->memsz;
+	host->node = -1;
+	pthread_mutex_unlock(&Glock);
+}
+
+int mips_numa_bind_memory(void *p, size_t len, int node)
+{
+	unsigned long mask[MIPS_NUMA_MAXNODES / (8 * sizeof(unsigned long))];
+
+	pthread_once(&Gonce, init_nodes);
+	if((node < 0) || (node >= Gnnodes)) {
+		errno = EINVAL;
+		return -1;
+	}
+	if(Gnnodes == 1)
+		return 0;
+	memset(mask, 0, sizeof(mask));
+	mask[node / (8 * sizeof(unsigned long))] |=
+		1UL << (node % (8 * sizeof(unsigned long)));
+	return syscall(SYS_mbind, p, len, MPOL_BIND, mask,
+				   MIPS_NUMA_MAXNODES + 1, MPOL_MF_MOVE) < 0 ? -1 : 0;
+}
+
+int mips_numa_get_stats(struct mips_numa_stats *stats, int n)
+{
+	pthread_once(&Gonce, init_nodes);
+	if(n > Gnnodes)
+		n = Gnnodes;
+	pthread_mutex_lock(&Glock);
+	memcpy(stats, Gstats, n * sizeof(*stats));
+	pthread_mutex_unlock(&Glock);
+	return n;
+}
+
+/**
+ * Read the online nodes and their processors, restricted to those the thread
+ * may run on.  Node ids may be sparse; nodes that are offline or have no
+ * usable processors get empty sets and are left out of Gpopulated.  Without
+ * sysfs (or NUMA support), or when no node has usable processors, there is a
+ * single node with all processors.
+ */
+static void init_nodes(void)
+{
+	cpu_set_t online, allowed;
+	char fname[64];
+	int i, n;
+
+	if(sched_getaffinity(0, sizeof(cpu_set_t), &allowed) < 0)
+		CPU_ZERO(&allowed);
+	if((n = parse_list(SYSFS_NODES "/online", &online)) > 1) {
+		if(n > MIPS_NUMA_MAXNODES)
+			n = MIPS_NUMA_MAXNODES;
+		for(i = 0; i < n; i++) {
+			snprintf(fname, sizeof(fname), SYSFS_NODES "/node%d/cpulist", i);
+			if(!CPU_ISSET(i, &online)
+			   || (parse_list(fname, &Gnode_cpus[i]) < 0))
+				CPU_ZERO(&Gnode_cpus[i]);
+			CPU_AND(&Gnode_cpus[i], &Gnode_cpus[i], &allowed);
+			if(CPU_COUNT(&Gnode_cpus[i]))
+				Gpopulated[Gnpopulated++] = i;
+		}
+		if(Gnpopulated) {
+			Gnnodes = n;
+			return;
+		}
+	}
+
+	Gnnodes = 1;
+	Gnode_cpus[0] = allowed;
+	Gpopulated[0] = 0;
+	Gnpopulated = 1;
+}
+
+/**
+ * Parse a sysfs list such as "0-3,8-11" into a set.  Returns the largest
+ * number in the list plus one, 0 for an empty list, or -1 on error.
+ */
+static int parse_list(const char *fname, cpu_set_t *set)
+{
+	char buf[1024], *p, *end;
+	long lo, hi, max = -1;
+	FILE *f;
+
+	CPU_ZERO(set);
+	if(!(f = fopen(fname, "r")))
+		return -1;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if(!p)
+		return -1;
+
+	while(*p && (*p != '\n')) {
+		lo = hi = strtol(p, &end, 10);
+		if(end == p)
+			return -1;
+		if(*end == '-')
+			hi = strtol(end + 1, &end, 10);
+		for(; (lo <= hi) && (lo < CPU_SETSIZE); lo++)
+			CPU_SET(lo, set);
+		if(hi > max)
+			max = hi;
+		p = (*end == ',') ? end + 1 : end;
+	}
+	return max + 1;
+}
+
+static int current_node(void)
+{
+	unsigned cpu, node;
+
+	if((syscall(SYS_getcpu, &cpu, &node, NULL) < 0) || (node >= (unsigned)Gnnodes))
+		return 0;
+	return node;
+}
+
+/**
+ * Return the node with usable processors that has the fewest CPUs.  Called
+ * with Glock held.
+ */
+static int least_loaded(void)
+{
+	int i, best = Gpopulated[0];
+
+	for(i = 1; i < Gnpopulated; i++)
+		if(Gstats[Gpopulated[i]].cpus < Gstats[best].cpus)
+			best = Gpopulated[i];
+	return best;
+}
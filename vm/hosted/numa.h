@@ -0,0 +1,113 @@
+/* 
+ * File:    numa.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * NUMA placement of CPUs; hosted implementation (Linux only).
+ *
+ * Placing a CPU on a node binds the calling thread, which is expected to be
+ * the one executing the CPU, to the processors of that node, and binds the
+ * CPU's memory to the node's memory, migrating pages already faulted in.
+ * Pages shared with clone images or other CPUs are not migrated.  Placement
+ * is done with raw system calls, so libnuma is not needed; on hosts without
+ * NUMA support every CPU is on node 0 and placement only does bookkeeping.
+ */
+
+#ifndef MIPS_NUMA_H_
+#define	MIPS_NUMA_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Maximum number of NUMA nodes supported. */
+#define MIPS_NUMA_MAXNODES	64
+
+/** Placement: the node of the processor the calling thread runs on. */
+#define MIPS_NUMA_LOCAL		(-1)
+
+/** Placement: the node with the fewest placed CPUs. */
+#define MIPS_NUMA_BALANCE	(-2)
+
+/** Per-node statistics. */
+struct mips_numa_stats {
+	unsigned	cpus;			/**!< CPUs placed on the node. */
+	size_t		memsz;			/**!< Their total memory size. */
+};
+
+/**
+ * Return the number of NUMA node ids, i.e., the highest online node id plus
+ * one (at least 1).  Node ids may be sparse: nodes that are offline or have
+ * no processors the process may run on are never chosen by balancing, and a
+ * CPU placed on such a node explicitly is counted without being bound.  On a
+ * node without memory, only the thread is bound.
+ */
+int mips_numa_nodes(void);
+
+/**
+ * Place a CPU and the calling thread on a node.  A CPU that has already been
+ * placed is moved.
+ *
+ * @param pcpu CPU state with page-aligned memory.
+ * @param node Node number or MIPS_NUMA_LOCAL or MIPS_NUMA_BALANCE.
+ * @return The node chosen, or -1 on failure (errno is set).
+ */
+int mips_numa_place(MIPS_CPU *pcpu, int node);
+
+/**
+ * Rebalance: move a placed CPU (and the calling thread) to the least loaded
+ * node if that has at least two CPUs fewer than the CPU's current node.
+ *
+ * @return The node of the CPU after rebalancing, or -1 on failure.
+ */
+int mips_numa_rebalance(MIPS_CPU *pcpu);
+
+/**
+ * Remove a CPU from the per-node counts.  Called by mips_free_hostdata; the
+ * memory binding stays in effect until the memory is freed.
+ */
+void mips_numa_release(MIPS_CPU *pcpu);
+
+/**
+ * Bind an arbitrary page-aligned host memory area (e.g. a per-CPU store
+ * kept outside of MIPS memory) to a node, migrating its pages.
+ *
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_numa_bind_memory(void *p, size_t len, int node);
+
+/**
+ * Get per-node statistics.
+ *
+ * @param stats  Array receiving the statistics of nodes 0..n-1.
+ * @param n      Array size.
+ * @return Number of nodes filled in.
+ */
+int mips_numa_get_stats(struct mips_numa_stats *stats, int n);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_NUMA_H_ */
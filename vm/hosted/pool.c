@@ -0,0 +1,268 @@
+/* 
+ * File:    pool.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Pool of MIPS memory blocks; hosted implementation.  See pool.h for the
+ * overview.  Free blocks are kept on a list per size class; blocks handed out
+ * are kept on a busy list so that foreign memory can be recognized on
+ * release.  All pool state is protected by a single mutex, which is not held
+ * while blocks are mapped or scrubbed.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "memory.h"
+#include "pool.h"
+
+#define MAXCLASSES 8
+
+struct block {
+	char			*base;
+	unsigned		cls;			/* size class index */
+	int				node;			/* NUMA node that faulted it in */
+	struct block	*next;
+};
+
+struct sizeclass {
+	size_t			size;
+	unsigned		nfree;
+	struct block	*free;
+};
+
+static pthread_mutex_t Glock = PTHREAD_MUTEX_INITIALIZER;
+static struct sizeclass Gclasses[MAXCLASSES];
+static unsigned Gnclasses;
+static unsigned Gmaxfree;
+static unsigned Gflags;
+static struct block *Gbusy;
+static struct mips_pool_stats Gstats;
+
+static struct block *map_block(unsigned);
+static void scrub_block(struct block*);
+static int current_node(void);
+
+int mips_pool_init(const size_t *sizes, unsigned nsizes, unsigned maxfree,
+				   unsigned prefill, unsigned flags)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	unsigned i, j;
+
+	if(Gnclasses || !nsizes || (nsizes > MAXCLASSES)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	/* Insertion sort by size, so that the first fitting class is the
+	 * smallest one. */
+
+	for(i = 0; i < nsizes; i++) {
+		size_t size = (sizes[i] + pagesz - 1) & ~(pagesz - 1);
+
+		for(j = i; j && (Gclasses[j-1].size > size); j--)
+			Gclasses[j] = Gclasses[j-1];
+		Gclasses[j].size = size;
+		Gclasses[j].nfree = 0;
+		Gclasses[j].free = NULL;
+	}
+	Gnclasses = nsizes;
+	Gmaxfree = maxfree;
+	Gflags = flags;
+
+	for(i = 0; i < nsizes; i++) {
+		for(j = 0; (j < prefill) && (j < maxfree); j++) {
+			struct block *b = map_block(i);
+
+			if(!b)
+				return -1;
+			b->next = Gclasses[i].free;
+			Gclasses[i].free = b;
+			++Gclasses[i].nfree;
+		}
+	}
+	return 0;
+}
+
+char *mips_pool_acquire(size_t memsz)
+{
+	struct block *b = NULL, **pb;
+	unsigned cls;
+	int node = -1;
+
+	for(cls = 0; (cls < Gnclasses) && (Gclasses[cls].size < memsz); cls++)
+		;
+	if(cls >= Gnclasses)
+		return NULL;
+
+	pthread_mutex_lock(&Glock);
+	pb = &Gclasses[cls].free;
+	if(*pb && (Gflags & MIPS_POOL_NUMA)) {
+		node = current_node();
+		for(; *pb && ((*pb)->node != node); pb = &(*pb)->next)
+			;
+		if(!*pb) {
+			pb = &Gclasses[cls].free;
+			++Gstats.remote;
+		}
+	}
+	if((b = *pb) != NULL) {
+		*pb = b->next;
+		--Gclasses[cls].nfree;
+		++Gstats.hits;
+	} else {
+		++Gstats.misses;
+	}
+	pthread_mutex_unlock(&Glock);
+
+	if(!b && !(b = map_block(cls)))
+		return NULL;
+
+	pthread_mutex_lock(&Glock);
+	b->next = Gbusy;
+	Gbusy = b;
+	pthread_mutex_unlock(&Glock);
+	return b->base;
+}
+
+int mips_pool_release(char *base)
+{
+	struct block *b, **pb;
+	struct sizeclass *sc;
+	struct timespec t0, t1;
+
+	pthread_mutex_lock(&Glock);
+	for(pb = &Gbusy; *pb && ((*pb)->base != base); pb = &(*pb)->next)
+		;
+	if(!(b = *pb)) {
+		pthread_mutex_unlock(&Glock);
+		return -1;
+	}
+	*pb = b->next;
+	sc = &Gclasses[b->cls];
+	if(sc->nfree >= Gmaxfree) {
+		pthread_mutex_unlock(&Glock);
+		munmap(b->base, sc->size);
+		free(b);
+		return 0;
+	}
+	pthread_mutex_unlock(&Glock);
+
+	clock_gettime(CLOCK_MONOTONIC, &t0);
+	scrub_block(b);
+	clock_gettime(CLOCK_MONOTONIC, &t1);
+
+	pthread_mutex_lock(&Glock);
+	b->next = sc->free;
+	sc->free = b;
+	++sc->nfree;
+	++Gstats.releases;
+	Gstats.scrub_ns += (t1.tv_sec - t0.tv_sec) * 1000000000ULL
+		+ t1.tv_nsec - t0.tv_nsec;
+	pthread_mutex_unlock(&Glock);
+	return 0;
+}
+
+void mips_pool_get_stats(struct mips_pool_stats *stats)
+{
+	pthread_mutex_lock(&Glock);
+	*stats = Gstats;
+	pthread_mutex_unlock(&Glock);
+}
+
+/** Map and pre-fault a new block of the given class. */
+static struct block *map_block(unsigned cls)
+{
+	struct block *b = malloc(sizeof(*b));
+
+	if(!b)
+		return NULL;
+	b->base = mmap(NULL, Gclasses[cls].size, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE, -1, 0);
+	if(b->base == MAP_FAILED) {
+		free(b);
+		return NULL;
+	}
+	b->cls = cls;
+	b->node = current_node();
+	return b;
+}
+
+/**
+ * Zero a released block.  If all its pages are still private, only the
+ * non-zero pages are cleared.  Otherwise, some pages have been replaced by
+ * file mappings (or were never faulted in), and the whole block is mapped
+ * afresh and pre-faulted.
+ */
+static void scrub_block(struct block *b)
+{
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t size = Gclasses[b->cls].size;
+	size_t npages = size / pagesz;
+	size_t scrubbed = 0, i;
+	unsigned char *state = malloc(npages);
+
+	if(state && (mips_page_state(b->base, npages, state) == 0)) {
+		for(i = 0; (i < npages) && (state[i] & MIPS_PAGE_PRIVATE); i++)
+			;
+	} else {
+		i = 0;
+	}
+
+	if(i == npages) {
+		for(i = 0; i < npages; i++) {
+			char *page = b->base + i * pagesz;
+
+			if(!mips_is_zero(page, pagesz)) {
+				memset(page, 0, pagesz);
+				scrubbed += pagesz;
+			}
+		}
+	} else {
+		mmap(b->base, size, PROT_READ | PROT_WRITE,
+			 MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_POPULATE, -1, 0);
+		b->node = current_node();
+		scrubbed = size;
+	}
+	free(state);
+
+	pthread_mutex_lock(&Glock);
+	Gstats.scrubbed += scrubbed;
+	pthread_mutex_unlock(&Glock);
+}
+
+/** Return the NUMA node of the CPU the calling thread runs on. */
+static int current_node(void)
+{
+	unsigned cpu, node;
+
+	return getcpu(&cpu, &node) < 0 ? 0 : (int)node;
+}
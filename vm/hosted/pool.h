@@ -0,0 +1,104 @@
+/* 
+ * File:    pool.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Pool of MIPS memory blocks for hosts that run many short-lived CPUs;
+ * hosted implementation (Linux only).
+ *
+ * Once the pool is initialized, mips_alloc_memory takes blocks from it and
+ * mips_free_memory returns them.  Blocks come in a few size classes (a
+ * request is served from the smallest class that fits) and are pre-faulted,
+ * so a recycled block incurs neither page faults nor zeroing by the OS.
+ * Instead, a released block is scrubbed: pages that are not zero are cleared,
+ * and a block whose pages have been replaced by other mappings (clone images,
+ * shared pages) is mapped afresh.
+ *
+ * With MIPS_POOL_NUMA, each block remembers the NUMA node of the thread that
+ * faulted it in, and a thread acquiring a block prefers one from its own
+ * node.
+ */
+
+#ifndef MIPS_POOL_H_
+#define	MIPS_POOL_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Pool flag: prefer blocks local to the NUMA node of the acquiring thread. */
+#define MIPS_POOL_NUMA	1
+
+/** Pool statistics. */
+struct mips_pool_stats {
+	size_t				hits;		/**!< Acquisitions served from the pool. */
+	size_t				misses;		/**!< Acquisitions that had to map a block. */
+	size_t				remote;		/**!< Hits on a block from another node. */
+	size_t				releases;	/**!< Blocks returned to the pool. */
+	size_t				scrubbed;	/**!< Bytes cleared while scrubbing. */
+	unsigned long long	scrub_ns;	/**!< Total time spent scrubbing. */
+};
+
+/**
+ * Initialize the pool.  May be called only once.
+ *
+ * @param sizes    Block sizes (size classes); typically the memsz values used
+ *                 by the host, e.g. 2MB and 16MB.
+ * @param nsizes   Number of size classes (at most 8).
+ * @param maxfree  Maximum number of free blocks kept per class; blocks
+ *                 released beyond that are unmapped.
+ * @param prefill  Number of blocks per class to allocate immediately.
+ * @param flags    MIPS_POOL_* flags.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_pool_init(const size_t *sizes, unsigned nsizes, unsigned maxfree,
+				   unsigned prefill, unsigned flags);
+
+/**
+ * Acquire a zero-filled, page-aligned block of at least memsz bytes.  This is
+ * called by mips_alloc_memory.
+ *
+ * @return Pointer to the block, or NULL if the pool is not initialized, no
+ * class is large enough, or the allocation fails.
+ */
+char *mips_pool_acquire(size_t memsz);
+
+/**
+ * Scrub a block and return it to the pool.  This is called by
+ * mips_free_memory.  The block is identified by its base address; its size is
+ * that of its class.
+ *
+ * @return 0 on success, or -1 if the block does not belong to the pool (the
+ * caller must then free it by other means).
+ */
+int mips_pool_release(char *base);
+
+/** Get pool statistics. */
+void mips_pool_get_stats(struct mips_pool_stats *stats);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_POOL_H_ */
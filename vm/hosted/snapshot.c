@@ -0,0 +1,634 @@
+/* 
+ * File:    snapshot.c
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Snapshots of a loaded CPU and its memory; hosted implementation.  The file
+ * layout is described in snapshot.h.  Only POSIX hosts are supported since
+ * loading depends on mmap.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "../cpu.h"
+#include "compress.h"
+#include "memory.h"
+#include "snapshot.h"
+
+/** Checkpointing state of a CPU. */
+struct mips_checkpoint {
+	MIPS_CPU		*pcpu;				/**!< Checkpointed CPU. */
+	char			*name;				/**!< File name prefix. */
+	uint32_t		chain;				/**!< Chain identifier. */
+	uint32_t		seq;				/**!< Last delta written. */
+	uint32_t		base_seq;			/**!< Last delta merged into the base. */
+	unsigned		maxchain;			/**!< Compaction threshold. */
+	uint32_t		compact_seq;		/**!< Target of running compaction. */
+	int				compacting;			/**!< Compaction thread not joined. */
+	int				compact_done;		/**!< Compaction thread finished. */
+	pthread_t		compactor;			/**!< Compaction thread. */
+	pthread_mutex_t	lock;				/**!< Protects base_seq, compact_done. */
+};
+
+static int write_snapshot(MIPS_CPU*, const char*, uint32_t, uint32_t);
+static int write_delta(struct mips_checkpoint*, const char*, uint32_t*, size_t);
+static int apply_delta(MIPS_CPU*, const char*, uint32_t, uint32_t);
+static MIPS_CPU *load_chain(const char*, uint32_t, uint32_t*, uint32_t*);
+static void *compact(void*);
+static void join_compactor(struct mips_checkpoint*, int);
+static int file_name(char*, const char*, const char*, uint32_t);
+static int write_all(int, const void*, size_t, off_t);
+static int read_all(int, void*, size_t, off_t);
+static size_t page_round(size_t, size_t);
+
+int mips_snapshot_save(MIPS_CPU *pcpu, const char *fname)
+{
+	return write_snapshot(pcpu, fname, 0, 0);
+}
+
+/** Write a snapshot recording the checkpoint chain and sequence number. */
+static int write_snapshot(MIPS_CPU *pcpu, const char *fname, uint32_t seq,
+	uint32_t chain)
+{
+	struct mips_snapshot_header hdr;
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	size_t off;
+	int fd;
+
+	if(((char*)pcpu != pcpu->base) || !pcpu->elf || !pcpu->shsymtab) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MIPS_SNAPSHOT_MAGIC, sizeof(hdr.magic));
+	hdr.version  = MIPS_SNAPSHOT_VERSION;
+	hdr.pagesz   = pagesz;
+	hdr.cpusz    = sizeof(MIPS_CPU);
+	hdr.seq      = seq;
+	hdr.chain    = chain;
+	hdr.memsz    = pcpu->memsz;
+	hdr.stksz    = pcpu->stksz;
+	hdr.elfoff   = page_round(sizeof(hdr), pagesz);
+	hdr.elfsz    = pcpu->elfsz;
+	hdr.memoff   = hdr.elfoff + page_round(pcpu->elfsz, pagesz);
+	hdr.shsymtab = (const char*)pcpu->shsymtab - pcpu->elf;
+	hdr.shsymstr = (const char*)pcpu->shsymstr - pcpu->elf;
+
+	if((fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
+
+	/* Compressed pages are inaccessible, and pwrite from them fails with
+	 * EFAULT instead of paging them in. */
+
+	mips_compress_expand(pcpu);
+
+	/* Write only non-zero pages; the rest stays as a hole in the file.  Page
+	 * 0 always contains the control state and is never skipped. */
+
+	for(off = 0; off < pcpu->memsz; off += pagesz) {
+		size_t n = pcpu->memsz - off < pagesz ? pcpu->memsz - off : pagesz;
+
+		if(off && mips_is_zero(pcpu->base + off, n))
+			continue;
+		if(write_all(fd, pcpu->base + off, n, hdr.memoff + off) < 0)
+			goto fail;
+		++hdr.npages;
+	}
+
+	if((write_all(fd, pcpu->elf, pcpu->elfsz, hdr.elfoff) < 0)
+	   || (ftruncate(fd, hdr.memoff + hdr.memsz) < 0)
+	   || (write_all(fd, &hdr, sizeof(hdr), 0) < 0))
+		goto fail;
+	return close(fd);
+
+fail:
+	close(fd);
+	return -1;
+}
+
+MIPS_CPU *mips_snapshot_load(const char *fname)
+{
+	struct mips_snapshot_header hdr;
+	size_t pagesz = sysconf(_SC_PAGESIZE);
+	struct stat st;
+	MIPS_CPU *pcpu;
+	char *elf, *base;
+	int fd, i;
+
+	if((fd = open(fname, O_RDONLY)) < 0)
+		return NULL;
+	if((fstat(fd, &st) < 0)
+	   || (pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr)))
+		goto fail;
+
+	errno = EINVAL;
+	if(memcmp(hdr.magic, MIPS_SNAPSHOT_MAGIC, sizeof(hdr.magic))
+	   || (hdr.version != MIPS_SNAPSHOT_VERSION)
+	   || (hdr.cpusz != sizeof(MIPS_CPU))
+	   || (hdr.elfoff % pagesz) || (hdr.memoff % pagesz)
+	   || (hdr.memsz < MIPS_LOWBASE) || (hdr.stksz >= hdr.memsz)
+	   || (hdr.elfoff + hdr.elfsz > hdr.memoff)
+	   || (hdr.memoff + hdr.memsz > (uint64_t)st.st_size)
+	   || (hdr.shsymtab + sizeof(Elf32_Shdr) > hdr.elfsz)
+	   || (hdr.shsymstr + sizeof(Elf32_Shdr) > hdr.elfsz))
+		goto fail;
+
+	elf = mmap(NULL, hdr.elfsz, PROT_READ, MAP_PRIVATE, fd, hdr.elfoff);
+	if(elf == MAP_FAILED)
+		goto fail;
+	base = mmap(NULL, hdr.memsz, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+				fd, hdr.memoff);
+	if(base == MAP_FAILED) {
+		munmap(elf, hdr.elfsz);
+		goto fail;
+	}
+	close(fd);
+
+	/* Re-bind host pointers. */
+
+	pcpu = (MIPS_CPU*)base;
+	pcpu->base     = base;
+	pcpu->memsz    = hdr.memsz;
+	pcpu->stksz    = hdr.stksz;
+	pcpu->elf      = elf;
+	pcpu->elfsz    = hdr.elfsz;
+	pcpu->shsymtab = (Elf32_Shdr*)(elf + hdr.shsymtab);
+	pcpu->shsymstr = (Elf32_Shdr*)(elf + hdr.shsymstr);
+	pcpu->peek_uw  = mips_identity_peek_uw;
+	pcpu->poke_uw  = mips_identity_poke_uw;
+	pcpu->peek_block = mips_identity_peek_block;
+	pcpu->poke_block = mips_identity_poke_block;
+	pcpu->xform    = NULL;
+
+	for(i = 3; i < MIPS_MAXFDS; i++)
+		pcpu->fds[i] = -1;
+
+	mips_init_hostdata(pcpu);
+	return pcpu;
+
+fail:
+	i = errno;
+	close(fd);
+	errno = i;
+	return NULL;
+}
+
+void mips_snapshot_unload(MIPS_CPU *pcpu)
+{
+	mips_free_hostdata(pcpu);
+	munmap((void*)pcpu->elf, pcpu->elfsz);
+	munmap(pcpu->base, pcpu->memsz);
+}
+
+struct mips_checkpoint *mips_checkpoint_begin(MIPS_CPU *pcpu,
+	const char *name, unsigned maxchain)
+{
+	size_t nwords = ((pcpu->memsz >> MIPS_PAGESHIFT) + 32) / 32;
+	struct mips_checkpoint *ck;
+	char fname[PATH_MAX], tmp[PATH_MAX];
+	struct timespec ts;
+	int err;
+
+	if(pcpu->dirty) {
+		errno = EBUSY;
+		return NULL;
+	}
+	if((file_name(fname, name, ".base", 0) < 0)
+	   || (file_name(tmp, name, ".base.tmp", 0) < 0))
+		return NULL;
+	if(!(ck = calloc(1, sizeof(*ck))) || !(ck->name = strdup(name))) {
+		free(ck);
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	/* The chain identifier only has to differ from that of a previous run
+	 * using the same name. */
+
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ck->chain = ((uint32_t)ts.tv_sec * 1000003U) ^ (uint32_t)ts.tv_nsec
+		^ ((uint32_t)getpid() << 16);
+	if(!ck->chain)
+		ck->chain = 1;
+	ck->pcpu = pcpu;
+	ck->maxchain = maxchain;
+	pthread_mutex_init(&ck->lock, NULL);
+
+	if((write_snapshot(pcpu, tmp, 0, ck->chain) < 0)
+	   || (rename(tmp, fname) < 0))
+		goto fail;
+	if(!(pcpu->dirty = calloc(nwords, sizeof(mips_uword)))) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	return ck;
+
+fail:
+	err = errno;
+	unlink(tmp);
+	pthread_mutex_destroy(&ck->lock);
+	free(ck->name);
+	free(ck);
+	errno = err;
+	return NULL;
+}
+
+int mips_checkpoint(struct mips_checkpoint *ck)
+{
+	MIPS_CPU *pcpu = ck->pcpu;
+	size_t npages = (pcpu->memsz + (1U << MIPS_PAGESHIFT) - 1) >> MIPS_PAGESHIFT;
+	mips_uword *dirty = pcpu->dirty;
+	char fname[PATH_MAX], tmp[PATH_MAX];
+	uint32_t *index, base_seq;
+	size_t i, n = 0;
+	int err;
+
+	/* Page 0 holds the register file, which is modified without going
+	 * through poke, so it is always included. */
+
+	dirty[0] |= 1;
+	for(i = 0; i < npages; i++)
+		if(dirty[i >> 5] & (1U << (i & 31)))
+			++n;
+	if(!(index = malloc(n * sizeof(*index)))) {
+		errno = ENOMEM;
+		return -1;
+	}
+	for(i = 0, n = 0; i < npages; i++)
+		if(dirty[i >> 5] & (1U << (i & 31)))
+			index[n++] = i;
+
+	mips_compress_expand(pcpu);
+	if((file_name(fname, ck->name, ".", ck->seq + 1) < 0)
+	   || (file_name(tmp, ck->name, ".tmp.", ck->seq + 1) < 0)
+	   || (write_delta(ck, tmp, index, n) < 0)
+	   || (rename(tmp, fname) < 0)) {
+		err = errno;
+		unlink(tmp);
+		free(index);
+		errno = err;
+		return -1;
+	}
+	free(index);
+	memset(dirty, 0, ((npages + 32) / 32) * sizeof(mips_uword));
+	++ck->seq;
+
+	/* Merge the chain into the base once it gets too long.  Only one
+	 * compaction runs at a time; if one is still busy, the next checkpoint
+	 * tries again. */
+
+	if(!ck->maxchain)
+		return n;
+	join_compactor(ck, 0);
+	pthread_mutex_lock(&ck->lock);
+	base_seq = ck->base_seq;
+	pthread_mutex_unlock(&ck->lock);
+	if(!ck->compacting && (ck->seq - base_seq >= ck->maxchain)) {
+		ck->compact_seq = ck->seq;
+		ck->compact_done = 0;
+		if(pthread_create(&ck->compactor, NULL, compact, ck) == 0)
+			ck->compacting = 1;
+	}
+	return n;
+}
+
+void mips_checkpoint_end(struct mips_checkpoint *ck)
+{
+	join_compactor(ck, 1);
+	free(ck->pcpu->dirty);
+	ck->pcpu->dirty = NULL;
+	pthread_mutex_destroy(&ck->lock);
+	free(ck->name);
+	free(ck);
+}
+
+MIPS_CPU *mips_checkpoint_restore(const char *name)
+{
+	return load_chain(name, UINT32_MAX, NULL, NULL);
+}
+
+/** Write the delta file with the listed pages. */
+static int write_delta(struct mips_checkpoint *ck, const char *fname,
+	uint32_t *index, size_t n)
+{
+	MIPS_CPU *pcpu = ck->pcpu;
+	struct mips_delta_header hdr;
+	size_t i, j, len, off;
+	int fd, err;
+
+	memset(&hdr, 0, sizeof(hdr));
+	memcpy(hdr.magic, MIPS_DELTA_MAGIC, sizeof(hdr.magic));
+	hdr.version   = MIPS_SNAPSHOT_VERSION;
+	hdr.chain     = ck->chain;
+	hdr.seq       = ck->seq + 1;
+	hdr.pageshift = MIPS_PAGESHIFT;
+	hdr.npages    = n;
+	hdr.cpusz     = sizeof(MIPS_CPU);
+	hdr.memsz     = pcpu->memsz;
+
+	if((fd = open(fname, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+		return -1;
+	if((write_all(fd, &hdr, sizeof(hdr), 0) < 0)
+	   || (write_all(fd, index, n * sizeof(*index), sizeof(hdr)) < 0))
+		goto fail;
+
+	/* Consecutive pages are contiguous both in memory and in the file, so
+	 * each run is written with a single call. */
+
+	off = sizeof(hdr) + n * sizeof(*index);
+	for(i = 0; i < n; i = j) {
+		for(j = i + 1; (j < n) && (index[j] == index[j-1] + 1); j++)
+			;
+		len = (size_t)(j - i) << MIPS_PAGESHIFT;
+		if(((size_t)index[i] << MIPS_PAGESHIFT) + len > pcpu->memsz)
+			len = pcpu->memsz - ((size_t)index[i] << MIPS_PAGESHIFT);
+		if(write_all(fd, pcpu->base + ((size_t)index[i] << MIPS_PAGESHIFT),
+					 len, off) < 0)
+			goto fail;
+		off += len;
+	}
+	if(fdatasync(fd) < 0)
+		goto fail;
+	return close(fd);
+
+fail:
+	err = errno;
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+/**
+ * Apply a delta file to a restored CPU.  Fails with ENOENT if the file does
+ * not exist or belongs to a different chain or position in it.
+ */
+static int apply_delta(MIPS_CPU *pcpu, const char *fname, uint32_t chain,
+	uint32_t seq)
+{
+	struct mips_delta_header hdr;
+	uint32_t *index = NULL;
+	size_t i, len, off;
+	MIPS_CPU saved;
+	int fd, err;
+
+	if((fd = open(fname, O_RDONLY)) < 0)
+		return -1;
+	if(read_all(fd, &hdr, sizeof(hdr), 0) < 0)
+		goto fail;
+	if(memcmp(hdr.magic, MIPS_DELTA_MAGIC, sizeof(hdr.magic))
+	   || (hdr.version != MIPS_SNAPSHOT_VERSION)
+	   || (hdr.chain != chain) || (hdr.seq != seq)) {
+		errno = ENOENT;
+		goto fail;
+	}
+	if((hdr.pageshift != MIPS_PAGESHIFT) || (hdr.cpusz != sizeof(MIPS_CPU))
+	   || (hdr.memsz != pcpu->memsz)
+	   || (hdr.npages > (pcpu->memsz >> MIPS_PAGESHIFT) + 1)) {
+		errno = EINVAL;
+		goto fail;
+	}
+	if(!(index = malloc(hdr.npages * sizeof(*index) + 1))) {
+		errno = ENOMEM;
+		goto fail;
+	}
+	if(read_all(fd, index, hdr.npages * sizeof(*index), sizeof(hdr)) < 0)
+		goto fail;
+
+	/* Page 0 brings the guest registers but also the writer's host pointers,
+	 * so everything below goes through the saved copy of the latter. */
+
+	saved = *pcpu;
+	off = sizeof(hdr) + hdr.npages * sizeof(*index);
+	for(i = 0; i < hdr.npages; i++, off += len) {
+		size_t addr = (size_t)index[i] << MIPS_PAGESHIFT;
+
+		if(addr >= saved.memsz) {
+			errno = EINVAL;
+			break;
+		}
+		len = saved.memsz - addr < (1U << MIPS_PAGESHIFT) ?
+			saved.memsz - addr : (1U << MIPS_PAGESHIFT);
+		if(read_all(fd, saved.base + addr, len, off) < 0)
+			break;
+	}
+	if(i < hdr.npages) {
+		*pcpu = saved;
+		goto fail;
+	}
+	saved.r          = pcpu->r;
+	saved.hi         = pcpu->hi;
+	saved.lo         = pcpu->lo;
+	saved.pc         = pcpu->pc;
+	saved.delay_slot = pcpu->delay_slot;
+	saved.brk        = pcpu->brk;
+	*pcpu = saved;
+
+	free(index);
+	return close(fd);
+
+fail:
+	err = errno;
+	free(index);
+	close(fd);
+	errno = err;
+	return -1;
+}
+
+/**
+ * Load the base snapshot and apply deltas up to and including limit.  The
+ * chain identifier and the sequence number of the last applied delta are
+ * stored to pchain and pseq if they are not NULL.
+ */
+static MIPS_CPU *load_chain(const char *name, uint32_t limit,
+	uint32_t *pchain, uint32_t *pseq)
+{
+	struct mips_snapshot_header hdr;
+	char fname[PATH_MAX];
+	MIPS_CPU *pcpu;
+	uint32_t seq;
+	int fd, err;
+
+	if(file_name(fname, name, ".base", 0) < 0)
+		return NULL;
+	if((fd = open(fname, O_RDONLY)) < 0)
+		return NULL;
+	err = read_all(fd, &hdr, sizeof(hdr), 0);
+	close(fd);
+	if(err < 0)
+		return NULL;
+	if(!(pcpu = mips_snapshot_load(fname)))
+		return NULL;
+
+	for(seq = hdr.seq + 1; hdr.chain && (seq <= limit); seq++) {
+		if(file_name(fname, name, ".", seq) < 0)
+			goto fail;
+		if(apply_delta(pcpu, fname, hdr.chain, seq) < 0) {
+			if(errno == ENOENT)
+				break;
+			goto fail;
+		}
+	}
+	if(pchain)
+		*pchain = hdr.chain;
+	if(pseq)
+		*pseq = seq - 1;
+	return pcpu;
+
+fail:
+	err = errno;
+	mips_snapshot_unload(pcpu);
+	errno = err;
+	return NULL;
+}
+
+/**
+ * Compaction thread: merge the deltas up to compact_seq into a new base
+ * snapshot and delete them.  Works entirely on files, so the checkpointed CPU
+ * keeps running meanwhile.
+ */
+static void *compact(void *arg)
+{
+	struct mips_checkpoint *ck = arg;
+	char fname[PATH_MAX], tmp[PATH_MAX];
+	uint32_t seq, chain, old_seq;
+	MIPS_CPU *pcpu;
+
+	pthread_mutex_lock(&ck->lock);
+	old_seq = ck->base_seq;
+	pthread_mutex_unlock(&ck->lock);
+
+	if((file_name(fname, ck->name, ".base", 0) < 0)
+	   || (file_name(tmp, ck->name, ".base.tmp", 0) < 0)
+	   || !(pcpu = load_chain(ck->name, ck->compact_seq, &chain, &seq)))
+		goto done;
+	if((chain != ck->chain) || (write_snapshot(pcpu, tmp, seq, chain) < 0)
+	   || (rename(tmp, fname) < 0)) {
+		unlink(tmp);
+		mips_snapshot_unload(pcpu);
+		goto done;
+	}
+	mips_snapshot_unload(pcpu);
+
+	pthread_mutex_lock(&ck->lock);
+	ck->base_seq = seq;
+	pthread_mutex_unlock(&ck->lock);
+
+	for(++old_seq; old_seq <= seq; old_seq++)
+		if(file_name(fname, ck->name, ".", old_seq) == 0)
+			unlink(fname);
+
+done:
+	pthread_mutex_lock(&ck->lock);
+	ck->compact_done = 1;
+	pthread_mutex_unlock(&ck->lock);
+	return NULL;
+}
+
+/** Join the compaction thread if it has finished or if wait is set. */
+static void join_compactor(struct mips_checkpoint *ck, int wait)
+{
+	int done;
+
+	if(!ck->compacting)
+		return;
+	pthread_mutex_lock(&ck->lock);
+	done = ck->compact_done;
+	pthread_mutex_unlock(&ck->lock);
+	if(done || wait) {
+		pthread_join(ck->compactor, NULL);
+		ck->compacting = 0;
+	}
+}
+
+/** Build NAME + suffix [+ seq] into a PATH_MAX buffer. */
+static int file_name(char *buf, const char *name, const char *suffix,
+	uint32_t seq)
+{
+	int n;
+
+	if(seq)
+		n = snprintf(buf, PATH_MAX, "%s%s%u", name, suffix, seq);
+	else
+		n = snprintf(buf, PATH_MAX, "%s%s", name, suffix);
+	if((n < 0) || (n >= PATH_MAX)) {
+		errno = ENAMETOOLONG;
+		return -1;
+	}
+	return 0;
+}
+
+/** Read the whole buffer from the given offset; EINVAL on premature EOF. */
+static int read_all(int fd, void *buf, size_t n, off_t off)
+{
+	char *p = buf;
+	ssize_t r;
+
+	while(n) {
+		if((r = pread(fd, p, n, off)) < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		if(r == 0) {
+			errno = EINVAL;
+			return -1;
+		}
+		p += r; off += r; n -= r;
+	}
+	return 0;
+}
+
+/** Write the whole buffer at the given offset, retrying short writes. */
+static int write_all(int fd, const void *buf, size_t n, off_t off)
+{
+	const char *p = buf;
+	ssize_t w;
+
+	while(n) {
+		if((w = pwrite(fd, p, n, off)) < 0) {
+			if(errno == EINTR)
+				continue;
+			return -1;
+		}
+		p += w; off += w; n -= w;
+	}
+	return 0;
+}
+
+/** Round n up to a multiple of pagesz (a power of 2). */
+static size_t page_round(size_t n, size_t pagesz)
+{
+	return (n + pagesz - 1) & ~(pagesz - 1);
+}
@@ -0,0 +1,197 @@
+/* 
+ * File:    snapshot.h
+ * Created: 2026-10-19
+ *
+ * ===========================================================================
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT.  IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ * ===========================================================================
+ */
+/**
+ * @file
+ * Snapshots of a loaded CPU and its memory; hosted implementation.
+ *
+ * A snapshot file has the following layout (all offsets are multiples of the
+ * page size at the time the snapshot was written):
+ *
+ * +---------------+ 0
+ * | header        | struct mips_snapshot_header
+ * +---------------+ elfoff
+ * | ELF image     | needed for symbol lookup
+ * +---------------+ memoff
+ * | MIPS memory   | memsz bytes; pages containing only 0s are not written,
+ * |               | so the file is sparse.  The control state (MIPS_CPU) is
+ * |               | at the start of this area, just as in the live memory.
+ * +---------------+ memoff + memsz
+ *
+ * Because the memory image is page-aligned, it is mapped MAP_PRIVATE on load
+ * and the program may start executing immediately: only the pages that are
+ * actually accessed are read from the file, and modifications never reach it.
+ * Host pointers stored in the CPU state (base, elf, shsymtab, shsymstr) are
+ * saved as offsets and re-bound on load.
+ *
+ * Incremental checkpoints consist of a base snapshot NAME.base followed by a
+ * chain of delta files NAME.1, NAME.2, ... Each delta holds only the pages
+ * (of 1 << MIPS_PAGESHIFT bytes) modified since the previous checkpoint plus
+ * page 0 with the register file:
+ *
+ * +---------------+ 0
+ * | header        | struct mips_delta_header
+ * +---------------+ sizeof(header)
+ * | page indices  | npages x uint32_t, ascending
+ * +---------------+
+ * | page contents | npages pages in the same order
+ * +---------------+
+ *
+ * The seq field of the base snapshot tells which deltas are already merged
+ * into it; restoring applies deltas seq+1, seq+2, ... until the first missing
+ * one or one belonging to a different chain (left over from an earlier run
+ * with the same name).  Every file is written under a temporary name and renamed into place,
+ * so an interrupted checkpoint or compaction leaves the previous chain
+ * intact.
+ */
+
+#ifndef MIPS_SNAPSHOT_H_
+#define	MIPS_SNAPSHOT_H_
+
+#ifdef	__cplusplus
+extern "C" {
+#endif
+
+/** Snapshot file magic. */
+#define MIPS_SNAPSHOT_MAGIC		"CSPIMSNP"
+
+/** Snapshot format version; incremented on every incompatible change. */
+#define MIPS_SNAPSHOT_VERSION	2
+
+/** Snapshot file header.  Stored in host byte order. */
+struct mips_snapshot_header {
+	char		magic[8];			/**!< MIPS_SNAPSHOT_MAGIC. */
+	uint32_t	version;			/**!< MIPS_SNAPSHOT_VERSION. */
+	uint32_t	pagesz;				/**!< Page size used for the layout. */
+	uint32_t	cpusz;				/**!< sizeof(MIPS_CPU) of the writer. */
+	uint32_t	npages;				/**!< Number of non-zero pages written. */
+	uint32_t	seq;				/**!< Last checkpoint delta merged in. */
+	uint32_t	chain;				/**!< Checkpoint chain identifier, or 0. */
+	uint64_t	memsz;				/**!< Total MIPS memory size. */
+	uint64_t	stksz;				/**!< Size reserved for stack. */
+	uint64_t	elfoff;				/**!< File offset of the ELF image. */
+	uint64_t	elfsz;				/**!< Size of the ELF image. */
+	uint64_t	memoff;				/**!< File offset of the memory image. */
+	uint64_t	shsymtab;			/**!< Symbol table header (ELF offset). */
+	uint64_t	shsymstr;			/**!< String table header (ELF offset). */
+};
+
+/**
+ * Write the complete state of a loaded CPU to a file.  The CPU must have been
+ * prepared with mips_elf_load.  Memory is written verbatim, so a snapshot of
+ * a program running with transformed memory (e.g. encrypted) stays
+ * transformed; the transformation itself is not saved.
+ *
+ * @param pcpu  CPU state.
+ * @param fname Name of the file to (over)write.
+ * @return 0 on success, -1 on failure (errno is set).
+ */
+int mips_snapshot_save(MIPS_CPU *pcpu, const char *fname);
+
+/**
+ * Map a snapshot file and return the CPU state contained in it.  The memory
+ * is mapped copy-on-write, so the snapshot file is never modified.  Memory
+ * access functions are reset to identity and must be set again by the caller
+ * if the snapshot has been made with transformed memory.  Guest file
+ * descriptors other than 0, 1 and 2 cannot be carried over between processes
+ * and are marked as closed.
+ *
+ * @param fname Name of the snapshot file.
+ * @return Pointer to the CPU state, or NULL on failure (invalid, truncated
+ * or incompatible file; errno is set).
+ */
+MIPS_CPU *mips_snapshot_load(const char *fname);
+
+/**
+ * Unmap a snapshot previously loaded by mips_snapshot_load.  The CPU state
+ * must not be used afterwards.
+ */
+void mips_snapshot_unload(MIPS_CPU *pcpu);
+
+/** Checkpoint delta file magic. */
+#define MIPS_DELTA_MAGIC		"CSPIMDLT"
+
+/** Checkpoint delta file header.  Stored in host byte order. */
+struct mips_delta_header {
+	char		magic[8];			/**!< MIPS_DELTA_MAGIC. */
+	uint32_t	version;			/**!< MIPS_SNAPSHOT_VERSION. */
+	uint32_t	chain;				/**!< Same as in the base snapshot. */
+	uint32_t	seq;				/**!< Sequence number, starting at 1. */
+	uint32_t	pageshift;			/**!< MIPS_PAGESHIFT of the writer. */
+	uint32_t	npages;				/**!< Number of pages in the delta. */
+	uint32_t	cpusz;				/**!< sizeof(MIPS_CPU) of the writer. */
+	uint64_t	memsz;				/**!< Total MIPS memory size. */
+};
+
+/** Opaque checkpointing state of a single CPU. */
+struct mips_checkpoint;
+
+/**
+ * Start incremental checkpointing of a CPU: write the base snapshot NAME.base
+ * and start tracking modified pages.  Existing checkpoint files with the same
+ * name are superseded.  Page tracking uses the dirty bitmap of the CPU, so
+ * checkpointing cannot be combined with mips_set_baseline on the same CPU.
+ *
+ * @param pcpu     CPU state; prepared with mips_elf_load or restored.
+ * @param name     File name prefix of the checkpoint chain.
+ * @param maxchain Number of deltas after which they are merged into the base
+ * in a background thread; 0 disables compaction.
+ * @return Checkpointing state, or NULL on failure (errno is set; EBUSY if
+ * the CPU already tracks modified pages).
+ */
+struct mips_checkpoint *mips_checkpoint_begin(MIPS_CPU *pcpu,
+	const char *name, unsigned maxchain);
+
+/**
+ * Write a delta with the pages modified since the previous checkpoint.  The
+ * cost is proportional to the number of such pages, not to the memory size.
+ * The CPU must not be executing while this function runs.
+ *
+ * @return Number of pages written, or -1 on failure (errno is set; tracking
+ * continues and the next checkpoint includes the pages again).
+ */
+int mips_checkpoint(struct mips_checkpoint *ck);
+
+/**
+ * Stop checkpointing: wait for a running compaction, stop page tracking and
+ * free the state.  The checkpoint files are left in place.
+ */
+void mips_checkpoint_end(struct mips_checkpoint *ck);
+
+/**
+ * Rebuild the CPU from a checkpoint chain: map the base snapshot and apply
+ * all following deltas in order.  The result has the same properties as the
+ * one returned by mips_snapshot_load, and must be released with
+ * mips_snapshot_unload.
+ *
+ * @param name File name prefix given to mips_checkpoint_begin.
+ * @return Pointer to the CPU state, or NULL on failure (errno is set).
+ */
+MIPS_CPU *mips_checkpoint_restore(const char *name);
+
+#ifdef	__cplusplus
+}
+#endif
+
+#endif	/* MIPS_SNAPSHOT_H_ */
@@ -50,6 +50,54 @@
  * Some additional system services, not found in SPIM, are implemented:
  * - 02: unsigned lseek(int fd, unsigned offset, int whence);
  * - 03: unsigned long long gettime(); [in nanoseconds]
+ * - 17: void *mmap(void *addr, unsigned len, int flags, int fd);
+ *   [maps the file from its current offset; flags: 0 = copy-on-write,
+ *   1 = shared; returns addr or (void*)-1; see mips_map_file]
+ * - 18: int read_input(void *buf, unsigned len, int mode);
+ *   [reads up to len bytes of buffered stdin: mode 0 = a line including the
+ *   newline, 1 = what is buffered (waiting only if nothing is); no NUL is
+ *   appended; returns the number of bytes, 0 at end of file]
+ * - 19: int ring_kick(struct spim_ring *ring);
+ *   [performs the requests queued in the ring (see below); returns their
+ *   number, or -1 if the ring header is invalid]
+ * - 20: int time_map(unsigned long long *page);
+ *   [makes the host store the gettime value at page (8 bytes, word-aligned)
+ *   after every service call and every MIPS_TIME_TICK instructions; NULL
+ *   stops the updates; returns 0, or -1 if page is invalid]
+ * - 21: void *memcpy(void *dst, const void *src, unsigned len);
+ *   [overlapping buffers are allowed, like with memmove]
+ * - 22: void *memset(void *dst, int c, unsigned len);
+ * - 23: int memcmp(const void *a, const void *b, unsigned len);
+ *   [returns -1, 0 or 1]
+ * - 24: unsigned strlen(const char *str);
+ * - 25: int vprintf(const char *fmt, va_list ap);
+ *   [formats into the output of the print services; ap points to the o32
+ *   argument block in MIPS memory; see do_printf for the conversions]
+ * - 26: void *malloc(unsigned size);
+ * - 27: void free(void *ptr);
+ * - 28: void *realloc(void *ptr, unsigned size);
+ *   [the heap is managed by the host above the break; see heap.h]
+ * - 29: void *calloc(unsigned n, unsigned size);
+ *   [returns NULL if n * size overflows]
+ *
+ * Buffers passed to services 21-24 must lie entirely within MIPS memory,
+ * otherwise MIPS_E_ADDRESS is returned as for a faulting access.
+ *
+ * Output of the print services is collected in a per-CPU buffer and written
+ * to stdout according to the flush policy (see enum mips_flush_policy).
+ * Standard input is read into a per-CPU buffer in large blocks; the input
+ * services, read_input and read() from fd 0 consume the buffered data first.
+ *
+ * Services can also be requested in batches through a ring in MIPS memory,
+ * so that a single SYSCALL performs many of them.  The ring consists of a
+ * header of three words: size (number of entries, a power of two), head and
+ * tail, followed by size entries of five words: service, three arguments and
+ * the result.  The program fills the entries from tail & (size-1) onwards and
+ * advances tail; ring_kick performs the entries from head up to tail in
+ * order, stores $v0 of each in its result word and advances head.  Nested
+ * ring_kick is not allowed.  Neither is gettime, whose 64-bit result does not
+ * fit the result word, nor mmap, which takes a fourth argument; all of them
+ * get the result -1.  If a service faults, head is left at its entry.
  *
  * Note: the SPIM close() variant returns void.  We return the value returned
  * by the underlying close system call.
@@ -62,17 +110,24 @@
  * also fds 0, 1 and 2, when initialized by init_stdio().  Once opened, they
  * cannot be closed or reused.
  *
- * @todo Remove the pcpu->fds field from MIPS_CPU and introduce per-cpu extra
- * data in syscalls.h.  This will be much cleaner... but unnecessary unless we
- * have more extra data to associate with the CPU state.
+ * @todo Move the pcpu->fds field from MIPS_CPU to the per-cpu extra data
+ * (struct mips_hostdata in syscalls.h).
  */
 #include <assert.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <fcntl.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include "../cpu.h"
+#include "aio.h"
+#include "compress.h"
+#include "heap.h"
+#include "memory.h"
+#include "numa.h"
 
 #ifdef _WIN32
 
@@ -102,7 +157,32 @@
 
 #endif	/* _WIN32 */
 
-#define SYSCALL_MAX 16
+#define SYSCALL_MAX 29
+
+/** Size of the per-CPU buffer through which read/write transform data. */
+#define IOBUF_SIZE 65536
+
+/** Size of the per-CPU buffer for output of print services. */
+#define OUTBUF_SIZE 8192
+
+/** Maximum length of a file name passed to open, including the NUL. */
+#define FNAME_MAX 256
+
+/** Size of the per-CPU buffer for standard input. */
+#define INBUF_SIZE 65536
+
+/** Number of bytes of a string fetched at once by print_string. */
+#define STR_CHUNK 64
+
+/** Maximum length of a printf format, including the NUL. */
+#define FMT_MAX 1024
+
+/** Limit of printf field width and precision. */
+#define FIELD_MAX 4096
+
+/** Size of the request ring header and of one entry, in words. */
+#define RING_HDR_WORDS 3
+#define RING_OP_WORDS 5
 
 static int do_print_int(MIPS_CPU*);			/* 1 */
 static int do_lseek(MIPS_CPU*);				/* 2 - not SPIM */
@@ -117,14 +197,45 @@ static int do_open(MIPS_CPU*);				/* 13 */
 static int do_read(MIPS_CPU*);				/* 14 */
 static int do_write(MIPS_CPU*);				/* 15 */
 static int do_close(MIPS_CPU*);				/* 16 */
+static int do_mmap(MIPS_CPU*);				/* 17 - not SPIM */
+static int do_read_input(MIPS_CPU*);		/* 18 - not SPIM */
+static int do_ring_kick(MIPS_CPU*);			/* 19 - not SPIM */
+static int do_time_map(MIPS_CPU*);			/* 20 - not SPIM */
+static int do_memcpy(MIPS_CPU*);			/* 21 - not SPIM */
+static int do_memset(MIPS_CPU*);			/* 22 - not SPIM */
+static int do_memcmp(MIPS_CPU*);			/* 23 - not SPIM */
+static int do_strlen(MIPS_CPU*);			/* 24 - not SPIM */
+static int do_printf(MIPS_CPU*);			/* 25 - not SPIM */
+static int do_malloc(MIPS_CPU*);			/* 26 - not SPIM */
+static int do_free(MIPS_CPU*);				/* 27 - not SPIM */
+static int do_realloc(MIPS_CPU*);			/* 28 - not SPIM */
+static int do_calloc(MIPS_CPU*);			/* 29 - not SPIM */
 
+static int get_time(unsigned long long*);
 static int find_fd_slot(MIPS_CPU*);
+static int open_args(MIPS_CPU*, char*, int*);
+static int submit_rw(MIPS_CPU*, struct mips_aio*);
+static int valid_range(MIPS_CPU*, mips_uword, mips_uword);
+static int is_identity(MIPS_CPU*);
+static int copy_block(MIPS_CPU*, mips_uword, mips_uword, mips_uword);
+static char *get_iobuf(MIPS_CPU*);
+static void output(MIPS_CPU*, const char*, unsigned);
+static void output_done(MIPS_CPU*, int);
+static int output_string(MIPS_CPU*, mips_uword, mips_uword, int, mips_uword*,
+						 int*);
+static int output_format(MIPS_CPU*, const char*, ...);
+static void output_pad(MIPS_CPU*, unsigned);
+static int fetch_args(MIPS_CPU*, mips_uword*, unsigned, mips_uword*);
+static int input_fill(MIPS_CPU*);
+static int input_copy(MIPS_CPU*, mips_uword, mips_uword, int, mips_uword*);
 typedef int (*syscall_handler)(MIPS_CPU*);
 
 static syscall_handler sys_dispatch[SYSCALL_MAX+1] = {
 	0, do_print_int, do_lseek, do_gettime, do_print_string, do_read_int,
 	0, 0, do_read_string, do_sbrk, 0, do_print_char, do_read_char, do_open,
-	do_read, do_write, do_close
+	do_read, do_write, do_close, do_mmap, do_read_input, do_ring_kick,
+	do_time_map, do_memcpy, do_memset, do_memcmp, do_strlen, do_printf,
+	do_malloc, do_free, do_realloc, do_calloc
 };
 
 void mips_dump_cpu(MIPS_CPU *pcpu)
@@ -146,86 +257,290 @@ void mips_dump_cpu(MIPS_CPU *pcpu)
 	printf("PC =%08x DS =%08x\n", pcpu->pc, pcpu->delay_slot);
 }
 
+void mips_init_hostdata(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = malloc(sizeof(*host));
+
+	pcpu->dirty = NULL;
+	pcpu->icache = NULL;
+	if((pcpu->host = host) != NULL) {
+		host->image_fd = -1;
+		host->dedup_slots = NULL;
+		host->zcpu = NULL;
+		host->nregions = 0;
+		host->node = -1;
+		host->iobuf = NULL;
+		host->outbuf = NULL;
+		host->outlen = 0;
+		host->flush = MIPS_FLUSH_AUTO;
+		host->inbuf = NULL;
+		host->inpos = host->inlen = 0;
+		host->parked = 0;
+		host->aio_done = 0;
+		host->kicks = host->ring_ops = 0;
+		host->timepage = 0;
+		host->heap = NULL;
+		host->heap_saved = NULL;
+		host->baseline = NULL;
+	}
+}
+
+void mips_free_hostdata(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+
+	free(pcpu->dirty);
+	pcpu->dirty = NULL;
+	if(pcpu->icache)
+		munmap(pcpu->icache, MIPS_ICACHE_SIZE * sizeof(*pcpu->icache));
+	pcpu->icache = NULL;
+	if(!host)
+		return;
+	mips_flush_output(pcpu);
+	mips_compress_unregister(pcpu, 1);
+	mips_numa_release(pcpu);
+	mips_heap_destroy(pcpu);
+	if(host->image_fd >= 0)
+		close(host->image_fd);
+	free(host->dedup_slots);
+	free(host->baseline);
+	free(host->iobuf);
+	free(host->outbuf);
+	free(host->inbuf);
+	free(host);
+	pcpu->host = NULL;
+}
+
+void mips_set_flush_policy(MIPS_CPU *pcpu, enum mips_flush_policy policy)
+{
+	if(pcpu->host)
+		pcpu->host->flush = policy;
+}
+
+void mips_flush_output(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+
+	if(!host || !host->outlen)
+		return;
+	fwrite(host->outbuf, 1, host->outlen, stdout);
+	fflush(stdout);
+	host->outlen = 0;
+}
+
 int mips_spim_syscall(MIPS_CPU *pcpu)
 {
 	int  opcode;
-	mips_uword service;
 	
 	if((mips_break_code(pcpu, &opcode) < 0) || (opcode != MIPS_I_SYSCALL))
 		return -1;
-	service = pcpu->r.ur[2];
-	if((service > SYSCALL_MAX) || !sys_dispatch[service])
+	return mips_spim_service(pcpu, pcpu->r.ur[2]);
+}
+
+int mips_spim_service(MIPS_CPU *pcpu, mips_uword service)
+{
+	int err = -1;
+
+	if((service <= SYSCALL_MAX) && sys_dispatch[service]) {
+		pcpu->r.ur[2] = service;
+		err = sys_dispatch[service](pcpu);
+	}
+	mips_time_refresh(pcpu);
+	return err;
+}
+
+/**
+ * Files are opened with the name in the I/O buffer.  Reads and writes go
+ * directly to MIPS memory if it is untransformed, otherwise through the I/O
+ * buffer, in which case a read transfers at most IOBUF_SIZE bytes.  Writes
+ * are resubmitted until the whole buffer has been written, like with the
+ * blocking write.  A read from fd 0 is served synchronously if there is
+ * buffered input.
+ */
+int mips_spim_syscall_async(MIPS_CPU *pcpu, struct mips_aio *aio)
+{
+	struct mips_hostdata *host = pcpu->host;
+	mips_sword	fd	= pcpu->r.sr[4];
+	mips_uword	buf	= pcpu->r.ur[5];
+	mips_uword	len	= pcpu->r.ur[6];
+	mips_uword	service;
+	int			opcode, flags, err;
+	char		*p;
+	
+	if((mips_break_code(pcpu, &opcode) < 0) || (opcode != MIPS_I_SYSCALL))
 		return -1;
-	return sys_dispatch[service](pcpu);
+	service = pcpu->r.ur[2];
+	if(!host || (service < 13) || (service > 15))
+		return mips_spim_syscall(pcpu);
+	if(!(p = get_iobuf(pcpu)))
+		return MIPS_E_ABORT;
+
+	if(service == 13) {
+		if((err = open_args(pcpu, p, &flags)) != 0) {
+			if(err > 0)
+				return err;
+			pcpu->r.sr[2] = -1;
+			return 0;
+		}
+		if(find_fd_slot(pcpu) < 0) {
+			pcpu->r.sr[2] = -1;
+			return 0;
+		}
+		if(mips_aio_submit(aio, pcpu, MIPS_AIO_OPEN, -1, p, 0, flags, S_RW) < 0)
+			return MIPS_E_ABORT;
+	} else {
+		if(!valid_range(pcpu, buf, len))
+			return MIPS_E_ADDRESS;
+		if((fd < 0) || (fd >= MIPS_MAXFDS) || (pcpu->fds[fd] < 0)) {
+			pcpu->r.sr[2] = -1;
+			return 0;
+		}
+		if((service == 14) && (fd == 0) && (host->inpos < host->inlen))
+			return mips_spim_syscall(pcpu);
+		mips_flush_output(pcpu);
+		host->aio_done = 0;
+		if(submit_rw(pcpu, aio) < 0)
+			return MIPS_E_ABORT;
+		if(service == 14)
+			mips_idle_enter(pcpu);
+	}
+	host->parked = service;
+	return MIPS_SPIM_PARKED;
 }
 
-/* return value: low-word in $v0 ($2), high-word in $v1 ($3) */
-static int do_gettime(MIPS_CPU *pcpu)
+int mips_spim_syscall_complete(MIPS_CPU *pcpu, struct mips_aio *aio, int res)
 {
-	union {						/* XXX! this is endian-specific! */
-		unsigned long long ull;	/* 64 bit */
-		unsigned ul[2];			/* 32 bit */
-	} r;
+	struct mips_hostdata *host = pcpu->host;
+	mips_uword buf = pcpu->r.ur[5];
+	int fd;
 
+	switch(host->parked) {
+	case 13:
+		pcpu->r.sr[2] = -1;
+		if(res <= 0)
+			break;
+		if((fd = find_fd_slot(pcpu)) >= 0) {
+			pcpu->fds[fd] = res;
+			pcpu->r.sr[2] = fd;
+		} else {
+			close(res);
+		}
+		break;
+	case 14:
+		mips_idle_leave(pcpu);
+		if(res > 0) {
+			if(is_identity(pcpu))
+				mips_mark_dirty(pcpu, buf, res);
+			else
+				mips_copyout(pcpu, buf, (char*)host->iobuf + (buf & 3), res);
+		}
+		pcpu->r.sr[2] = res < 0 ? -1 : res;
+		break;
+	case 15:
+		if(res > 0) {
+			host->aio_done += res;
+			if((host->aio_done < pcpu->r.ur[6]) && (submit_rw(pcpu, aio) == 0))
+				return 1;
+		}
+		if(host->aio_done)
+			pcpu->r.ur[2] = host->aio_done;
+		else
+			pcpu->r.sr[2] = res < 0 ? -1 : res;
+		break;
+	}
+	host->parked = 0;
+	mips_time_refresh(pcpu);
+	return 0;
+}
+
+/** Get the monotonic host time in nanoseconds; return 0 or -1 on error. */
+static int get_time(unsigned long long *ns)
+{
 #ifdef _WIN32
 
 	FILETIME ft;
 
 	GetSystemTimeAsFileTime(&ft);
-	r.ul[0] = ft.dwLowDateTime;
-	r.ul[1] = ft.dwHighDateTime;
-	r.ull *= 100;
+	*ns = ((unsigned long long)ft.dwHighDateTime << 32 | ft.dwLowDateTime) * 100;
 
 #else  /* !_WIN32 */
 
 	struct timespec tp;
 	
 	if(clock_gettime(CLOCK_MONOTONIC, &tp) < 0)
-		return MIPS_E_ABORT;
-	r.ull = tp.tv_sec * 1000000000ULL + tp.tv_nsec;
+		return -1;
+	*ns = tp.tv_sec * 1000000000ULL + tp.tv_nsec;
 
 #endif	/* _WIN32 */
 
-	pcpu->r.ur[2] = r.ul[0];
-	pcpu->r.ur[3] = r.ul[1];
 	return 0;
 }
 
+/* return value: low-word in $v0 ($2), high-word in $v1 ($3) */
+static int do_gettime(MIPS_CPU *pcpu)
+{
+	unsigned long long ns;
+
+	if(get_time(&ns) < 0)
+		return MIPS_E_ABORT;
+	pcpu->r.ur[2] = (mips_uword)ns;
+	pcpu->r.ur[3] = ns >> 32;
+	return 0;
+}
+
+void mips_time_refresh(MIPS_CPU *pcpu)
+{
+	unsigned long long ns;
+	mips_uword page;
+
+	if(!pcpu->host || !(page = pcpu->host->timepage) || (get_time(&ns) < 0))
+		return;
+	mips_poke_uw(pcpu, page, (mips_uword)ns);
+	mips_poke_uw(pcpu, page + 4, ns >> 32);
+}
+
 static int do_print_int(MIPS_CPU *pcpu)
 {
+	char buf[16];
+	
 	assert(pcpu->r.ur[2] == 1);
-	printf("%d", pcpu->r.sr[4]);
-	fflush(stdout);
+	output(pcpu, buf, sprintf(buf, "%d", pcpu->r.sr[4]));
+	output_done(pcpu, 0);
 	return 0;
 }
 
+/**
+ * The string is fetched in aligned chunks, which are transformed in bulk (see
+ * mips_copyin) and output up to the terminating NUL.
+ */
 static int do_print_string(MIPS_CPU *pcpu)
 {
-	mips_uword ptr = pcpu->r.ur[4];
-	mips_ubyte ch;
-	int err;
+	mips_uword len;
+	int newline = 0, err;
 	
 	assert(pcpu->r.ur[2] == 4);
-
-	if((err = setjmp(pcpu->exn)) == 0) {
-		while(1) {
-			ch = mips_peek_ub(pcpu, ptr++);
-			if(!ch)
-				break;
-			putchar(ch);
-		}
-		fflush(stdout);
-	}
+	err = output_string(pcpu, pcpu->r.ur[4], ~(mips_uword)0, 1, &len, &newline);
+	output_done(pcpu, newline);
 	return err;
 }
 
 static int do_read_int(MIPS_CPU *pcpu)
 {
+	struct mips_hostdata *host = pcpu->host;
 	char buf[18];
-	int x;
+	unsigned i;
+	int x, n;
 	
 	assert(pcpu->r.ur[2] == 5);
-	fgets(buf, sizeof(buf), stdin);
+	for(i = 0; i < sizeof(buf)-1; ) {
+		if((n = input_fill(pcpu)) < 0)
+			return MIPS_E_ABORT;
+		if(!n)
+			break;
+		if((buf[i++] = host->inbuf[host->inpos++]) == '\n')
+			break;
+	}
+	buf[i] = 0;
 	if(sscanf(buf, "%d", &x) == 1)
 		pcpu->r.sr[2] = x;
 	return 0;
@@ -235,32 +550,25 @@ static int do_read_string(MIPS_CPU *pcpu)
 {
 	mips_uword buf = pcpu->r.ur[4];
 	mips_uword len = pcpu->r.ur[5];
-	unsigned i = 0;
-	int ch, err;
+	mips_uword n;
+	int err;
 	
 	assert(pcpu->r.ur[2] == 8);
-	if((err = setjmp(pcpu->exn)) == 0) {
-		while(len-- > 1) {
-			ch = getchar();
-			if(ch != EOF)
-				mips_poke_ub(pcpu, buf+i, ch);
-			++i;
-			if((ch == '\n') || (ch == EOF))
-				break;
-		}
-		mips_poke_ub(pcpu, buf+i, 0);
-	}
-	return err;
+	if(!valid_range(pcpu, buf, len ? len : 1))
+		return MIPS_E_ADDRESS;
+	if((err = input_copy(pcpu, buf, len ? len-1 : 0, 1, &n)) != 0)
+		return err;
+	mips_poke_ub(pcpu, buf+n, 0);
+	return 0;
 }
 
 static int do_sbrk(MIPS_CPU *pcpu)
 {
-	mips_uword amount = pcpu->r.ur[2];
+	mips_uword amount = pcpu->r.ur[4];
 	mips_uword oldbrk = pcpu->brk;
 	mips_uword newbrk;
 	
 	assert((pcpu->r.ur[2] == 9) && (oldbrk % 4 == 0));
-	amount = pcpu->r.ur[2];
 	
 	if(amount & 3)
 		amount += 4 - (amount & 3);
@@ -279,18 +587,23 @@ static int do_sbrk(MIPS_CPU *pcpu)
 
 static int do_print_char(MIPS_CPU *pcpu)
 {
-	mips_uword ch = pcpu->r.ur[4];
+	char ch = pcpu->r.ur[4];
 	
 	assert(pcpu->r.ur[2] == 11);
-	putchar(ch);
-	fflush(stdout);
+	output(pcpu, &ch, 1);
+	output_done(pcpu, ch == '\n');
 	return 0;
 }
 
 static int do_read_char(MIPS_CPU *pcpu)
 {
+	struct mips_hostdata *host = pcpu->host;
+	int n;
+
 	assert(pcpu->r.ur[2] == 12);
-	pcpu->r.sr[2] = getchar();
+	if((n = input_fill(pcpu)) < 0)
+		return MIPS_E_ABORT;
+	pcpu->r.sr[2] = n ? (mips_ubyte)host->inbuf[host->inpos++] : EOF;
 	return 0;
 }
 
@@ -305,37 +618,52 @@ static int find_fd_slot(MIPS_CPU *pcpu)
 	return -1;
 }
 
-static int do_open(MIPS_CPU *pcpu)
+/**
+ * Helper for do_open and mips_spim_syscall_async: decode the flags and copy
+ * in the file name (at most FNAME_MAX bytes including the NUL).
+ *
+ * @return 0 on success, -1 if the flags are invalid, or MIPS_E_ADDRESS.
+ */
+static int open_args(MIPS_CPU *pcpu, char *fname, int *flags)
 {
-	mips_uword	name  = pcpu->r.ur[4];
-	mips_uword	flags = pcpu->r.ur[5];
-	mips_uword	mode  = S_RW; /* UNUSED: pcpu->r.ur[6]; */
-	char		fname[256];
-	int			fd, err;
-	
-	assert(pcpu->r.ur[2] == 13);
+	mips_uword	name = pcpu->r.ur[4];
+	unsigned	i;
+	int			err;
 
 	/* Decode POSIX-like flags to fopen() mode string. */
-	switch(flags) {
-	case 0:		flags = O_RDONLY;						break;
-	case 1:		flags = O_WRONLY | O_CREAT | O_TRUNC;	break;
-	case 2:		flags = O_RDWR | O_CREAT;				break;
-	default:	pcpu->r.sr[2] = -1;						return 0;
+	switch(pcpu->r.ur[5]) {
+	case 0:		*flags = O_RDONLY;						break;
+	case 1:		*flags = O_WRONLY | O_CREAT | O_TRUNC;	break;
+	case 2:		*flags = O_RDWR | O_CREAT;				break;
+	default:	return -1;
 	}
-	flags |= O_BINARY;
+	*flags |= O_BINARY;
 
 	/* Copy in the whole file name. */
 	if((err = setjmp(pcpu->exn)) == 0) {
-		unsigned i = 0;
-		while(1) {
-			if(i >= sizeof(fname))
+		for(i = 0; ; i++) {
+			if(i >= FNAME_MAX)
 				return MIPS_E_ADDRESS;
 			if(!(fname[i] = mips_peek_ub(pcpu, name+i)))
 				break;
-			++i;
 		}
-	} else {
-		return err;
+	}
+	return err;
+}
+
+static int do_open(MIPS_CPU *pcpu)
+{
+	mips_uword	mode  = S_RW; /* UNUSED: pcpu->r.ur[6]; */
+	char		fname[FNAME_MAX];
+	int			fd, flags, err;
+	
+	assert(pcpu->r.ur[2] == 13);
+
+	if((err = open_args(pcpu, fname, &flags)) != 0) {
+		if(err > 0)
+			return err;
+		pcpu->r.sr[2] = -1;
+		return 0;
 	}
 	
 	/* Open the file. Assume failure first... */
@@ -346,51 +674,109 @@ static int do_open(MIPS_CPU *pcpu)
 	return 0;
 }
 
+/**
+ * With identity memory, the data is read directly into MIPS memory.
+ * Otherwise it is read into the I/O buffer and transformed into MIPS memory
+ * in bulk; several buffers are transferred only for regular files, since
+ * another read from a pipe or terminal could block.
+ */
 static int do_read(MIPS_CPU *pcpu)
 {
 	mips_sword	fd	= pcpu->r.sr[4];
 	mips_uword	buf	= pcpu->r.ur[5];
 	mips_uword	len	= pcpu->r.ur[6];
+	mips_uword	m, total;
+	struct stat	st;
 	char		*p;
+	int			n;
 	
 	assert(pcpu->r.ur[2] == 14);
+	mips_flush_output(pcpu);
 
-	if(buf + len >= pcpu->memsz)
+	if(!valid_range(pcpu, buf, len))
 		return MIPS_E_ADDRESS;
 	if((fd < 0) || (fd >= MIPS_MAXFDS) || (pcpu->fds[fd] < 0)) {
 		pcpu->r.sr[2] = -1;
 		return 0;
 	}
+	if((fd == 0) && pcpu->host && (pcpu->host->inpos < pcpu->host->inlen))
+		return input_copy(pcpu, buf, len, 0, &pcpu->r.ur[2]);
 
-	if(!(p = malloc(len)))
+	if(is_identity(pcpu)) {
+		mips_idle_enter(pcpu);
+		n = read(pcpu->fds[fd], pcpu->base + buf, len);
+		mips_idle_leave(pcpu);
+		if((pcpu->r.sr[2] = n) > 0)
+			mips_mark_dirty(pcpu, buf, n);
+		return 0;
+	}
+
+	if(!(p = get_iobuf(pcpu)))
 		return MIPS_E_ABORT;
-	if((pcpu->r.sr[2] = read(pcpu->fds[fd], p, len)) > 0)
-		mips_copyout(pcpu, buf, p, pcpu->r.sr[2]);
-	free(p);
+	p += buf & 3;
+	if((len > IOBUF_SIZE) &&
+	   ((fstat(pcpu->fds[fd], &st) < 0) || !S_ISREG(st.st_mode)))
+		len = IOBUF_SIZE;
+	for(total = 0; total < len; ) {
+		m = len - total < IOBUF_SIZE ? len - total : IOBUF_SIZE;
+		mips_idle_enter(pcpu);
+		n = read(pcpu->fds[fd], p, m);
+		mips_idle_leave(pcpu);
+		if(n <= 0) {
+			if(!total)
+				total = n;
+			break;
+		}
+		mips_copyout(pcpu, buf + total, p, n);
+		total += n;
+		if((mips_uword)n < m)
+			break;
+	}
+	pcpu->r.sr[2] = total;
 	return 0;
 }
 
+/** The counterpart of do_read; the buffer is transferred in full. */
 static int do_write(MIPS_CPU *pcpu)
 {
 	mips_sword	fd	= pcpu->r.sr[4];
 	mips_uword	buf	= pcpu->r.ur[5];
 	mips_uword	len	= pcpu->r.ur[6];
+	mips_uword	m, total;
 	char		*p;
+	int			n;
 	
 	assert(pcpu->r.ur[2] == 15);
+	mips_flush_output(pcpu);
 
-	if(buf + len >= pcpu->memsz)
+	if(!valid_range(pcpu, buf, len))
 		return MIPS_E_ADDRESS;
 	if((fd < 0) || (fd >= MIPS_MAXFDS) || (pcpu->fds[fd] < 0)) {
 		pcpu->r.sr[2] = -1;
 		return 0;
 	}
 
-	if(!(p = malloc(len)))
+	if(is_identity(pcpu)) {
+		pcpu->r.sr[2] = write(pcpu->fds[fd], pcpu->base + buf, len);
+		return 0;
+	}
+
+	if(!(p = get_iobuf(pcpu)))
 		return MIPS_E_ABORT;
-	mips_copyin(pcpu, p, buf, len);
-	pcpu->r.sr[2] = write(pcpu->fds[fd], p, len);
-	free(p);
+	p += buf & 3;
+	for(total = 0; total < len; ) {
+		m = len - total < IOBUF_SIZE ? len - total : IOBUF_SIZE;
+		mips_copyin(pcpu, p, buf + total, m);
+		if((n = write(pcpu->fds[fd], p, m)) <= 0) {
+			if(!total)
+				total = n;
+			break;
+		}
+		total += n;
+		if((mips_uword)n < m)
+			break;
+	}
+	pcpu->r.sr[2] = total;
 	return 0;
 }
 
@@ -410,6 +796,451 @@ static int do_close(MIPS_CPU *pcpu)
 	return 0;
 }
 
+static int do_mmap(MIPS_CPU *pcpu)
+{
+	mips_uword	addr	= pcpu->r.ur[4];
+	mips_uword	len		= pcpu->r.ur[5];
+	mips_uword	flags	= pcpu->r.ur[6];
+	mips_sword	fd		= pcpu->r.sr[7];
+	off_t		off;
+
+	assert(pcpu->r.ur[2] == 17);
+	pcpu->r.sr[2] = -1;
+	if((fd < 0) || (fd >= MIPS_MAXFDS) || (pcpu->fds[fd] < 0))
+		return 0;
+	if((off = lseek(pcpu->fds[fd], 0, SEEK_CUR)) < 0)
+		return 0;
+	if(mips_map_file(pcpu, addr, len, pcpu->fds[fd], off,
+					 flags & MIPS_MAP_SHARED) == 0)
+		pcpu->r.ur[2] = addr;
+	return 0;
+}
+
+static int do_read_input(MIPS_CPU *pcpu)
+{
+	mips_uword	buf		= pcpu->r.ur[4];
+	mips_uword	len		= pcpu->r.ur[5];
+	mips_uword	mode	= pcpu->r.ur[6];
+
+	assert(pcpu->r.ur[2] == 18);
+	if(!valid_range(pcpu, buf, len))
+		return MIPS_E_ADDRESS;
+	return input_copy(pcpu, buf, len, mode == 0, &pcpu->r.ur[2]);
+}
+
+/**
+ * Each entry is performed by its handler from sys_dispatch with the service
+ * and arguments loaded into $v0 and $a0-$a2; these registers are restored
+ * afterwards.
+ */
+static int do_ring_kick(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+	mips_uword	ring	= pcpu->r.ur[4];
+	mips_uword	hdr[RING_HDR_WORDS], op[RING_OP_WORDS], regs[5];
+	mips_uword	size, head, tail, addr, service, n = 0;
+	int			err = 0;
+
+	assert(pcpu->r.ur[2] == 19);
+	if((ring & 3) || !valid_range(pcpu, ring, sizeof(hdr)))
+		return MIPS_E_ADDRESS;
+	mips_copyin(pcpu, hdr, ring, sizeof(hdr));
+	size = hdr[0];
+	head = hdr[1];
+	tail = hdr[2];
+	if(!size || (size & (size - 1)) || (size > pcpu->memsz / sizeof(op))
+	   || (tail - head > size)) {
+		pcpu->r.sr[2] = -1;
+		return 0;
+	}
+	if(!valid_range(pcpu, ring, sizeof(hdr) + size * sizeof(op)))
+		return MIPS_E_ADDRESS;
+
+	memcpy(regs, &pcpu->r.ur[2], sizeof(regs));
+	for(; head != tail; head++, n++) {
+		addr = ring + sizeof(hdr) + (head & (size - 1)) * sizeof(op);
+		mips_copyin(pcpu, op, addr, sizeof(op) - 4);
+		service = op[0];
+		pcpu->r.ur[2] = service;
+		pcpu->r.ur[4] = op[1];
+		pcpu->r.ur[5] = op[2];
+		pcpu->r.ur[6] = op[3];
+		if((service > SYSCALL_MAX) || !sys_dispatch[service]
+		   || (service == 3) || (service == 17) || (service == 19))
+			pcpu->r.sr[2] = -1;
+		else if((err = sys_dispatch[service](pcpu)) != 0)
+			break;
+		mips_poke_uw(pcpu, addr + sizeof(op) - 4, pcpu->r.ur[2]);
+	}
+	memcpy(&pcpu->r.ur[2], regs, sizeof(regs));
+	mips_poke_uw(pcpu, ring + 4, head);
+
+	if(host) {
+		host->kicks++;
+		host->ring_ops += n;
+	}
+	if(err)
+		return err;
+	pcpu->r.ur[2] = n;
+	return 0;
+}
+
+static int do_time_map(MIPS_CPU *pcpu)
+{
+	mips_uword page = pcpu->r.ur[4];
+
+	assert(pcpu->r.ur[2] == 20);
+	pcpu->r.sr[2] = -1;
+	if(!pcpu->host || (page & 3) || (page && !valid_range(pcpu, page, 8)))
+		return 0;
+	pcpu->host->timepage = page;
+	pcpu->r.sr[2] = 0;
+	return 0;
+}
+
+/**
+ * Memory services work directly on MIPS memory if it is untransformed,
+ * otherwise in chunks through the I/O buffer, placed so that the word
+ * alignment of the host and MIPS addresses matches (see mips_copyout).  The
+ * chunks of memcpy are copied backwards if dst is above src, so that
+ * overlapping buffers are handled.
+ */
+static int do_memcpy(MIPS_CPU *pcpu)
+{
+	mips_uword	dst	= pcpu->r.ur[4];
+	mips_uword	src	= pcpu->r.ur[5];
+	mips_uword	len	= pcpu->r.ur[6];
+
+	assert(pcpu->r.ur[2] == 21);
+	if(!valid_range(pcpu, dst, len) || !valid_range(pcpu, src, len))
+		return MIPS_E_ADDRESS;
+	pcpu->r.ur[2] = dst;
+	return copy_block(pcpu, dst, src, len);
+}
+
+static int do_memset(MIPS_CPU *pcpu)
+{
+	mips_uword	dst	= pcpu->r.ur[4];
+	int			c	= pcpu->r.sr[5];
+	mips_uword	len	= pcpu->r.ur[6];
+	mips_uword	off, n;
+	char		*p;
+
+	assert(pcpu->r.ur[2] == 22);
+	if(!valid_range(pcpu, dst, len))
+		return MIPS_E_ADDRESS;
+	pcpu->r.ur[2] = dst;
+	if(is_identity(pcpu)) {
+		memset(pcpu->base + dst, c, len);
+		mips_mark_dirty(pcpu, dst, len);
+		return 0;
+	}
+	if(!(p = get_iobuf(pcpu)))
+		return MIPS_E_ABORT;
+	p += dst & 3;
+	memset(p, c, len < IOBUF_SIZE ? len : IOBUF_SIZE);
+	for(off = 0; off < len; off += n) {
+		n = len - off < IOBUF_SIZE ? len - off : IOBUF_SIZE;
+		mips_copyout(pcpu, dst + off, p, n);
+	}
+	return 0;
+}
+
+/** The I/O buffer is split into halves, one for each operand. */
+static int do_memcmp(MIPS_CPU *pcpu)
+{
+	mips_uword	a	= pcpu->r.ur[4];
+	mips_uword	b	= pcpu->r.ur[5];
+	mips_uword	len	= pcpu->r.ur[6];
+	mips_uword	off, n;
+	char		*p;
+	int			r = 0;
+
+	assert(pcpu->r.ur[2] == 23);
+	if(!valid_range(pcpu, a, len) || !valid_range(pcpu, b, len))
+		return MIPS_E_ADDRESS;
+	if(is_identity(pcpu)) {
+		r = memcmp(pcpu->base + a, pcpu->base + b, len);
+	} else {
+		if(!(p = get_iobuf(pcpu)))
+			return MIPS_E_ABORT;
+		for(off = 0; (off < len) && !r; off += n) {
+			n = len - off < IOBUF_SIZE/2 - 4 ? len - off : IOBUF_SIZE/2 - 4;
+			mips_copyin(pcpu, p + (a & 3), a + off, n);
+			mips_copyin(pcpu, p + IOBUF_SIZE/2 + (b & 3), b + off, n);
+			r = memcmp(p + (a & 3), p + IOBUF_SIZE/2 + (b & 3), n);
+		}
+	}
+	pcpu->r.sr[2] = (r > 0) - (r < 0);
+	return 0;
+}
+
+/** Like print_string, the string is fetched in aligned chunks. */
+static int do_strlen(MIPS_CPU *pcpu)
+{
+	mips_uword	str	= pcpu->r.ur[4];
+	const char	*end;
+
+	assert(pcpu->r.ur[2] == 24);
+	if(!valid_range(pcpu, str, 1))
+		return MIPS_E_ADDRESS;
+	if(is_identity(pcpu)) {
+		if(!(end = memchr(pcpu->base + str, 0, pcpu->memsz - str - 1)))
+			return MIPS_E_ADDRESS;
+		pcpu->r.ur[2] = end - (pcpu->base + str);
+		return 0;
+	}
+	return output_string(pcpu, str, ~(mips_uword)0, 0, &pcpu->r.ur[2], NULL);
+}
+
+/**
+ * Supported are the conversions d, i, u, o, x, X, c, s, p and %, with flags
+ * -+ #0, field width and precision (also as *, limited to FIELD_MAX), and
+ * length modifiers hh, h, l, ll and L (long double is double in o32).  The
+ * floating-point conversions f, F, e, E, g, G, a and A take a double, which
+ * o32 passes 8-byte aligned like long long; it is formatted by the host.
+ * Other conversions (e.g. n) are output verbatim without consuming an
+ * argument.  Returns the number of bytes output, or -1 if the format is
+ * longer than FMT_MAX.
+ */
+static int do_printf(MIPS_CPU *pcpu)
+{
+	mips_uword	fa = pcpu->r.ur[4];
+	mips_uword	ap = pcpu->r.ur[5];
+	mips_uword	arg[2], len, max;
+	char		fmt[FMT_MAX], spec[16];
+	const char	*p, *q;
+	unsigned long long val;
+	double		dval;
+	int			width, prec, size, newline = 0, err = 0;
+	unsigned	total = 0, n;
+
+	assert(pcpu->r.ur[2] == 25);
+	if((err = output_string(pcpu, fa, sizeof(fmt), 0, &len, NULL)) != 0)
+		return err;
+	if(len >= sizeof(fmt)) {
+		pcpu->r.sr[2] = -1;
+		return 0;
+	}
+	mips_copyin(pcpu, fmt, fa, len);
+	fmt[len] = 0;
+
+	for(p = fmt; *p && !err; p = q) {
+		/* Literal text up to the next conversion. */
+		if(*p != '%') {
+			q = p + strcspn(p, "%");
+			output(pcpu, p, q - p);
+			newline |= memchr(p, '\n', q - p) != NULL;
+			total += q - p;
+			continue;
+		}
+
+		q = p + 1;
+		n = 1;
+		spec[0] = '%';
+		while(strchr("-+ #0", *q) && (n < 6))
+			spec[n++] = *q++;
+		width = 0;
+		if(*q == '*') {
+			++q;
+			if((err = fetch_args(pcpu, &ap, 1, arg)) != 0)
+				break;
+			width = arg[0];
+			if(width < -FIELD_MAX)
+				width = -FIELD_MAX;
+			if(width < 0) {
+				spec[n++] = '-';
+				width = -width;
+			}
+		} else {
+			while((*q >= '0') && (*q <= '9') && (width <= FIELD_MAX))
+				width = width * 10 + *q++ - '0';
+		}
+		prec = -1;
+		if(*q == '.') {
+			prec = 0;
+			if(*++q == '*') {
+				++q;
+				if((err = fetch_args(pcpu, &ap, 1, arg)) != 0)
+					break;
+				prec = arg[0];
+			} else {
+				while((*q >= '0') && (*q <= '9') && (prec <= FIELD_MAX))
+					prec = prec * 10 + *q++ - '0';
+			}
+		}
+		while((*q >= '0') && (*q <= '9'))
+			++q;
+		if(width > FIELD_MAX)
+			width = FIELD_MAX;
+		if(prec > FIELD_MAX)
+			prec = FIELD_MAX;
+
+		size = 4;
+		if(*q == 'h') {
+			size = 2;
+			if(*++q == 'h') {
+				++q;
+				size = 1;
+			}
+		} else if(*q == 'l') {
+			if(*++q == 'l') {
+				++q;
+				size = 8;
+			}
+		} else if(*q == 'L') {
+			++q;
+			size = 8;
+		}
+
+		switch(*q) {
+		case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'p':
+			if((err = fetch_args(pcpu, &ap, size / 4 + (size < 4), arg)) != 0)
+				break;
+			val = arg[0];
+			if(size == 8)
+				val |= (unsigned long long)arg[1] << 32;
+			if((*q == 'd') || (*q == 'i')) {
+				switch(size) {
+				case 1: val = (signed char)val;			break;
+				case 2: val = (short)val;				break;
+				case 4: val = (mips_sword)val;			break;
+				}
+			} else {
+				switch(size) {
+				case 1: val = (unsigned char)val;		break;
+				case 2: val = (unsigned short)val;		break;
+				}
+			}
+			if(*q == 'p')
+				spec[n++] = '#';
+			memcpy(spec + n, "*.*ll", 5);
+			spec[n + 5] = *q == 'p' ? 'x' : *q;
+			spec[n + 6] = 0;
+			total += output_format(pcpu, spec, width, prec, val);
+			break;
+		case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+		case 'a': case 'A':
+			if((err = fetch_args(pcpu, &ap, 2, arg)) != 0)
+				break;
+			val = arg[0] | (unsigned long long)arg[1] << 32;
+			memcpy(&dval, &val, sizeof(dval));
+			memcpy(spec + n, "*.*", 3);
+			spec[n + 3] = *q;
+			spec[n + 4] = 0;
+			total += output_format(pcpu, spec, width, prec, dval);
+			break;
+		case 'c':
+			if((err = fetch_args(pcpu, &ap, 1, arg)) != 0)
+				break;
+			memcpy(spec + n, "*c", 3);
+			total += output_format(pcpu, spec, width, (unsigned char)arg[0]);
+			newline |= (unsigned char)arg[0] == '\n';
+			break;
+		case 's':
+			if((err = fetch_args(pcpu, &ap, 1, arg)) != 0)
+				break;
+			max = prec < 0 ? ~(mips_uword)0 : (mips_uword)prec;
+			if((err = output_string(pcpu, arg[0], max, 0, &len, NULL)) != 0)
+				break;
+			if(len < (unsigned)width && !memchr(spec, '-', n))
+				output_pad(pcpu, width - len);
+			output_string(pcpu, arg[0], len, 1, &len, &newline);
+			if(len < (unsigned)width && memchr(spec, '-', n))
+				output_pad(pcpu, width - len);
+			total += len < (unsigned)width ? (unsigned)width : len;
+			break;
+		case '%':
+			output(pcpu, "%", 1);
+			++total;
+			break;
+		default:
+			if(*q)
+				++q;
+			output(pcpu, p, q - p);
+			total += q - p;
+			continue;
+		}
+		++q;
+	}
+	output_done(pcpu, newline);
+	if(err)
+		return err;
+	pcpu->r.ur[2] = total;
+	return 0;
+}
+
+static int do_malloc(MIPS_CPU *pcpu)
+{
+	assert(pcpu->r.ur[2] == 26);
+	pcpu->r.ur[2] = mips_heap_alloc(pcpu, pcpu->r.ur[4]);
+	return 0;
+}
+
+static int do_free(MIPS_CPU *pcpu)
+{
+	assert(pcpu->r.ur[2] == 27);
+	mips_heap_free(pcpu, pcpu->r.ur[4]);
+	return 0;
+}
+
+/**
+ * A block which cannot be resized in place is moved.  A block unknown to the
+ * heap (e.g. allocated before a snapshot was taken) is copied as far as
+ * the new size and MIPS memory allow, since its old size is not known.
+ */
+static int do_realloc(MIPS_CPU *pcpu)
+{
+	mips_uword	ptr		= pcpu->r.ur[4];
+	mips_uword	size	= pcpu->r.ur[5];
+	mips_uword	dst, len;
+	int			err;
+
+	assert(pcpu->r.ur[2] == 28);
+	if(!ptr) {
+		pcpu->r.ur[2] = mips_heap_alloc(pcpu, size);
+		return 0;
+	}
+	if(!size) {
+		mips_heap_free(pcpu, ptr);
+		pcpu->r.ur[2] = 0;
+		return 0;
+	}
+	if(!valid_range(pcpu, ptr, 1))
+		return MIPS_E_ADDRESS;
+	pcpu->r.ur[2] = ptr;
+	if(mips_heap_resize(pcpu, ptr, size) == 0)
+		return 0;
+
+	if(!(len = mips_heap_size(pcpu, ptr)) || (len > size))
+		len = size;
+	if(len > pcpu->memsz - 1 - ptr)
+		len = pcpu->memsz - 1 - ptr;
+	if((pcpu->r.ur[2] = dst = mips_heap_alloc(pcpu, size)) == 0)
+		return 0;
+	if((err = copy_block(pcpu, dst, ptr, len)) != 0)
+		return err;
+	mips_heap_free(pcpu, ptr);
+	return 0;
+}
+
+/** Reused heap blocks are not zero, so the block is cleared by memset. */
+static int do_calloc(MIPS_CPU *pcpu)
+{
+	unsigned long long total = (unsigned long long)pcpu->r.ur[4] * pcpu->r.ur[5];
+	mips_uword ptr;
+
+	assert(pcpu->r.ur[2] == 29);
+	pcpu->r.ur[2] = 0;
+	if((total >> 32) || !(ptr = mips_heap_alloc(pcpu, total)))
+		return 0;
+	pcpu->r.ur[2] = 22;
+	pcpu->r.ur[4] = ptr;
+	pcpu->r.ur[5] = 0;
+	pcpu->r.ur[6] = total;
+	return do_memset(pcpu);
+}
+
 static int do_lseek(MIPS_CPU *pcpu)
 {
 	mips_sword	fd		= pcpu->r.sr[4];
@@ -434,3 +1265,296 @@ static int do_lseek(MIPS_CPU *pcpu)
 	}
 	return 0;
 }
+
+/**
+ * Check that the range of len bytes at addr is within MIPS memory and not
+ * below MIPS_LOWBASE (same conditions as mips_copyout).
+ */
+static int valid_range(MIPS_CPU *pcpu, mips_uword addr, mips_uword len)
+{
+	if(!len)
+		return addr < pcpu->memsz;
+	return (addr >= MIPS_LOWBASE) && (addr + len > addr) &&
+		(addr + len < pcpu->memsz);
+}
+
+/**
+ * Check whether MIPS memory may be accessed directly by the host: the memory
+ * is not transformed, and is not compressed, since compressed pages are
+ * paged in by a signal handler which is not invoked for system calls.
+ */
+static int is_identity(MIPS_CPU *pcpu)
+{
+	return (pcpu->peek_block == mips_identity_peek_block) &&
+		(pcpu->poke_block == mips_identity_poke_block) &&
+		(!pcpu->host || !pcpu->host->zcpu);
+}
+
+/**
+ * Copy len bytes within MIPS memory, directly if it is untransformed, else
+ * in chunks through the I/O buffer, backwards if dst is above src.  Both
+ * ranges must have been validated.
+ */
+static int copy_block(MIPS_CPU *pcpu, mips_uword dst, mips_uword src,
+					  mips_uword len)
+{
+	mips_uword	off, pos, n;
+	char		*p, *q;
+
+	if(is_identity(pcpu)) {
+		memmove(pcpu->base + dst, pcpu->base + src, len);
+		mips_mark_dirty(pcpu, dst, len);
+		return 0;
+	}
+	if(!(p = get_iobuf(pcpu)))
+		return MIPS_E_ABORT;
+	for(off = 0; off < len; off += n) {
+		n = len - off < IOBUF_SIZE ? len - off : IOBUF_SIZE;
+		pos = dst > src ? len - off - n : off;
+		q = p + ((dst + pos) & 3);
+		mips_copyin(pcpu, q, src + pos, n);
+		mips_copyout(pcpu, dst + pos, q, n);
+	}
+	return 0;
+}
+
+/**
+ * Return the I/O buffer of the CPU, allocating it on first use.  The buffer
+ * has room for IOBUF_SIZE bytes at an offset of up to 3 bytes, so that data
+ * can be placed at the same word alignment as in MIPS memory and
+ * transformed without further copying (see mips_copyout).
+ */
+static char *get_iobuf(MIPS_CPU *pcpu)
+{
+	if(!pcpu->host)
+		return NULL;
+	if(!pcpu->host->iobuf)
+		pcpu->host->iobuf = malloc(IOBUF_SIZE + sizeof(mips_uword));
+	return (char*)pcpu->host->iobuf;
+}
+
+/**
+ * Append n bytes to the output buffer of the CPU, flushing it when full.
+ * Without host data or if the buffer cannot be allocated, the bytes are
+ * written to stdout directly.
+ */
+static void output(MIPS_CPU *pcpu, const char *p, unsigned n)
+{
+	struct mips_hostdata *host = pcpu->host;
+	unsigned m;
+
+	if(host && !host->outbuf)
+		host->outbuf = malloc(OUTBUF_SIZE);
+	if(!host || !host->outbuf) {
+		fwrite(p, 1, n, stdout);
+		fflush(stdout);
+		return;
+	}
+	for(; n; n -= m, p += m) {
+		if(host->outlen == OUTBUF_SIZE)
+			mips_flush_output(pcpu);
+		m = OUTBUF_SIZE - host->outlen;
+		if(m > n)
+			m = n;
+		memcpy(host->outbuf + host->outlen, p, m);
+		host->outlen += m;
+	}
+}
+
+/**
+ * Output the string at ptr, but at most max bytes of it, or only count the
+ * bytes if out is 0.  The string is fetched in aligned chunks, which are
+ * transformed in bulk (see mips_copyin).
+ *
+ * @param len     Number of bytes of the string (up to max).
+ * @param newline Set to 1 if a newline has been output; may be NULL if out
+ *                is 0.
+ * @return 0, or MIPS_E_ADDRESS if the string is not within MIPS memory.
+ */
+static int output_string(MIPS_CPU *pcpu, mips_uword ptr, mips_uword max,
+						 int out, mips_uword *len, int *newline)
+{
+	mips_uword n, m;
+	char buf[STR_CHUNK];
+
+	for(*len = 0; *len < max; *len += n, ptr += n) {
+		n = STR_CHUNK - ptr % STR_CHUNK;
+		if((ptr < pcpu->memsz) && (ptr + n >= pcpu->memsz))
+			n = pcpu->memsz - ptr - 1;
+		if(n > max - *len)
+			n = max - *len;
+		if(!n || (mips_copyin(pcpu, buf, ptr, n) < 0))
+			return MIPS_E_ADDRESS;
+		m = strnlen(buf, n);
+		if(out) {
+			output(pcpu, buf, m);
+			*newline |= memchr(buf, '\n', m) != NULL;
+		}
+		if(m < n) {
+			*len += m;
+			break;
+		}
+	}
+	return 0;
+}
+
+/**
+ * Output the arguments formatted by the host's printf according to spec.
+ * @return Number of bytes output.
+ */
+static int output_format(MIPS_CPU *pcpu, const char *spec, ...)
+{
+	char buf[128], *p = buf;
+	va_list ap;
+	int n;
+
+	va_start(ap, spec);
+	n = vsnprintf(buf, sizeof(buf), spec, ap);
+	va_end(ap);
+	if(n < 0)
+		return 0;
+	if((unsigned)n >= sizeof(buf)) {
+		if(!(p = malloc(n + 1)))
+			return 0;
+		va_start(ap, spec);
+		vsnprintf(p, n + 1, spec, ap);
+		va_end(ap);
+	}
+	output(pcpu, p, n);
+	if(p != buf)
+		free(p);
+	return n;
+}
+
+/** Output n spaces. */
+static void output_pad(MIPS_CPU *pcpu, unsigned n)
+{
+	static const char spaces[] = "                                ";
+	unsigned m;
+
+	for(; n; n -= m) {
+		m = n < sizeof(spaces) - 1 ? n : sizeof(spaces) - 1;
+		output(pcpu, spaces, m);
+	}
+}
+
+/**
+ * Fetch n words of printf arguments from the o32 argument block at *ap,
+ * which is advanced; a pair of words (long long) is 8-byte aligned.
+ */
+static int fetch_args(MIPS_CPU *pcpu, mips_uword *ap, unsigned n,
+					  mips_uword *arg)
+{
+	if(n == 2)
+		*ap = (*ap + 7) & ~7U;
+	if(mips_copyin(pcpu, arg, *ap, 4 * n) < 0)
+		return MIPS_E_ADDRESS;
+	*ap += 4 * n;
+	return 0;
+}
+
+/**
+ * Apply the flush policy at the end of a print service; newline tells
+ * whether the output contained a newline.
+ */
+static void output_done(MIPS_CPU *pcpu, int newline)
+{
+	struct mips_hostdata *host = pcpu->host;
+
+	if(!host)
+		return;
+	if(host->flush == MIPS_FLUSH_AUTO)
+		host->flush = isatty(STDOUT_FILENO) ? MIPS_FLUSH_LINE : MIPS_FLUSH_FULL;
+	if((host->flush == MIPS_FLUSH_ALWAYS) ||
+	   ((host->flush == MIPS_FLUSH_LINE) && newline))
+		mips_flush_output(pcpu);
+}
+
+/**
+ * Helper for the asynchronous read and write: submit the transfer of the
+ * part of the buffer after the first host->aio_done bytes.
+ */
+static int submit_rw(MIPS_CPU *pcpu, struct mips_aio *aio)
+{
+	struct mips_hostdata *host = pcpu->host;
+	mips_uword	buf		= pcpu->r.ur[5] + host->aio_done;
+	mips_uword	len		= pcpu->r.ur[6] - host->aio_done;
+	int			write	= pcpu->r.ur[2] == 15;
+	char		*p;
+
+	if(is_identity(pcpu)) {
+		p = pcpu->base + buf;
+	} else {
+		p = (char*)host->iobuf + (buf & 3);
+		if(len > IOBUF_SIZE)
+			len = IOBUF_SIZE;
+		if(write)
+			mips_copyin(pcpu, p, buf, len);
+	}
+	return mips_aio_submit(aio, pcpu, write ? MIPS_AIO_WRITE : MIPS_AIO_READ,
+						   pcpu->fds[pcpu->r.sr[4]], p, len, 0, 0);
+}
+
+/**
+ * Return the number of buffered bytes of standard input, reading a block from
+ * the host if there are none.  Pending output is flushed before waiting for
+ * input.
+ *
+ * @return Number of buffered bytes, 0 at end of file or on error, or -1 if
+ * the buffer cannot be allocated.
+ */
+static int input_fill(MIPS_CPU *pcpu)
+{
+	struct mips_hostdata *host = pcpu->host;
+	int n;
+
+	if(!host)
+		return -1;
+	if(host->inpos < host->inlen)
+		return host->inlen - host->inpos;
+	if(!host->inbuf && !(host->inbuf = malloc(INBUF_SIZE)))
+		return -1;
+	mips_flush_output(pcpu);
+	mips_idle_enter(pcpu);
+	n = read(pcpu->fds[0], host->inbuf, INBUF_SIZE);
+	mips_idle_leave(pcpu);
+	host->inpos = 0;
+	host->inlen = n > 0 ? n : 0;
+	return host->inlen;
+}
+
+/**
+ * Move up to len bytes of standard input to MIPS memory at addr, which must
+ * be a valid range.  If line is nonzero, the transfer stops after a newline
+ * and more input is read until one is found; otherwise only the buffered
+ * bytes are transferred, and input is read only if there are none.
+ *
+ * @param count Set to the number of transferred bytes; 0 at end of file.
+ * @return 0, or MIPS_E_ABORT if the buffer cannot be allocated.
+ */
+static int input_copy(MIPS_CPU *pcpu, mips_uword addr, mips_uword len,
+					  int line, mips_uword *count)
+{
+	struct mips_hostdata *host = pcpu->host;
+	mips_uword m, total = 0;
+	char *p, *nl = NULL;
+	int n;
+
+	while((total < len) && !nl) {
+		if((n = input_fill(pcpu)) < 0)
+			return MIPS_E_ABORT;
+		if(!n)
+			break;
+		p = host->inbuf + host->inpos;
+		m = len - total < (mips_uword)n ? len - total : (mips_uword)n;
+		if(line && (nl = memchr(p, '\n', m)))
+			m = nl - p + 1;
+		mips_copyout(pcpu, addr + total, p, m);
+		host->inpos += m;
+		total += m;
+		if(!line)
+			break;
+	}
+	*count = total;
+	return 0;
+}
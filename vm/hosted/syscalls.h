@@ -58,14 +58,143 @@ extern "C" {
  * @note File paths in open() are limited to 256 characters (including \0).
  * Longer filenames shall return MIPS_E_ADDRESS.
  *
- * @note read()/write() syscalls allocate memory.  malloc() failure is reported
- * through MIPS_E_ABORT return code.
+ * @note read()/write() syscalls transfer data directly between MIPS memory
+ * and the file unless the memory is transformed or compressed; then the data
+ * goes through a per-CPU buffer which is allocated on first use.  malloc()
+ * failure is reported through MIPS_E_ABORT return code.  A buffer which is
+ * not entirely within MIPS memory or which extends below MIPS_LOWBASE is
+ * reported through MIPS_E_ADDRESS.
+ *
+ * @note A ring entry has room for three arguments and $v0 only, so ring_kick
+ * rejects requests for gettime (service 3), which returns its high word in
+ * $v1, and for mmap (service 17), which takes its fourth argument in $a3, as
+ * well as nested ring_kick requests: their result word is set to -1 and the
+ * other entries are performed normally.
  */
 int mips_spim_syscall(MIPS_CPU *pcpu);
 
+/**
+ * Perform a SPIM service with the arguments in $a0-$a3 as if the CPU had
+ * executed a SYSCALL for it, but without one; used by native routines (see
+ * native.h).  $v0 is overwritten with the service number before the call.
+ * Like after a SYSCALL, the time page is refreshed (see mips_time_refresh).
+ *
+ * @return Same as mips_spim_syscall.
+ */
+int mips_spim_service(MIPS_CPU *pcpu, mips_uword service);
+
+struct mips_aio;
+struct mips_heap;
+
+/** Return value of mips_spim_syscall_async: the CPU has been parked. */
+#define MIPS_SPIM_PARKED	(-2)
+
+/**
+ * Process SPIM syscall like mips_spim_syscall, but submit open, read and
+ * write to an io_uring (see aio.h) instead of blocking the host thread.  The
+ * CPU is then parked: it must not be executed until mips_aio_reap returns
+ * it, and then it is resumed with mips_resume.  Other services, which are
+ * not expected to block for long, are processed synchronously; note that
+ * these include the reading SPIM services.
+ *
+ * @return MIPS_SPIM_PARKED if the CPU has been parked, otherwise the same
+ * as mips_spim_syscall.
+ */
+int mips_spim_syscall_async(MIPS_CPU *pcpu, struct mips_aio *aio);
+
+/**
+ * Continue a syscall submitted by mips_spim_syscall_async, whose host
+ * operation has returned res (negative errno on failure).  Called by
+ * mips_aio_reap.
+ *
+ * @return 1 if another operation has been submitted to aio (the rest of a
+ * short write), or 0 if the result has been stored in $v0 and the CPU is no
+ * longer parked.
+ */
+int mips_spim_syscall_complete(MIPS_CPU *pcpu, struct mips_aio *aio, int res);
+
+/**
+ * When output of the print services (print_int, print_string, print_char) is
+ * written to stdout.  The output is collected in a per-CPU buffer which is
+ * always flushed when it is full, before the CPU waits for input or writes
+ * to a file descriptor, and by mips_flush_output.
+ */
+enum mips_flush_policy {
+	MIPS_FLUSH_AUTO,					/**!< LINE if stdout is a tty, else FULL. */
+	MIPS_FLUSH_ALWAYS,					/**!< After every service call. */
+	MIPS_FLUSH_LINE,					/**!< After a newline. */
+	MIPS_FLUSH_FULL						/**!< Only in the cases listed above. */
+};
+
+/** Set the flush policy of print services; the default is MIPS_FLUSH_AUTO. */
+void mips_set_flush_policy(MIPS_CPU *pcpu, enum mips_flush_policy policy);
+
+/**
+ * Write out the buffered output of print services.  Must be called when the
+ * program stops (e.g. at BREAK) and before the host writes to stdout.
+ */
+void mips_flush_output(MIPS_CPU *pcpu);
+
+/** Instructions between time page refreshes done by the execution loops. */
+#define MIPS_TIME_TICK 1024
+
+/**
+ * Store the current time in the page registered by the time_map service, if
+ * any.  Called after every service call, and must be called by execution
+ * loops every MIPS_TIME_TICK instructions, so that the program can read the
+ * time without a syscall.  The refresh may fall between the loads of the two
+ * words, so a program must load the high word again and retry if it changed.
+ */
+void mips_time_refresh(MIPS_CPU *pcpu);
+
 /** Debug routine: print out CPU state to stdout. */
 void mips_dump_cpu(MIPS_CPU *pcpu);
 
+/**
+ * Host environment's private per-CPU data.  This is allocated outside of the
+ * MIPS memory, so that the program cannot tamper with it.
+ */
+struct mips_hostdata {
+	int			image_fd;			/**!< Memory image shared with clones. */
+	unsigned	*dedup_slots;		/**!< Shared store slot+1 of each page. */
+	struct mips_zcpu *zcpu;			/**!< Compressed memory state, or NULL. */
+	unsigned	nregions;			/**!< Number of file-backed regions. */
+	int			node;				/**!< NUMA node the CPU is placed on, or -1. */
+	mips_uword	*iobuf;				/**!< Staging buffer of read/write, or NULL. */
+	char		*outbuf;			/**!< Output of print services, or NULL. */
+	unsigned	outlen;				/**!< Number of bytes in outbuf. */
+	int			flush;				/**!< enum mips_flush_policy. */
+	char		*inbuf;				/**!< Buffered standard input, or NULL. */
+	unsigned	inpos;				/**!< Position of the next byte in inbuf. */
+	unsigned	inlen;				/**!< Number of bytes in inbuf. */
+	int			parked;				/**!< Service of the pending async syscall, or 0. */
+	mips_uword	aio_done;			/**!< Bytes written so far by the async write. */
+	unsigned long kicks;			/**!< Number of ring_kick calls. */
+	unsigned long ring_ops;			/**!< Requests performed by ring_kick. */
+	mips_uword	timepage;			/**!< Address given to time_map, or 0. */
+	struct mips_heap *heap;			/**!< Heap of malloc services, or NULL. */
+	struct mips_heap *heap_saved;	/**!< Heap at the baseline, or NULL. */
+	char		*baseline;			/**!< First page at the baseline, or NULL. */
+};
+
+/**
+ * Allocate and initialize host data for a CPU.  Called by mips_init_cpu; it
+ * must also be called whenever a CPU state is obtained by other means than
+ * mips_init_cpu (e.g. copied or mapped from a file), because the host pointer
+ * stored in it is then stale.  Tracking of modified pages and the instruction
+ * cache are disabled (pcpu->dirty and pcpu->icache are set to NULL).  On
+ * allocation failure, pcpu->host is NULL and the services which depend on it
+ * fail.
+ */
+void mips_init_hostdata(MIPS_CPU *pcpu);
+
+/**
+ * Release host data allocated by mips_init_hostdata, including the dirty
+ * page bitmap, instruction cache, compression state and NUMA placement.
+ * Buffered output is flushed first.
+ */
+void mips_free_hostdata(MIPS_CPU *pcpu);
+
 #ifdef	__cplusplus
 }
 #endif